@@ -5,6 +5,7 @@ section .asm
 global print:function
 global vana_sum:function
 global vana_getkey:function
+global vana_getkeyblock:function
 global vana_malloc:function
 global vana_free:function
 global vana_putchar:function
@@ -12,6 +13,19 @@ global vana_process_load_start:function
 global vana_system:function
 global vana_exit:function
 global vana_process_get_arguments:function
+global vana_mmap:function
+global vana_munmap:function
+global vana_open:function
+global vana_close:function
+global vana_pread:function
+global vana_pwrite:function
+global vana_readv:function
+global vana_writev:function
+global vana_io_ring_setup:function
+global vana_io_ring_enter:function
+global vana_getdents:function
+global vana_setpriority:function
+global vana_getpriority:function
 
 ; void print(const char* filename)
 print:
@@ -45,6 +59,16 @@ vana_getkey:
     pop ebp
     ret
 
+; int vana_getkeyblock()
+; Sleeps in the kernel until a key is pressed
+vana_getkeyblock:
+    push ebp
+    mov ebp, esp
+    mov eax, 23 ; Command 23 waits for a key
+    int 0x80
+    pop ebp
+    ret
+
 ; void vana_putchar(char c)
 vana_putchar:
     push ebp
@@ -120,3 +144,159 @@ vana_exit:
     int 0x80
     pop ebp
     ret
+
+; void* vana_mmap(const char* filename, unsigned int offset, unsigned int length)
+vana_mmap:
+    push ebp
+    mov ebp, esp
+    mov eax, 10 ; Command 10 maps a file into the process
+    push dword[ebp+16] ; Variable "length"
+    push dword[ebp+12] ; Variable "offset"
+    push dword[ebp+8] ; Variable "filename"
+    int 0x80
+    add esp, 12
+    pop ebp
+    ret
+
+; int vana_munmap(void* address)
+vana_munmap:
+    push ebp
+    mov ebp, esp
+    mov eax, 11 ; Command 11 removes a file mapping
+    push dword[ebp+8] ; Variable "address"
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; int vana_open(const char* filename, const char* mode)
+vana_open:
+    push ebp
+    mov ebp, esp
+    mov eax, 12 ; Command 12 opens a file
+    push dword[ebp+12] ; Variable "mode"
+    push dword[ebp+8] ; Variable "filename"
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
+; int vana_close(int fd)
+vana_close:
+    push ebp
+    mov ebp, esp
+    mov eax, 13 ; Command 13 closes a file
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
+
+; int vana_pread(int fd, void* buf, unsigned int count, unsigned int offset)
+vana_pread:
+    push ebp
+    mov ebp, esp
+    mov eax, 14 ; Command 14 reads at an offset
+    push dword[ebp+20] ; Variable "offset"
+    push dword[ebp+16] ; Variable "count"
+    push dword[ebp+12] ; Variable "buf"
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 16
+    pop ebp
+    ret
+
+; int vana_pwrite(int fd, const void* buf, unsigned int count, unsigned int offset)
+vana_pwrite:
+    push ebp
+    mov ebp, esp
+    mov eax, 15 ; Command 15 writes at an offset
+    push dword[ebp+20] ; Variable "offset"
+    push dword[ebp+16] ; Variable "count"
+    push dword[ebp+12] ; Variable "buf"
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 16
+    pop ebp
+    ret
+
+; int vana_readv(int fd, const struct vana_iovec* iov, int iovcnt)
+vana_readv:
+    push ebp
+    mov ebp, esp
+    mov eax, 16 ; Command 16 reads into several buffers
+    push dword[ebp+16] ; Variable "iovcnt"
+    push dword[ebp+12] ; Variable "iov"
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 12
+    pop ebp
+    ret
+
+; int vana_writev(int fd, const struct vana_iovec* iov, int iovcnt)
+vana_writev:
+    push ebp
+    mov ebp, esp
+    mov eax, 17 ; Command 17 writes from several buffers
+    push dword[ebp+16] ; Variable "iovcnt"
+    push dword[ebp+12] ; Variable "iov"
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 12
+    pop ebp
+    ret
+
+; struct vana_io_ring* vana_io_ring_setup()
+vana_io_ring_setup:
+    push ebp
+    mov ebp, esp
+    mov eax, 18 ; Command 18 sets up the I/O ring of the process
+    int 0x80
+    pop ebp
+    ret
+
+; int vana_io_ring_enter()
+vana_io_ring_enter:
+    push ebp
+    mov ebp, esp
+    mov eax, 19 ; Command 19 runs the requests queued in the I/O ring
+    int 0x80
+    pop ebp
+    ret
+
+; int vana_getdents(int fd, void* buf, unsigned int size)
+vana_getdents:
+    push ebp
+    mov ebp, esp
+    mov eax, 20 ; Command 20 lists an open directory
+    push dword[ebp+16] ; Variable "size"
+    push dword[ebp+12] ; Variable "buf"
+    push dword[ebp+8] ; Variable "fd"
+    int 0x80
+    add esp, 12
+    pop ebp
+    ret
+
+; int vana_setpriority(int pid, int nice)
+vana_setpriority:
+    push ebp
+    mov ebp, esp
+    mov eax, 21 ; Command 21 sets the nice value of a process
+    push dword[ebp+12] ; Variable "nice"
+    push dword[ebp+8] ; Variable "pid"
+    int 0x80
+    add esp, 8
+    pop ebp
+    ret
+
+; int vana_getpriority(int pid)
+; Returns 20 minus the nice value, or a negative status code
+vana_getpriority:
+    push ebp
+    mov ebp, esp
+    mov eax, 22 ; Command 22 reads the nice value of a process
+    push dword[ebp+8] ; Variable "pid"
+    int 0x80
+    add esp, 4
+    pop ebp
+    ret
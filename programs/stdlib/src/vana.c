@@ -1,5 +1,6 @@
 #include "vana.h"
 #include "string.h"
+#include "memory.h"
 
 struct command_argument* vana_parse_command(const char* command, int max)
 {
@@ -46,17 +47,6 @@ out:
     return root_command;
 }
 
-int vana_getkeyblock()
-{
-    int val = 0;
-    do
-    {
-        val = vana_getkey();
-    }
-    while(val == 0);
-    return val;
-}
-
 void vana_terminal_readline(char* out, int max, bool output_while_typing)
 {
     int i = 0;
@@ -103,3 +93,58 @@ int vana_system_run(const char* command)
 
     return vana_system(root_command_argument);
 }
+
+/*
+ * Add `increment` to the nice value of the calling process, as nice(3)
+ * does. The result is clamped to -20..19, which the kernel rejects values
+ * outside of.
+ * Returns the new nice value.
+ */
+int vana_nice(int increment)
+{
+    int nice = 20 - vana_getpriority(VANA_PRIORITY_SELF) + increment;
+    if (nice < -20)
+    {
+        nice = -20;
+    }
+    else if (nice > 19)
+    {
+        nice = 19;
+    }
+    vana_setpriority(VANA_PRIORITY_SELF, nice);
+    return 20 - vana_getpriority(VANA_PRIORITY_SELF);
+}
+
+/*
+ * Queue a request in the I/O ring and return its cleared slot to fill in,
+ * or NULL if the submission ring is full. Queued requests run on the next
+ * vana_io_ring_enter().
+ */
+struct vana_io_ring_sqe* vana_io_ring_get_sqe(struct vana_io_ring* ring)
+{
+    if (ring->sq_tail - ring->sq_head >= ring->entries)
+    {
+        return 0;
+    }
+
+    struct vana_io_ring_sqe* sqe = &ring->sq[ring->sq_tail & (ring->entries - 1)];
+    memset(sqe, 0, sizeof(struct vana_io_ring_sqe));
+    ring->sq_tail++;
+    return sqe;
+}
+
+/*
+ * Take the oldest completion off the I/O ring.
+ * Returns false if no request has completed since the last call.
+ */
+bool vana_io_ring_get_cqe(struct vana_io_ring* ring, struct vana_io_ring_cqe* cqe)
+{
+    if (ring->cq_head == ring->cq_tail)
+    {
+        return false;
+    }
+
+    *cqe = ring->cq[ring->cq_head & (ring->entries - 1)];
+    ring->cq_head++;
+    return true;
+}
@@ -15,6 +15,78 @@ struct process_arguments
     char** argv;
 };
 
+// One buffer of vana_readv() or vana_writev()
+struct vana_iovec
+{
+    void* base;
+    unsigned int length;
+};
+
+// Record filled in by vana_getdents(). Records are packed back to back;
+// step to the next one with `record_length`.
+#define VANA_DIRENT_FILE 0
+#define VANA_DIRENT_DIRECTORY 1
+
+struct vana_dirent
+{
+    unsigned short record_length;
+    unsigned char type;
+    unsigned char name_length;
+    unsigned int size;
+    unsigned int first_cluster;
+    char name[];
+} __attribute__((packed));
+
+// Process id naming the caller in the priority calls
+#define VANA_PRIORITY_SELF -1
+
+// I/O ring shared with the kernel, see vana_io_ring_setup()
+#define VANA_IO_RING_ENTRIES 64
+#define VANA_IO_RING_AT_POSITION 0xFFFFFFFF
+
+enum
+{
+    VANA_IO_RING_OP_NOP = 0,
+    VANA_IO_RING_OP_OPEN,
+    VANA_IO_RING_OP_CLOSE,
+    VANA_IO_RING_OP_READ,
+    VANA_IO_RING_OP_WRITE
+};
+
+struct vana_io_ring_sqe
+{
+    unsigned char opcode;
+    unsigned char reserved[3];
+    int fd;
+    // Data buffer, or the path to open
+    void* buffer;
+    unsigned int length;
+    // File offset, or VANA_IO_RING_AT_POSITION to use the file's position
+    unsigned int offset;
+    // Open mode: 'r', 'w' or 'a'
+    unsigned int mode;
+    unsigned int user_data;
+    unsigned int reserved2;
+};
+
+struct vana_io_ring_cqe
+{
+    unsigned int user_data;
+    int result;
+};
+
+struct vana_io_ring
+{
+    unsigned int sq_head;
+    unsigned int sq_tail;
+    unsigned int cq_head;
+    unsigned int cq_tail;
+    unsigned int entries;
+    unsigned int reserved;
+    struct vana_io_ring_sqe sq[VANA_IO_RING_ENTRIES];
+    struct vana_io_ring_cqe cq[VANA_IO_RING_ENTRIES];
+};
+
 void print(const char* filename);
 int vana_getkey();
 int vana_sum(int a, int b);
@@ -30,5 +102,21 @@ void vana_process_get_arguments(struct process_arguments* arguments);
 int vana_system(struct command_argument* arguments);
 int vana_system_run(const char* command);
 void vana_exit();
+void* vana_mmap(const char* filename, unsigned int offset, unsigned int length);
+int vana_munmap(void* address);
+int vana_open(const char* filename, const char* mode);
+int vana_close(int fd);
+int vana_pread(int fd, void* buf, unsigned int count, unsigned int offset);
+int vana_pwrite(int fd, const void* buf, unsigned int count, unsigned int offset);
+int vana_readv(int fd, const struct vana_iovec* iov, int iovcnt);
+int vana_writev(int fd, const struct vana_iovec* iov, int iovcnt);
+int vana_getdents(int fd, void* buf, unsigned int size);
+int vana_setpriority(int pid, int nice);
+int vana_getpriority(int pid);
+int vana_nice(int increment);
+struct vana_io_ring* vana_io_ring_setup();
+int vana_io_ring_enter();
+struct vana_io_ring_sqe* vana_io_ring_get_sqe(struct vana_io_ring* ring);
+bool vana_io_ring_get_cqe(struct vana_io_ring* ring, struct vana_io_ring_cqe* cqe);
 
 #endif
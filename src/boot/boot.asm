@@ -1,6 +1,17 @@
 ORG 0x7c00
 BITS 16
 
+; Sectors reserved for the kernel behind the boot sector, passed in by the
+; Makefile, which also checks that kernel.bin fits
+%ifndef KERNEL_SECTORS
+%error "KERNEL_SECTORS must be defined, build with make"
+%endif
+
+; The kernel is loaded at 0x100000 and the initrd at 0x700000
+%if KERNEL_SECTORS * 512 > 0x700000 - 0x100000
+%error "KERNEL_SECTORS overlaps the initrd load address"
+%endif
+
 CODE_SEG equ gdt_code - gdt_start
 DATA_SEG equ gdt_data - gdt_start
 
@@ -12,7 +23,7 @@ _start:
 OEMIdentifier           db 'VANAOS  '
 BytesPerSector          dw 0x200
 SectorsPerCluster       db 0x80
-ReservedSectors         dw 200
+ReservedSectors         dw KERNEL_SECTORS + 1
 FATCopies               db 0x02
 RootDirEntries          dw 0x40
 NumSectors              dw 0x00
@@ -97,15 +108,41 @@ gdt_descriptor:
     or al, 2
     out 0x92, al
 
-    ; For the loading...
+    ; Load the whole reserved area behind the boot sector as the kernel
     mov eax, 1
-    mov ecx, 100
+    mov esi, KERNEL_SECTORS
     mov edi, 0x0100000
+    call ata_lba_read_all
 
+    ; Load the optional initial RAM disk
+    mov eax, [InitrdLBA]
+    mov esi, [InitrdSectors]
+    mov edi, 0x0700000
+    call ata_lba_read_all
 
-    call ata_lba_read
     jmp CODE_SEG:0x0100000
 
+; Read ESI sectors from LBA EAX to EDI in chunks of 128 sectors, as the
+; sector count register holds at most 255
+ata_lba_read_all:
+    test esi, esi
+    jz .done
+    mov ecx, esi
+    cmp ecx, 128
+    jbe .read_chunk
+    mov ecx, 128
+.read_chunk:
+    sub esi, ecx
+    push eax
+    push ecx
+    call ata_lba_read
+    pop ecx
+    pop eax
+    add eax, ecx
+    jmp ata_lba_read_all
+.done:
+    ret
+
 ata_lba_read:
     mov ebx, eax, ; Backup the LBA
     ; Send the highest 8 bits of the lba to hard disk controller
@@ -165,5 +202,9 @@ ata_lba_read:
     ; End of reading sectors into memory
     ret
 
-times 510-($ - $$) db 0
+; Location of the initial RAM disk, patched into the image by the Makefile.
+; Zero sectors means no initrd is present.
+times 502-($ - $$) db 0
+InitrdLBA               dd 0
+InitrdSectors           dd 0
 dw 0xAA55
@@ -14,12 +14,53 @@
 #define VANA_HEAP_TABLE_ADDRESS 0x00007E00
 
 #define VANA_SECTOR_SIZE 512
+#define VANA_MAX_DISKS 8
+// Pending requests held by each disk's request queue
+#define VANA_DISK_QUEUE_DEPTH 32
+// Dispatches a queued request may be passed over by the elevator
+#define VANA_DISK_QUEUE_DEADLINE 16
+// Sectors held by each disk's block cache and its hash table size
+#define VANA_BCACHE_BLOCKS 128
+#define VANA_BCACHE_BUCKETS 32
+#define VANA_MAX_PCI_DEVICES 64
+
+// The bootloader stays resident and records where it loaded the initrd
+#define VANA_BOOT_SECTOR_ADDRESS 0x7C00
+#define VANA_BOOT_INITRD_SECTORS_OFFSET 506
+// The initrd is loaded into the free memory between the kernel stacks and the heap
+#define VANA_INITRD_ADDRESS 0x700000
+#define VANA_INITRD_MAX_SECTORS ((VANA_HEAP_ADDRESS - VANA_INITRD_ADDRESS) / VANA_SECTOR_SIZE)
 
 #define VANA_MAX_FILESYSTEMS 12
-#define VANA_MAX_FILE_DESCRIPTORS 512
+// Entries of the mount table and the drive numbers paths can name (0-9)
+#define VANA_MAX_MOUNTS 16
+#define VANA_MAX_DRIVES 10
+// Files each process, and the kernel itself, may have open at once. A
+// multiple of 32, the width of a word of the descriptor bitmap.
+#define VANA_MAX_FILE_DESCRIPTORS 64
 
 #define VANA_MAX_PATH 108
 
+// Directory entries kept in the dentry cache and its hash table size
+#define VANA_DCACHE_ENTRIES 128
+#define VANA_DCACHE_BUCKETS 64
+
+// File pages held by the page cache (4 KiB each) and its hash table size
+#define VANA_PCACHE_PAGES 1024
+#define VANA_PCACHE_BUCKETS 256
+
+// FAT32 tables are read on demand in groups of this many sectors
+#define VANA_FAT_TABLE_READAHEAD 8
+// FAT32 table groups kept in memory per volume, least recently used evicted
+#define VANA_FAT_TABLE_GROUPS 256
+// Clusters a FAT32 allocation looks past the first free one for a longer run
+#define VANA_FAT32_RUN_SEARCH 1024
+
+// File data pages a tmpfs volume may allocate (4 KiB each)
+#define VANA_TMPFS_MAX_PAGES 4096
+// Hash buckets of a new tmpfs directory, doubled as it fills up
+#define VANA_TMPFS_DIRECTORY_BUCKETS 8
+
 #define VANA_TOTAL_GDT_SEGMENTS 6
 
 #define VANA_PROGRAM_VIRTUAL_ADDRESS 0x400000
@@ -28,12 +69,41 @@
 #define VANA_PROGRAM_VIRTUAL_STACK_ADDRESS_END VANA_PROGRAM_VIRTUAL_STACK_ADDRESS_START - VANA_USER_PROGRAM_STACK_SIZE
 
 #define VANA_MAX_PROGRAM_ALLOCATIONS 1024
+// Files a process may have mapped at once and the part of its address
+// space mmap places them in
+#define VANA_MAX_PROCESS_MAPPINGS 16
+#define VANA_MMAP_VIRTUAL_ADDRESS 0x40000000
+#define VANA_MMAP_VIRTUAL_END 0x80000000
 #define VANA_MAX_PROCESSES 12
 
+// Rate of the timer interrupt and the timer ticks a task may run before
+// the scheduler moves on to the next one
+#define VANA_TIMER_HZ 100
+#define VANA_TASK_TIME_SLICE_TICKS 5
+
+// Scheduler priority levels, at most 32 so one word maps the run queues.
+// Nice values pick the starting level and tasks that use up their slices
+// sink up to VANA_TASK_FEEDBACK_LEVELS - 1 levels below it, with a slice
+// one VANA_TASK_TIME_SLICE_TICKS longer per level, until every penalty is
+// cleared each VANA_TASK_BOOST_TICKS ticks.
+#define VANA_TASK_PRIORITIES 32
+#define VANA_TASK_FEEDBACK_LEVELS 4
+#define VANA_TASK_BOOST_TICKS 100
+#define VANA_TASK_NICE_MIN -20
+#define VANA_TASK_NICE_MAX 19
+
+// Kernel stack of the idle task, which only halts and handles interrupts
+#define VANA_TASK_IDLE_STACK_SIZE 4096
+
 #define USER_DATA_SEGMENT 0x23
 #define USER_CODE_SEGMENT 0x1b
 
 #define VANA_MAX_ISR80H_COMMANDS 1024
+// Buffers a single readv or writev system call may name
+#define VANA_MAX_IOVECS 16
+// Entries of each queue of a process's I/O ring, a power of two small
+// enough for the ring to fit one page
+#define VANA_IO_RING_ENTRIES 64
 
 #define VANA_KEYBOARD_BUFFER_SIZE 1024
 
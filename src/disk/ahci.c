@@ -0,0 +1,527 @@
+/*
+ * AHCI SATA driver.
+ *
+ * The controller is located on the PCI bus by its class code and exposes
+ * its registers through the memory mapped ABAR (BAR5). Every implemented
+ * port with an attached ATA drive receives:
+ *
+ *   - a command list of 32 command headers (1 KiB aligned),
+ *   - a received FIS area (256 byte aligned),
+ *   - one command table per slot holding the command FIS and the PRDT
+ *     scatter list describing the data buffer.
+ *
+ * The kernel heap hands out 4 KiB aligned blocks and kernel memory is
+ * identity mapped, so buffer addresses can be given to the HBA directly.
+ *
+ * When both the HBA and the drive support Native Command Queuing, large
+ * transfers are split into several READ/WRITE FPDMA QUEUED commands that
+ * occupy up to 32 slots at once. The drive is then free to complete them in
+ * whatever order suits its media. Drives without NCQ use one READ/WRITE DMA
+ * EXT command per request, and drives without LBA48 the 28-bit READ/WRITE
+ * DMA commands. The flush callback issues FLUSH CACHE (EXT) to commit the
+ * drive's write cache. Completion is detected by polling PxCI/PxSACT since the disk API
+ * is synchronous and system calls run with interrupts disabled.
+ *
+ * Each port is registered as a `struct disk` so filesystems work unchanged.
+ */
+#include "ahci.h"
+#include "disk.h"
+#include "config.h"
+#include "status.h"
+#include "pci/pci.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+// Iterations to spin on a register before giving up on the device
+#define AHCI_SPIN_TIMEOUT 10000000
+
+struct ahci_port
+{
+    volatile struct ahci_hba_port* regs;
+
+    struct ahci_command_header* command_list;
+    void* received_fis;
+    struct ahci_command_table* command_tables;
+
+    // Command slots usable on this port
+    int slots;
+
+    // Non-zero when the FPDMA QUEUED commands may be used
+    int ncq;
+
+    // Non-zero when the drive supports the 48-bit EXT commands
+    int lba48;
+
+    uint32_t total_sectors;
+
+    struct disk disk;
+};
+
+static volatile struct ahci_hba_memory* ahci_hba = 0;
+static int ahci_hba_slots = 0;
+
+/*
+ * Stop the command engine and FIS receive so the command list and FIS
+ * pointers can be safely reprogrammed.
+ */
+static int ahci_port_stop(volatile struct ahci_hba_port* regs)
+{
+    regs->cmd &= ~AHCI_PORT_CMD_ST;
+    regs->cmd &= ~AHCI_PORT_CMD_FRE;
+
+    for (int i = 0; i < AHCI_SPIN_TIMEOUT; i++)
+    {
+        if (!(regs->cmd & (AHCI_PORT_CMD_FR | AHCI_PORT_CMD_CR)))
+        {
+            return 0;
+        }
+    }
+
+    return -EIO;
+}
+
+/* Restart FIS receive and the command engine. */
+static void ahci_port_start(volatile struct ahci_hba_port* regs)
+{
+    while (regs->cmd & AHCI_PORT_CMD_CR) {}
+
+    regs->cmd |= AHCI_PORT_CMD_FRE;
+    regs->cmd |= AHCI_PORT_CMD_ST;
+}
+
+/*
+ * Bring a port back into a usable state after a task file error. Any
+ * outstanding commands are aborted by the engine restart.
+ */
+static void ahci_port_recover(struct ahci_port* port)
+{
+    ahci_port_stop(port->regs);
+    port->regs->serr = 0xFFFFFFFF;
+    port->regs->is = 0xFFFFFFFF;
+    ahci_port_start(port->regs);
+}
+
+/*
+ * Allocate the command list, received FIS area and command tables for a
+ * port and point the HBA at them.
+ */
+static int ahci_port_rebase(struct ahci_port* port)
+{
+    int res = ahci_port_stop(port->regs);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    port->command_list = kzalloc(sizeof(struct ahci_command_header) * AHCI_MAX_SLOTS);
+    port->received_fis = kzalloc(256);
+    port->command_tables = kzalloc(sizeof(struct ahci_command_table) * AHCI_MAX_SLOTS);
+    if (!port->command_list || !port->received_fis || !port->command_tables)
+    {
+        return -ENOMEM;
+    }
+
+    for (int i = 0; i < AHCI_MAX_SLOTS; i++)
+    {
+        port->command_list[i].ctba = (uint32_t)&port->command_tables[i];
+        port->command_list[i].ctbau = 0;
+    }
+
+    port->regs->clb = (uint32_t)port->command_list;
+    port->regs->clbu = 0;
+    port->regs->fb = (uint32_t)port->received_fis;
+    port->regs->fbu = 0;
+    port->regs->serr = 0xFFFFFFFF;
+    port->regs->is = 0xFFFFFFFF;
+    port->regs->ie = 0;
+
+    ahci_port_start(port->regs);
+    return 0;
+}
+
+/* True for the NCQ commands, which are tracked through PxSACT. */
+static int ahci_command_queued(uint8_t command)
+{
+    return command == ATA_CMD_READ_FPDMA_QUEUED || command == ATA_CMD_WRITE_FPDMA_QUEUED;
+}
+
+/* True for the 28-bit commands, which keep LBA bits 27:24 in the device field. */
+static int ahci_command_lba28(uint8_t command)
+{
+    return command == ATA_CMD_READ_DMA || command == ATA_CMD_WRITE_DMA || command == ATA_CMD_FLUSH_CACHE;
+}
+
+/* True for commands that move data from memory to the drive. */
+static int ahci_command_writes(uint8_t command)
+{
+    return command == ATA_CMD_WRITE_DMA || command == ATA_CMD_WRITE_DMA_EXT || command == ATA_CMD_WRITE_FPDMA_QUEUED;
+}
+
+/*
+ * Build and issue a command in the given slot without waiting for it.
+ *
+ * @param command  ATA command opcode.
+ * @param lba      First sector of the transfer.
+ * @param count    Sector count placed in the FIS.
+ * @param buf      Data buffer, must be physically contiguous.
+ * @param bytes    Length of the buffer in bytes.
+ * @return         Zero once the command was handed to the HBA.
+ */
+static int ahci_port_issue(struct ahci_port* port, int slot, uint8_t command, unsigned int lba, int count, void* buf, uint32_t bytes)
+{
+    struct ahci_command_header* header = &port->command_list[slot];
+    struct ahci_command_table* table = &port->command_tables[slot];
+    memset(table, 0, sizeof(struct ahci_command_table));
+
+    int entries = 0;
+    uint32_t address = (uint32_t)buf;
+    while (bytes > 0)
+    {
+        if (entries >= AHCI_PRDT_ENTRIES)
+        {
+            return -EINVARG;
+        }
+
+        uint32_t chunk = bytes > AHCI_PRDT_MAX_BYTES ? AHCI_PRDT_MAX_BYTES : bytes;
+        table->prdt[entries].dba = address;
+        table->prdt[entries].dbau = 0;
+        table->prdt[entries].dbc = chunk - 1;
+        table->prdt[entries].i = 0;
+        address += chunk;
+        bytes -= chunk;
+        entries++;
+    }
+
+    header->cfl = sizeof(struct ahci_fis_reg_h2d) / sizeof(uint32_t);
+    header->w = ahci_command_writes(command);
+    header->prdtl = entries;
+    header->prdbc = 0;
+
+    struct ahci_fis_reg_h2d* fis = (struct ahci_fis_reg_h2d*)table->cfis;
+    fis->fis_type = AHCI_FIS_TYPE_REG_H2D;
+    fis->c = 1;
+    fis->command = command;
+    fis->lba0 = lba & 0xFF;
+    fis->lba1 = (lba >> 8) & 0xFF;
+    fis->lba2 = (lba >> 16) & 0xFF;
+    fis->lba3 = (lba >> 24) & 0xFF;
+    fis->lba4 = 0;
+    fis->lba5 = 0;
+
+    if (ahci_command_queued(command))
+    {
+        // NCQ commands carry the count in the feature field and the tag
+        // in bits 7:3 of the count field
+        fis->device = 0x40;
+        fis->featurel = count & 0xFF;
+        fis->featureh = (count >> 8) & 0xFF;
+        fis->countl = slot << 3;
+        fis->counth = 0;
+    }
+    else if (ahci_command_lba28(command))
+    {
+        fis->device = 0x40 | ((lba >> 24) & 0x0F);
+        fis->lba3 = 0;
+        fis->countl = count & 0xFF;
+        fis->counth = 0;
+    }
+    else
+    {
+        fis->device = command == ATA_CMD_IDENTIFY ? 0 : 0x40;
+        fis->countl = count & 0xFF;
+        fis->counth = (count >> 8) & 0xFF;
+    }
+
+    // Non-queued commands may only be issued while the device is idle
+    if (!ahci_command_queued(command))
+    {
+        int spin = 0;
+        while ((port->regs->tfd & (AHCI_PORT_TFD_BSY | AHCI_PORT_TFD_DRQ)) && spin < AHCI_SPIN_TIMEOUT)
+        {
+            spin++;
+        }
+
+        if (spin == AHCI_SPIN_TIMEOUT)
+        {
+            return -EIO;
+        }
+    }
+    else
+    {
+        port->regs->sact = 1U << slot;
+    }
+
+    port->regs->ci = 1U << slot;
+    return 0;
+}
+
+/*
+ * Poll until every slot in `mask` has completed. Queued commands are done
+ * once their PxSACT bit clears, others once their PxCI bit clears.
+ */
+static int ahci_port_wait(struct ahci_port* port, uint32_t mask)
+{
+    for (int i = 0; i < AHCI_SPIN_TIMEOUT; i++)
+    {
+        if (port->regs->is & AHCI_PORT_IS_TFES)
+        {
+            ahci_port_recover(port);
+            return -EIO;
+        }
+
+        if (!((port->regs->ci | port->regs->sact) & mask))
+        {
+            return 0;
+        }
+    }
+
+    ahci_port_recover(port);
+    return -EIO;
+}
+
+/*
+ * Identify the drive attached to a port and decide whether the 48-bit
+ * commands and NCQ can be used. Drives without LBA48 report their size in
+ * words 60-61 only. The queue depth reported by the drive caps the usable
+ * slots.
+ */
+static int ahci_port_identify(struct ahci_port* port)
+{
+    uint16_t* identify = kzalloc(VANA_SECTOR_SIZE);
+    if (!identify)
+    {
+        return -ENOMEM;
+    }
+
+    int res = ahci_port_issue(port, 0, ATA_CMD_IDENTIFY, 0, 0, identify, VANA_SECTOR_SIZE);
+    if (res == 0)
+    {
+        res = ahci_port_wait(port, 1);
+    }
+
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    port->total_sectors = identify[ATA_IDENTIFY_LBA28_SECTORS] |
+                          (identify[ATA_IDENTIFY_LBA28_SECTORS + 1] << 16);
+    port->lba48 = 0;
+    if (identify[ATA_IDENTIFY_COMMAND_SETS] & ATA_IDENTIFY_LBA48_SUPPORTED)
+    {
+        port->lba48 = 1;
+        // Words 100-103 hold a 64-bit count, only the low 32 bits are kept
+        port->total_sectors = identify[ATA_IDENTIFY_LBA48_SECTORS] |
+                              (identify[ATA_IDENTIFY_LBA48_SECTORS + 1] << 16);
+    }
+
+    port->slots = ahci_hba_slots;
+    port->ncq = 0;
+    // The FPDMA QUEUED commands carry a 48-bit address
+    if (port->lba48 && (ahci_hba->cap & AHCI_CAP_NCQ) &&
+        (identify[ATA_IDENTIFY_SATA_CAPABILITIES] & ATA_IDENTIFY_SATA_NCQ))
+    {
+        int depth = (identify[ATA_IDENTIFY_QUEUE_DEPTH] & 0x1F) + 1;
+        port->ncq = 1;
+        if (depth < port->slots)
+        {
+            port->slots = depth;
+        }
+    }
+
+out:
+    kfree(identify);
+    return res;
+}
+
+/*
+ * Move sectors between memory and the drive.
+ *
+ * With NCQ the request is cut into AHCI_NCQ_SECTORS_PER_COMMAND sized
+ * commands and every free slot is filled before waiting, so up to 32
+ * commands are outstanding. Without NCQ each command covers as much of
+ * the request as the PRDT allows, or 256 sectors on drives without LBA48,
+ * and completes before the next is issued.
+ */
+static int ahci_transfer(struct disk* disk, unsigned int lba, int total, void* buf, int write)
+{
+    int res = 0;
+    struct ahci_port* port = disk->driver_private;
+    char* out = buf;
+    int slots = port->ncq ? port->slots : 1;
+    int per_command = port->ncq ? AHCI_NCQ_SECTORS_PER_COMMAND : AHCI_MAX_SECTORS_PER_COMMAND;
+    uint8_t command;
+    if (!port->lba48)
+    {
+        if (lba + total - 1 > AHCI_LBA28_MAX_LBA)
+        {
+            return -EINVARG;
+        }
+
+        per_command = AHCI_LBA28_MAX_SECTORS;
+        command = write ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA;
+    }
+    else if (write)
+    {
+        command = port->ncq ? ATA_CMD_WRITE_FPDMA_QUEUED : ATA_CMD_WRITE_DMA_EXT;
+    }
+    else
+    {
+        command = port->ncq ? ATA_CMD_READ_FPDMA_QUEUED : ATA_CMD_READ_DMA_EXT;
+    }
+
+    while (total > 0)
+    {
+        uint32_t mask = 0;
+        for (int slot = 0; slot < slots && total > 0; slot++)
+        {
+            int count = total > per_command ? per_command : total;
+            res = ahci_port_issue(port, slot, command, lba, count, out, count * disk->sector_size);
+            if (res < 0)
+            {
+                break;
+            }
+
+            mask |= 1U << slot;
+            lba += count;
+            total -= count;
+            out += count * disk->sector_size;
+        }
+
+        int wait_res = ahci_port_wait(port, mask);
+        if (res == 0)
+        {
+            res = wait_res;
+        }
+
+        if (res < 0)
+        {
+            break;
+        }
+    }
+
+    return res;
+}
+
+/* Disk layer read callback. */
+static int ahci_read(struct disk* disk, unsigned int lba, int total, void* buf)
+{
+    return ahci_transfer(disk, lba, total, buf, 0);
+}
+
+/* Disk layer write callback. */
+static int ahci_write(struct disk* disk, unsigned int lba, int total, const void* buf)
+{
+    return ahci_transfer(disk, lba, total, (void*)buf, 1);
+}
+
+/* Disk layer flush callback: commit the drive's write cache to the media. */
+static int ahci_flush(struct disk* disk)
+{
+    struct ahci_port* port = disk->driver_private;
+    int res = ahci_port_issue(port, 0, port->lba48 ? ATA_CMD_FLUSH_CACHE_EXT : ATA_CMD_FLUSH_CACHE, 0, 0, 0, 0);
+    if (res == 0)
+    {
+        res = ahci_port_wait(port, 1);
+    }
+    return res;
+}
+
+/* Return non-zero if an active ATA drive is attached to the port. */
+static int ahci_port_has_drive(volatile struct ahci_hba_port* regs)
+{
+    uint32_t ssts = regs->ssts;
+    uint8_t det = ssts & 0x0F;
+    uint8_t ipm = (ssts >> 8) & 0x0F;
+    if (det != AHCI_PORT_SSTS_DET_PRESENT || ipm != AHCI_PORT_SSTS_IPM_ACTIVE)
+    {
+        return 0;
+    }
+
+    return regs->sig == AHCI_SIG_ATA;
+}
+
+/* Initialise a port with an attached drive and register it as a disk. */
+static int ahci_probe_port(int index)
+{
+    int res = 0;
+    struct ahci_port* port = kzalloc(sizeof(struct ahci_port));
+    if (!port)
+    {
+        return -ENOMEM;
+    }
+
+    port->regs = &ahci_hba->ports[index];
+    res = ahci_port_rebase(port);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    res = ahci_port_identify(port);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    port->disk.type = VANA_DISK_TYPE_REAL;
+    port->disk.sector_size = VANA_SECTOR_SIZE;
+    port->disk.read = ahci_read;
+    port->disk.write = ahci_write;
+    port->disk.flush = ahci_flush;
+    port->disk.driver_private = port;
+    res = disk_register(&port->disk);
+
+out:
+    if (res < 0)
+    {
+        // A port that failed to initialise must not keep DMA pointers to
+        // memory we are about to release
+        ahci_port_stop(port->regs);
+        if (port->command_list)
+        {
+            kfree(port->command_list);
+        }
+        if (port->received_fis)
+        {
+            kfree(port->received_fis);
+        }
+        if (port->command_tables)
+        {
+            kfree(port->command_tables);
+        }
+        kfree(port);
+    }
+    return res;
+}
+
+/*
+ * Locate the first AHCI controller, switch it to AHCI mode and register a
+ * disk for every port that has an ATA drive attached.
+ *
+ * @return Zero when a controller was found, -EIO otherwise.
+ */
+int ahci_init()
+{
+    struct pci_device* device = pci_find_class(AHCI_PCI_CLASS, AHCI_PCI_SUBCLASS, AHCI_PCI_PROG_IF, 0);
+    if (!device)
+    {
+        return -EIO;
+    }
+
+    pci_enable(device, PCI_COMMAND_MEMORY_SPACE | PCI_COMMAND_BUS_MASTER);
+    ahci_hba = (volatile struct ahci_hba_memory*)pci_get_bar(device, AHCI_PCI_ABAR);
+    ahci_hba->ghc |= AHCI_GHC_AHCI_ENABLE;
+    ahci_hba_slots = ((ahci_hba->cap >> AHCI_CAP_SLOTS_SHIFT) & AHCI_CAP_SLOTS_MASK) + 1;
+
+    uint32_t implemented = ahci_hba->pi;
+    for (int i = 0; i < AHCI_MAX_PORTS; i++)
+    {
+        if ((implemented & (1U << i)) && ahci_port_has_drive(&ahci_hba->ports[i]))
+        {
+            ahci_probe_port(i);
+        }
+    }
+
+    return 0;
+}
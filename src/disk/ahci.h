@@ -0,0 +1,179 @@
+#ifndef AHCI_H
+#define AHCI_H
+
+#include <stdint.h>
+
+// PCI class triple of an AHCI 1.0 compatible SATA controller
+#define AHCI_PCI_CLASS 0x01
+#define AHCI_PCI_SUBCLASS 0x06
+#define AHCI_PCI_PROG_IF 0x01
+
+// The HBA register block is exposed through BAR5 (ABAR)
+#define AHCI_PCI_ABAR 5
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_MAX_SLOTS 32
+
+// Number of PRDT entries reserved in each command table. Each entry covers
+// up to 4 MiB so eight entries describe the largest 65536 sector transfer.
+#define AHCI_PRDT_ENTRIES 8
+#define AHCI_PRDT_MAX_BYTES (4 * 1024 * 1024)
+
+// NCQ splits large reads into commands of this size so several slots are
+// in flight at once and the drive can service them in any order.
+#define AHCI_NCQ_SECTORS_PER_COMMAND 256
+#define AHCI_MAX_SECTORS_PER_COMMAND 65536
+// A zero sector count means 256 sectors for the 28-bit commands
+#define AHCI_LBA28_MAX_SECTORS 256
+#define AHCI_LBA28_MAX_LBA 0x0FFFFFFF
+
+#define AHCI_GHC_AHCI_ENABLE (1 << 31)
+#define AHCI_CAP_NCQ (1 << 30)
+#define AHCI_CAP_SLOTS_SHIFT 8
+#define AHCI_CAP_SLOTS_MASK 0x1F
+
+#define AHCI_PORT_CMD_ST 0x0001
+#define AHCI_PORT_CMD_FRE 0x0010
+#define AHCI_PORT_CMD_FR 0x4000
+#define AHCI_PORT_CMD_CR 0x8000
+
+#define AHCI_PORT_IS_TFES (1 << 30)
+
+#define AHCI_PORT_TFD_ERR 0x01
+#define AHCI_PORT_TFD_DRQ 0x08
+#define AHCI_PORT_TFD_BSY 0x80
+
+#define AHCI_PORT_SSTS_DET_PRESENT 0x03
+#define AHCI_PORT_SSTS_IPM_ACTIVE 0x01
+
+#define AHCI_SIG_ATA 0x00000101
+
+#define AHCI_FIS_TYPE_REG_H2D 0x27
+
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH_CACHE 0xE7
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_FPDMA_QUEUED 0x60
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_FPDMA_QUEUED 0x61
+#define ATA_CMD_FLUSH_CACHE_EXT 0xEA
+#define ATA_CMD_IDENTIFY 0xEC
+
+// IDENTIFY DEVICE words describing queueing support
+#define ATA_IDENTIFY_QUEUE_DEPTH 75
+#define ATA_IDENTIFY_SATA_CAPABILITIES 76
+#define ATA_IDENTIFY_SATA_NCQ (1 << 8)
+#define ATA_IDENTIFY_LBA28_SECTORS 60
+#define ATA_IDENTIFY_COMMAND_SETS 83
+#define ATA_IDENTIFY_LBA48_SUPPORTED (1 << 10)
+#define ATA_IDENTIFY_LBA48_SECTORS 100
+
+struct ahci_hba_port
+{
+    uint32_t clb;
+    uint32_t clbu;
+    uint32_t fb;
+    uint32_t fbu;
+    uint32_t is;
+    uint32_t ie;
+    uint32_t cmd;
+    uint32_t reserved0;
+    uint32_t tfd;
+    uint32_t sig;
+    uint32_t ssts;
+    uint32_t sctl;
+    uint32_t serr;
+    uint32_t sact;
+    uint32_t ci;
+    uint32_t sntf;
+    uint32_t fbs;
+    uint32_t reserved1[11];
+    uint32_t vendor[4];
+} __attribute__((packed));
+
+struct ahci_hba_memory
+{
+    uint32_t cap;
+    uint32_t ghc;
+    uint32_t is;
+    uint32_t pi;
+    uint32_t vs;
+    uint32_t ccc_ctl;
+    uint32_t ccc_pts;
+    uint32_t em_loc;
+    uint32_t em_ctl;
+    uint32_t cap2;
+    uint32_t bohc;
+    uint8_t reserved[0xA0 - 0x2C];
+    uint8_t vendor[0x100 - 0xA0];
+    struct ahci_hba_port ports[AHCI_MAX_PORTS];
+} __attribute__((packed));
+
+// Register host to device FIS used to issue ATA commands
+struct ahci_fis_reg_h2d
+{
+    uint8_t fis_type;
+    uint8_t pmport : 4;
+    uint8_t reserved0 : 3;
+    uint8_t c : 1;
+    uint8_t command;
+    uint8_t featurel;
+
+    uint8_t lba0;
+    uint8_t lba1;
+    uint8_t lba2;
+    uint8_t device;
+
+    uint8_t lba3;
+    uint8_t lba4;
+    uint8_t lba5;
+    uint8_t featureh;
+
+    uint8_t countl;
+    uint8_t counth;
+    uint8_t icc;
+    uint8_t control;
+
+    uint8_t reserved1[4];
+} __attribute__((packed));
+
+struct ahci_command_header
+{
+    uint8_t cfl : 5;
+    uint8_t a : 1;
+    uint8_t w : 1;
+    uint8_t p : 1;
+    uint8_t r : 1;
+    uint8_t b : 1;
+    uint8_t c : 1;
+    uint8_t reserved0 : 1;
+    uint8_t pmp : 4;
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved1[4];
+} __attribute__((packed));
+
+struct ahci_prdt_entry
+{
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved0;
+    uint32_t dbc : 22;
+    uint32_t reserved1 : 9;
+    uint32_t i : 1;
+} __attribute__((packed));
+
+struct ahci_command_table
+{
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct ahci_prdt_entry prdt[AHCI_PRDT_ENTRIES];
+} __attribute__((packed));
+
+int ahci_init();
+
+#endif
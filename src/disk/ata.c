@@ -0,0 +1,393 @@
+/*
+ * ATA disk driver using Programmed I/O (PIO) operations.
+ *
+ * The primary IDE bus exposes a set of well known ports:
+ *   0x1F0 – data register used to transfer 16-bit words
+ *   0x1F2 – sector count
+ *   0x1F3 – LBA low byte
+ *   0x1F4 – LBA mid byte
+ *   0x1F5 – LBA high byte
+ *   0x1F6 – drive/head register
+ *   0x1F7 – command/status register
+ *
+ * Requests are issued with 28-bit LBA commands when they fit and with the
+ * LBA48 "EXT" commands otherwise. LBA48 writes each of the count and address
+ * registers twice (high byte first) which raises the per-command limit from
+ * 256 to 65536 sectors and the addressable range beyond 128 GiB. Larger
+ * requests are split into several commands transparently.
+ *
+ * Writes use the matching WRITE SECTORS commands and may sit in the drive's
+ * write cache until the flush callback issues a CACHE FLUSH.
+ *
+ * Only the primary master drive is driven. `ata_init()` registers it with the
+ * generic disk layer which forwards `disk_read_block()` and
+ * `disk_write_block()` calls to `ata_read()` and `ata_write()`.
+ */
+#include "ata.h"
+#include "disk.h"
+#include "io/io.h"
+#include "config.h"
+#include "status.h"
+#include "memory/memory.h"
+#include <stdint.h>
+
+#define ATA_PRIMARY_DATA 0x1F0
+#define ATA_PRIMARY_SECTOR_COUNT 0x1F2
+#define ATA_PRIMARY_LBA_LOW 0x1F3
+#define ATA_PRIMARY_LBA_MID 0x1F4
+#define ATA_PRIMARY_LBA_HIGH 0x1F5
+#define ATA_PRIMARY_DRIVE_HEAD 0x1F6
+#define ATA_PRIMARY_COMMAND 0x1F7
+#define ATA_PRIMARY_ALT_STATUS 0x3F6
+
+#define ATA_COMMAND_READ_SECTORS 0x20
+#define ATA_COMMAND_READ_SECTORS_EXT 0x24
+#define ATA_COMMAND_WRITE_SECTORS 0x30
+#define ATA_COMMAND_WRITE_SECTORS_EXT 0x34
+#define ATA_COMMAND_CACHE_FLUSH 0xE7
+#define ATA_COMMAND_CACHE_FLUSH_EXT 0xEA
+#define ATA_COMMAND_IDENTIFY 0xEC
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+// IDENTIFY DEVICE words describing LBA48 support and capacity
+#define ATA_IDENTIFY_COMMAND_SETS 83
+#define ATA_IDENTIFY_LBA48_SUPPORTED (1 << 10)
+#define ATA_IDENTIFY_LBA28_SECTORS 60
+#define ATA_IDENTIFY_LBA48_SECTORS 100
+
+// Largest transfer a single command can describe. A count of zero in the
+// sector count register means 256 (LBA28) or 65536 (LBA48) sectors.
+#define ATA_LBA28_MAX_SECTORS 256
+#define ATA_LBA48_MAX_SECTORS 65536
+#define ATA_LBA28_MAX_LBA 0x0FFFFFFF
+
+static struct disk ata_disk;
+
+/*
+ * Capabilities reported by IDENTIFY DEVICE. When the drive cannot be
+ * identified the driver falls back to LBA28 only, which matches the
+ * behaviour of the original PIO implementation.
+ */
+static struct ata_drive_info
+{
+    int lba48;
+    uint32_t total_sectors;
+} ata_info;
+
+/*
+ * Reading the alternate status register four times gives the drive the
+ * 400ns it needs to update its status after a command or drive select.
+ */
+static void ata_delay()
+{
+    for (int i = 0; i < 4; i++)
+    {
+        insb(ATA_PRIMARY_ALT_STATUS);
+    }
+}
+
+/*
+ * Wait until the drive clears BSY and either raises DRQ or reports an error.
+ *
+ * @return Zero when data is ready, -EIO on a drive error or fault.
+ */
+static int ata_wait_drq()
+{
+    unsigned char status = insb(ATA_PRIMARY_COMMAND);
+    while ((status & ATA_STATUS_BSY) ||
+           !(status & (ATA_STATUS_DRQ | ATA_STATUS_ERR | ATA_STATUS_DF)))
+    {
+        status = insb(ATA_PRIMARY_COMMAND);
+    }
+
+    if (status & (ATA_STATUS_ERR | ATA_STATUS_DF))
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Issue IDENTIFY DEVICE to the primary master and record whether the drive
+ * implements the 48-bit command set.
+ *
+ * @return Zero when an ATA drive answered, -EIO when the bus is empty or the
+ *         attached device is not an ATA hard disk.
+ */
+static int ata_identify()
+{
+    uint16_t identify[256];
+    memset(&ata_info, 0, sizeof(ata_info));
+
+    outb(ATA_PRIMARY_DRIVE_HEAD, 0xA0);
+    ata_delay();
+    outb(ATA_PRIMARY_SECTOR_COUNT, 0);
+    outb(ATA_PRIMARY_LBA_LOW, 0);
+    outb(ATA_PRIMARY_LBA_MID, 0);
+    outb(ATA_PRIMARY_LBA_HIGH, 0);
+    outb(ATA_PRIMARY_COMMAND, ATA_COMMAND_IDENTIFY);
+    ata_delay();
+
+    // A status of zero (or a floating bus) means no drive is attached
+    unsigned char status = insb(ATA_PRIMARY_COMMAND);
+    if (status == 0x00 || status == 0xFF)
+    {
+        return -EIO;
+    }
+
+    while (insb(ATA_PRIMARY_COMMAND) & ATA_STATUS_BSY) {}
+
+    // ATAPI and SATA devices report a signature in the LBA mid/high ports
+    if (insb(ATA_PRIMARY_LBA_MID) || insb(ATA_PRIMARY_LBA_HIGH))
+    {
+        return -EIO;
+    }
+
+    if (ata_wait_drq() < 0)
+    {
+        return -EIO;
+    }
+
+    for (int i = 0; i < 256; i++)
+    {
+        identify[i] = insw(ATA_PRIMARY_DATA);
+    }
+
+    ata_info.total_sectors = identify[ATA_IDENTIFY_LBA28_SECTORS] |
+                             (identify[ATA_IDENTIFY_LBA28_SECTORS + 1] << 16);
+    if (identify[ATA_IDENTIFY_COMMAND_SETS] & ATA_IDENTIFY_LBA48_SUPPORTED)
+    {
+        ata_info.lba48 = 1;
+        // Words 100-103 hold a 64-bit count, only the low 32 bits are kept
+        ata_info.total_sectors = identify[ATA_IDENTIFY_LBA48_SECTORS] |
+                                 (identify[ATA_IDENTIFY_LBA48_SECTORS + 1] << 16);
+    }
+
+    return 0;
+}
+
+/*
+ * Wait for the drive to finish a command that transfers no data.
+ *
+ * @return Zero on success, -EIO on a drive error or fault.
+ */
+static int ata_wait_idle()
+{
+    unsigned char status = insb(ATA_PRIMARY_COMMAND);
+    while (status & ATA_STATUS_BSY)
+    {
+        status = insb(ATA_PRIMARY_COMMAND);
+    }
+
+    return (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) ? -EIO : 0;
+}
+
+/*
+ * Program the task file for a 28-bit READ/WRITE SECTORS command.
+ * `total` must be between 1 and 256.
+ */
+static void ata_command_lba28(uint8_t command, unsigned int lba, int total)
+{
+    outb(ATA_PRIMARY_DRIVE_HEAD, ((lba >> 24) & 0x0F) | 0xE0); // drive/head register
+    outb(ATA_PRIMARY_SECTOR_COUNT, (unsigned char)total);       // 256 is encoded as 0
+    outb(ATA_PRIMARY_LBA_LOW, (unsigned char)(lba & 0xff));
+    outb(ATA_PRIMARY_LBA_MID, (unsigned char)(lba >> 8));
+    outb(ATA_PRIMARY_LBA_HIGH, (unsigned char)(lba >> 16));
+    outb(ATA_PRIMARY_COMMAND, command);
+}
+
+/*
+ * Program the task file for a 48-bit READ/WRITE SECTORS EXT command. Each register
+ * is written twice, the "previous" high order byte first. `total` must be
+ * between 1 and 65536. Only 32 bits of LBA are supported by the disk API so
+ * the top two address bytes are always zero.
+ */
+static void ata_command_lba48(uint8_t command, unsigned int lba, int total)
+{
+    outb(ATA_PRIMARY_DRIVE_HEAD, 0x40);
+    outb(ATA_PRIMARY_SECTOR_COUNT, (unsigned char)(total >> 8)); // 65536 is encoded as 0
+    outb(ATA_PRIMARY_LBA_LOW, (unsigned char)(lba >> 24));
+    outb(ATA_PRIMARY_LBA_MID, 0);
+    outb(ATA_PRIMARY_LBA_HIGH, 0);
+    outb(ATA_PRIMARY_SECTOR_COUNT, (unsigned char)total);
+    outb(ATA_PRIMARY_LBA_LOW, (unsigned char)(lba & 0xff));
+    outb(ATA_PRIMARY_LBA_MID, (unsigned char)(lba >> 8));
+    outb(ATA_PRIMARY_LBA_HIGH, (unsigned char)(lba >> 16));
+    outb(ATA_PRIMARY_COMMAND, command);
+}
+
+/*
+ * Issue a single read or write command and transfer its data.
+ *
+ * @param lba   Logical block address of the first sector.
+ * @param total Number of sectors, within the limit of the chosen command.
+ * @param lba48 Non-zero to use the EXT commands.
+ * @param buf   Data buffer (must hold total * 512 bytes).
+ * @param write Non-zero to write `buf` to the drive.
+ * @return      Zero on success, -EIO if the drive reports an error.
+ */
+static int ata_transfer_command(unsigned int lba, int total, int lba48, void* buf, int write)
+{
+    if (lba48)
+    {
+        ata_command_lba48(write ? ATA_COMMAND_WRITE_SECTORS_EXT : ATA_COMMAND_READ_SECTORS_EXT, lba, total);
+    }
+    else
+    {
+        ata_command_lba28(write ? ATA_COMMAND_WRITE_SECTORS : ATA_COMMAND_READ_SECTORS, lba, total);
+    }
+    ata_delay();
+
+    unsigned short* ptr = (unsigned short*) buf;
+    for (int b = 0; b < total; b++)
+    {
+        /* Wait for the drive to assert the Data Request (DRQ) bit. */
+        if (ata_wait_drq() < 0)
+        {
+            return -EIO;
+        }
+
+        /* Transfer one sector (256 words) through the data port. */
+        for (int i = 0; i < 256; i++)
+        {
+            if (write)
+            {
+                outw(ATA_PRIMARY_DATA, *ptr);
+            }
+            else
+            {
+                *ptr = insw(ATA_PRIMARY_DATA);
+            }
+            ptr++;
+        }
+    }
+
+    // Wait for the last written sector to be accepted
+    if (write && ata_wait_idle() < 0)
+    {
+        return -EIO;
+    }
+
+    return 0;
+}
+
+/*
+ * Read or write one or more sectors on the primary ATA drive.
+ *
+ * The request is split into as few commands as possible. Ranges that lie
+ * entirely below the 28-bit limit use the 28-bit commands in runs of up to
+ * 256 sectors, everything else uses the EXT commands in runs of up to 65536.
+ *
+ * @param lba   Logical block address of the first sector.
+ * @param total Number of sectors to transfer.
+ * @param buf   Data buffer (must hold total * 512 bytes).
+ * @param write Non-zero to write `buf` to the drive.
+ * @return      Zero on success, negative error code otherwise.
+ */
+static int ata_transfer(unsigned int lba, int total, void* buf, int write)
+{
+    int res = 0;
+    char* out = buf;
+    while (total > 0)
+    {
+        int count = total;
+        int lba48 = ata_info.lba48 &&
+                    (count > ATA_LBA28_MAX_SECTORS || lba + count - 1 > ATA_LBA28_MAX_LBA);
+        int max = lba48 ? ATA_LBA48_MAX_SECTORS : ATA_LBA28_MAX_SECTORS;
+        if (count > max)
+        {
+            count = max;
+        }
+
+        if (!lba48 && lba + count - 1 > ATA_LBA28_MAX_LBA)
+        {
+            // The drive cannot address this range
+            res = -EIO;
+            break;
+        }
+
+        res = ata_transfer_command(lba, count, lba48, out, write);
+        if (res < 0)
+        {
+            break;
+        }
+
+        lba += count;
+        total -= count;
+        out += count * VANA_SECTOR_SIZE;
+    }
+
+    return res;
+}
+
+/*
+ * Disk layer read callback. Only the primary master is driven so the disk
+ * argument simply identifies this driver's instance.
+ */
+static int ata_read(struct disk* idisk, unsigned int lba, int total, void* buf)
+{
+    if (idisk != &ata_disk)
+    {
+        return -EIO;
+    }
+
+    return ata_transfer(lba, total, buf, 0);
+}
+
+/* Disk layer write callback. */
+static int ata_write(struct disk* idisk, unsigned int lba, int total, const void* buf)
+{
+    if (idisk != &ata_disk)
+    {
+        return -EIO;
+    }
+
+    return ata_transfer(lba, total, (void*)buf, 1);
+}
+
+/* Disk layer flush callback: commit the drive's write cache to the media. */
+static int ata_flush(struct disk* idisk)
+{
+    if (idisk != &ata_disk)
+    {
+        return -EIO;
+    }
+
+    if (ata_wait_idle() < 0)
+    {
+        return -EIO;
+    }
+
+    outb(ATA_PRIMARY_COMMAND, ata_info.lba48 ? ATA_COMMAND_CACHE_FLUSH_EXT : ATA_COMMAND_CACHE_FLUSH);
+    ata_delay();
+    return ata_wait_idle();
+}
+
+/*
+ * Probe for the primary master and register it with the disk layer, which
+ * in turn calls `fs_resolve()` to attach a filesystem driver.
+ *
+ * @return Zero when a drive was registered, negative error code otherwise.
+ */
+int ata_init()
+{
+    int res = ata_identify();
+    if (res < 0)
+    {
+        return res;
+    }
+
+    memset(&ata_disk, 0, sizeof(ata_disk));
+    ata_disk.type = VANA_DISK_TYPE_REAL;
+    ata_disk.sector_size = VANA_SECTOR_SIZE;
+    ata_disk.read = ata_read;
+    ata_disk.write = ata_write;
+    ata_disk.flush = ata_flush;
+    res = disk_register(&ata_disk);
+    return res < 0 ? res : 0;
+}
@@ -0,0 +1,6 @@
+#ifndef ATA_H
+#define ATA_H
+
+int ata_init();
+
+#endif
@@ -0,0 +1,370 @@
+/*
+ * Block cache.
+ *
+ * Keeps recently used sectors of a disk in memory so metadata that is read
+ * again and again, such as directory sectors, does not go back to the
+ * device. Every disk with a read callback gets its own cache of
+ * VANA_BCACHE_BLOCKS sectors when it is registered, so a busy data disk
+ * cannot push the metadata of another mount out of memory. Blocks are found
+ * through a hash of the lba and callers hold a reference while they look at
+ * a block's data. Unreferenced blocks stay cached on an LRU list and the
+ * least recently used one is recycled when all blocks are in use.
+ *
+ * The cache is write-back. Callers that modify a block mark it dirty and
+ * the sector is only written when the block is recycled or when
+ * `bcache_sync()` is called for its disk, which queues every dirty sector
+ * of the disk at once so neighbouring sectors go out as one command.
+ *
+ * Whole sectors of file data bypass the cache and go to the disk layer
+ * directly; only the partial sectors at either end of a file write are
+ * patched here. `bcache_update_range()` and `bcache_sync_range()` keep the
+ * two paths coherent when a direct transfer covers a cached sector.
+ */
+#include "bcache.h"
+#include "disk.h"
+#include "status.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+/*
+ * Allocate the block cache of `disk`: the block descriptors and their
+ * sector buffers. Called by disk_register() before the disk's filesystem
+ * is resolved.
+ */
+int bcache_create(struct disk* disk)
+{
+    struct bcache* cache = kzalloc(sizeof(struct bcache));
+    if (!cache)
+    {
+        return -ENOMEM;
+    }
+
+    cache->blocks = kzalloc(sizeof(struct bcache_block) * VANA_BCACHE_BLOCKS);
+    if (!cache->blocks)
+    {
+        kfree(cache);
+        return -ENOMEM;
+    }
+
+    char* data = kzalloc(VANA_SECTOR_SIZE * VANA_BCACHE_BLOCKS);
+    if (!data)
+    {
+        kfree(cache->blocks);
+        kfree(cache);
+        return -ENOMEM;
+    }
+
+    for (int i = VANA_BCACHE_BLOCKS - 1; i >= 0; i--)
+    {
+        cache->blocks[i].data = data + i * VANA_SECTOR_SIZE;
+        cache->blocks[i].hash_next = cache->free;
+        cache->free = &cache->blocks[i];
+    }
+
+    disk->bcache = cache;
+    return 0;
+}
+
+static uint32_t bcache_bucket(unsigned int lba)
+{
+    return (lba * 2654435761u) % VANA_BCACHE_BUCKETS;
+}
+
+static void bcache_lru_remove(struct bcache* cache, struct bcache_block* block)
+{
+    if (block->lru_prev)
+    {
+        block->lru_prev->lru_next = block->lru_next;
+    }
+    else if (cache->lru_head == block)
+    {
+        cache->lru_head = block->lru_next;
+    }
+
+    if (block->lru_next)
+    {
+        block->lru_next->lru_prev = block->lru_prev;
+    }
+    else if (cache->lru_tail == block)
+    {
+        cache->lru_tail = block->lru_prev;
+    }
+
+    block->lru_prev = 0;
+    block->lru_next = 0;
+}
+
+static void bcache_lru_push(struct bcache* cache, struct bcache_block* block)
+{
+    block->lru_prev = 0;
+    block->lru_next = cache->lru_head;
+    if (cache->lru_head)
+    {
+        cache->lru_head->lru_prev = block;
+    }
+    cache->lru_head = block;
+    if (!cache->lru_tail)
+    {
+        cache->lru_tail = block;
+    }
+}
+
+static void bcache_unhash(struct bcache* cache, struct bcache_block* block)
+{
+    struct bcache_block** link = &cache->buckets[bcache_bucket(block->lba)];
+    while (*link && *link != block)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if (*link)
+    {
+        *link = block->hash_next;
+    }
+    block->hash_next = 0;
+}
+
+/* Return an unhashed block to the free list. */
+static void bcache_release(struct bcache* cache, struct bcache_block* block)
+{
+    block->disk = 0;
+    block->lba = 0;
+    block->refcount = 0;
+    block->hash_next = cache->free;
+    cache->free = block;
+}
+
+/* Write a dirty block back to its disk. */
+static int bcache_writeback(struct bcache_block* block)
+{
+    int res = disk_write_block(block->disk, block->lba, 1, block->data);
+    if (res == 0)
+    {
+        block->dirty = 0;
+    }
+    return res;
+}
+
+/*
+ * Take a free block, recycling the least recently used one if needed. A
+ * dirty victim is written back first; one that cannot be written stays
+ * cached and the next oldest block is tried instead.
+ */
+static struct bcache_block* bcache_alloc(struct bcache* cache)
+{
+    struct bcache_block* victim = cache->lru_tail;
+    while (!cache->free && victim)
+    {
+        struct bcache_block* prev = victim->lru_prev;
+        if (!victim->dirty || bcache_writeback(victim) == 0)
+        {
+            bcache_lru_remove(cache, victim);
+            bcache_unhash(cache, victim);
+            bcache_release(cache, victim);
+        }
+        victim = prev;
+    }
+
+    struct bcache_block* block = cache->free;
+    if (block)
+    {
+        cache->free = block->hash_next;
+        block->hash_next = 0;
+    }
+    return block;
+}
+
+/*
+ * Find or create the block for sector `lba` of `disk`. A newly created
+ * block is filled from the device only if `read` is non-zero.
+ */
+static int bcache_lookup(struct disk* disk, unsigned int lba, int read, struct bcache_block** block_out)
+{
+    struct bcache* cache = disk->bcache;
+    if (!cache)
+    {
+        return -EIO;
+    }
+
+    uint32_t bucket = bcache_bucket(lba);
+    for (struct bcache_block* block = cache->buckets[bucket]; block; block = block->hash_next)
+    {
+        if (block->lba == lba)
+        {
+            if (block->refcount == 0)
+            {
+                bcache_lru_remove(cache, block);
+            }
+            block->refcount++;
+            *block_out = block;
+            return 0;
+        }
+    }
+
+    struct bcache_block* block = bcache_alloc(cache);
+    if (!block)
+    {
+        return -ENOMEM;
+    }
+
+    int res = read ? disk_read_block(disk, lba, 1, block->data) : 0;
+    if (res < 0)
+    {
+        bcache_release(cache, block);
+        return res;
+    }
+
+    block->disk = disk;
+    block->lba = lba;
+    block->refcount = 1;
+    block->dirty = 0;
+    block->hash_next = cache->buckets[bucket];
+    cache->buckets[bucket] = block;
+    *block_out = block;
+    return 0;
+}
+
+/*
+ * Get a referenced block holding sector `lba` of `disk`, reading it from
+ * the device on a miss.
+ *
+ * @return Zero on success, -ENOMEM if every block is referenced, -EIO if
+ *         the disk has no cache or the driver's error if the sector could
+ *         not be read.
+ */
+int bcache_get(struct disk* disk, unsigned int lba, struct bcache_block** block_out)
+{
+    return bcache_lookup(disk, lba, 1, block_out);
+}
+
+/*
+ * Like bcache_get() for a sector the caller is about to overwrite
+ * completely. The device is not read on a miss, so the block's data is
+ * undefined until the caller fills it.
+ */
+int bcache_get_new(struct disk* disk, unsigned int lba, struct bcache_block** block_out)
+{
+    return bcache_lookup(disk, lba, 0, block_out);
+}
+
+/* Drop a reference taken by bcache_get(). */
+void bcache_put(struct bcache_block* block)
+{
+    if (!block || block->refcount <= 0)
+    {
+        return;
+    }
+
+    block->refcount--;
+    if (block->refcount == 0)
+    {
+        bcache_lru_push(block->disk->bcache, block);
+    }
+}
+
+/* Record that a referenced block's data was modified. */
+void bcache_mark_dirty(struct bcache_block* block)
+{
+    block->dirty = 1;
+}
+
+/* Non-zero if `block` caches one of `total` sectors of `disk` from `lba`. */
+static int bcache_block_in_range(struct bcache_block* block, struct disk* disk, unsigned int lba, int total)
+{
+    return block->disk == disk && block->lba >= lba && block->lba - lba < (unsigned int)total;
+}
+
+/*
+ * Copy `total` sectors that are about to be written to the device directly
+ * from `buf` into any blocks caching them, so the cache does not go stale.
+ */
+void bcache_update_range(struct disk* disk, unsigned int lba, int total, const void* buf)
+{
+    struct bcache* cache = disk->bcache;
+    if (!cache)
+    {
+        return;
+    }
+
+    for (int i = 0; i < VANA_BCACHE_BLOCKS; i++)
+    {
+        struct bcache_block* block = &cache->blocks[i];
+        if (bcache_block_in_range(block, disk, lba, total))
+        {
+            memcpy(block->data, (char*)buf + (block->lba - lba) * disk->sector_size, disk->sector_size);
+        }
+    }
+}
+
+/*
+ * Write back the dirty blocks among `total` sectors from `lba` before they
+ * are read from the device directly.
+ *
+ * @return Zero on success or the first error.
+ */
+int bcache_sync_range(struct disk* disk, unsigned int lba, int total)
+{
+    struct bcache* cache = disk->bcache;
+    if (!cache)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < VANA_BCACHE_BLOCKS; i++)
+    {
+        struct bcache_block* block = &cache->blocks[i];
+        if (block->dirty && bcache_block_in_range(block, disk, lba, total))
+        {
+            int res = bcache_writeback(block);
+            if (res < 0)
+            {
+                return res;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Write every dirty block of `disk` back to the device. All of them are
+ * queued before the queue is run so adjacent sectors are merged and the
+ * writes are issued in elevator order.
+ *
+ * @return Zero on success or the first error; blocks that could not be
+ *         written stay dirty.
+ */
+int bcache_sync(struct disk* disk)
+{
+    struct bcache* cache = disk->bcache;
+    if (!cache)
+    {
+        return 0;
+    }
+
+    int res = 0;
+    for (int i = 0; i < VANA_BCACHE_BLOCKS; i++)
+    {
+        struct bcache_block* block = &cache->blocks[i];
+        if (block->disk && block->dirty)
+        {
+            res = disk_queue_write(disk, block->lba, 1, block->data);
+            if (res < 0)
+            {
+                return res;
+            }
+        }
+    }
+
+    res = disk_queue_run(disk);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    for (int i = 0; i < VANA_BCACHE_BLOCKS; i++)
+    {
+        cache->blocks[i].dirty = 0;
+    }
+    return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include "config.h"
+
+struct disk;
+
+// One cached sector
+struct bcache_block
+{
+    struct disk* disk;
+    unsigned int lba;
+    char* data;
+
+    // Callers currently using the block; referenced blocks are never evicted
+    int refcount;
+
+    // Non-zero if `data` was modified and has not been written back yet
+    int dirty;
+
+    struct bcache_block* hash_next;
+    struct bcache_block* lru_prev;
+    struct bcache_block* lru_next;
+};
+
+// The block cache of one disk, see disk->bcache
+struct bcache
+{
+    struct bcache_block* blocks;
+    struct bcache_block* buckets[VANA_BCACHE_BUCKETS];
+
+    // Blocks holding no sector, linked through hash_next
+    struct bcache_block* free;
+
+    // Most and least recently released unreferenced blocks
+    struct bcache_block* lru_head;
+    struct bcache_block* lru_tail;
+};
+
+int bcache_create(struct disk* disk);
+int bcache_get(struct disk* disk, unsigned int lba, struct bcache_block** block_out);
+int bcache_get_new(struct disk* disk, unsigned int lba, struct bcache_block** block_out);
+void bcache_put(struct bcache_block* block);
+void bcache_mark_dirty(struct bcache_block* block);
+int bcache_sync(struct disk* disk);
+void bcache_update_range(struct disk* disk, unsigned int lba, int total, const void* buf);
+int bcache_sync_range(struct disk* disk, unsigned int lba, int total);
+
+#endif
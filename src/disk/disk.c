@@ -1,99 +1,166 @@
 /*
- * ATA disk driver using Programmed I/O (PIO) operations.
+ * Generic disk layer.
  *
- * The primary IDE bus exposes a set of well known ports:
- *   0x1F0 – data register used to read 16-bit words
- *   0x1F2 – sector count
- *   0x1F3 – LBA low byte
- *   0x1F4 – LBA mid byte
- *   0x1F5 – LBA high byte
- *   0x1F6 – drive/head register
- *   0x1F7 – command/status register
+ * Block device drivers (the legacy ATA PIO driver, AHCI, virtio-blk) fill in a
+ * `struct disk` with their sector size, a read callback and, when the device
+ * is writable, a write callback and hand it to
+ * `disk_register()`. The disk receives the index of the slot it occupies in
+ * the `disks` table and its own block cache, and `fs_resolve()` is invoked
+ * to attach a filesystem. A disk whose filesystem resolves is mounted at the
+ * next free drive number (fs/mount.c), the number used in paths such as
+ * `0:/shell.elf`.
  *
- * Only a single drive is supported. Higher layers interact with this
- * driver via the filesystem which ultimately calls `disk_read_block()`.
+ * Higher layers interact with devices through `disk_get()` and
+ * `disk_read_block()`/`disk_write_block()` without knowing which driver is
+ * behind them. Transfers pass through the disk's request queue (queue.c);
+ * callers with several to make can add them with `disk_queue_read()` or
+ * `disk_queue_write()` and dispatch them in one go with `disk_queue_run()`
+ * so they are merged and sorted first.
+ *
+ * Completed writes may still sit in the device's volatile write cache.
+ * `disk_flush()` commits them; filesystems call it once per sync rather
+ * than after every command.
  */
 #include "disk.h"
-#include "io/io.h"
+#include "ata.h"
+#include "ahci.h"
+#include "virtio_blk.h"
+#include "ramdisk.h"
+#include "bcache.h"
+#include "fs/mount.h"
 #include "config.h"
 #include "status.h"
 #include "memory/memory.h"
 
-static struct disk disk;
+// Registered disks indexed by disk id. A NULL entry means the slot is free.
+static struct disk* disks[VANA_MAX_DISKS];
 
 /*
- * Read one or more sectors from the primary ATA drive.
+ * Add a disk to the table, resolve its filesystem and mount it. Disks with
+ * a read callback get a block cache first so the filesystem can use it
+ * while mounting.
  *
- * @param lba   Logical block address of the first sector.
- * @param total Number of sectors to read.
- * @param buf   Destination buffer (must hold total * 512 bytes).
- * @return      Zero on success, negative error code otherwise.
+ * @param disk  Driver owned disk structure. It must stay valid for the
+ *              lifetime of the kernel.
+ * @return      The assigned disk id or -ENOMEM if the table is full or the
+ *              block cache could not be allocated.
  */
-static int disk_read_sector(int lba, int total, void* buf)
+int disk_register(struct disk* disk)
 {
-    /* Select the drive and output the 28-bit LBA and sector count. */
-    outb(0x1F6, (lba >> 24) | 0xE0);      // drive/head register
-    outb(0x1F2, total);                   // number of sectors to read
-    outb(0x1F3, (unsigned char)(lba & 0xff));  // LBA low
-    outb(0x1F4, (unsigned char)(lba >> 8));    // LBA mid
-    outb(0x1F5, (unsigned char)(lba >> 16));   // LBA high
-    outb(0x1F7, 0x20);                  // send READ SECTORS command
-
-    unsigned short* ptr = (unsigned short*) buf;
-    for (int b = 0; b < total; b++)
+    for (int i = 0; i < VANA_MAX_DISKS; i++)
     {
-        /* Wait for the drive to assert the Data Request (DRQ) bit. */
-        char c = insb(0x1F7);
-        while(!(c & 0x08))
+        if (disks[i] == 0)
         {
-            c = insb(0x1F7);
-        }
+            if (disk->read && bcache_create(disk) < 0)
+            {
+                return -ENOMEM;
+            }
 
-        /* Read one sector (256 words) from the data port. */
-        for (int i = 0; i < 256; i++)
-        {
-            *ptr = insw(0x1F0);
-            ptr++;
+            disk->id = i;
+            disk_queue_init(&disk->queue);
+            disks[i] = disk;
+            disk->filesystem = fs_resolve(disk);
+            if (disk->filesystem)
+            {
+                mount_disk(disk);
+            }
+            return i;
         }
     }
 
-    return 0;
+    return -ENOMEM;
 }
 
 /*
- * Probe for the primary disk and initialise the global descriptor.
- * `fs_resolve()` is invoked to attach a filesystem driver so that later
- * calls through the VFS can transparently access this device.
+ * Probe every built-in block device driver. The legacy IDE controller is
+ * tried first so the disk the bootloader read the kernel from remains
+ * drive 0 when both controllers are present. An initrd loaded by the
+ * bootloader is registered after the hardware disks.
  */
 void disk_search_and_init()
 {
-    memset(&disk, 0, sizeof(disk));
-    disk.type = VANA_DISK_TYPE_REAL;
-    disk.sector_size = VANA_SECTOR_SIZE;
-    disk.id = 0;
-    disk.filesystem = fs_resolve(&disk);
+    memset(disks, 0, sizeof(disks));
+    ata_init();
+    ahci_init();
+    virtio_blk_init();
+    ramdisk_load_initrd();
 }
 
 struct disk* disk_get(int index)
 {
-    if (index != 0)
+    if (index < 0 || index >= VANA_MAX_DISKS)
         return 0;
 
-    return &disk;
+    return disks[index];
 }
 
 /*
  * Public wrapper used by the filesystem layer (e.g. FAT16) to read
- * one or more sectors. The disk pointer is validated before the
- * request is forwarded to `disk_read_sector()`.
+ * one or more sectors. The disk pointer is validated and the request is
+ * queued and dispatched together with anything else already pending.
  */
 int disk_read_block(struct disk* idisk, unsigned int lba, int total, void* buf)
 {
-    if (idisk != &disk)
+    if (!idisk || !idisk->read)
     {
         return -EIO;
     }
 
-    return disk_read_sector(lba, total, buf);
+    int res = disk_queue_read(idisk, lba, total, buf);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return disk_queue_run(idisk);
+}
+
+/*
+ * Write one or more sectors. Like disk_read_block() the request is queued
+ * and dispatched together with anything else already pending.
+ *
+ * @return Zero on success, -ERDONLY if the driver cannot write, or the
+ *         driver's error.
+ */
+int disk_write_block(struct disk* idisk, unsigned int lba, int total, const void* buf)
+{
+    if (!idisk)
+    {
+        return -EIO;
+    }
+
+    if (!idisk->write)
+    {
+        return -ERDONLY;
+    }
+
+    int res = disk_queue_write(idisk, lba, total, buf);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return disk_queue_run(idisk);
 }
 
+/*
+ * Commit writes held in the device's write cache to the media. Pending
+ * queued requests are dispatched first so they are covered too.
+ *
+ * @return Zero on success, or the queue's or the driver's error.
+ */
+int disk_flush(struct disk* idisk)
+{
+    if (!idisk)
+    {
+        return -EIO;
+    }
+
+    int res = disk_queue_run(idisk);
+    if (res < 0 || !idisk->flush)
+    {
+        return res;
+    }
+
+    return idisk->flush(idisk);
+}
@@ -2,11 +2,22 @@
 #define DISK_H
 
 #include "fs/file.h"
+#include "queue.h"
 
 typedef unsigned int VANA_DISK_TYPE;
 
 // Represents a real physical hard disk
 #define VANA_DISK_TYPE_REAL 0
+// Represents a disk backed by kernel memory
+#define VANA_DISK_TYPE_RAM 1
+// Represents a volume without a backing device, such as a tmpfs
+#define VANA_DISK_TYPE_VIRTUAL 2
+
+struct disk;
+struct bcache;
+typedef int (*DISK_READ_FUNCTION)(struct disk* disk, unsigned int lba, int total, void* buf);
+typedef int (*DISK_WRITE_FUNCTION)(struct disk* disk, unsigned int lba, int total, const void* buf);
+typedef int (*DISK_FLUSH_FUNCTION)(struct disk* disk);
 
 struct disk
 {
@@ -16,6 +27,22 @@ struct disk
     // The id of the disk
     int id;
 
+    // Driver callback that transfers sectors from the device
+    DISK_READ_FUNCTION read;
+    // Driver callback that transfers sectors to the device, NULL if read-only
+    DISK_WRITE_FUNCTION write;
+    // Driver callback that commits the device's write cache, NULL if it has none
+    DISK_FLUSH_FUNCTION flush;
+
+    // Private data for the disk driver
+    void* driver_private;
+
+    // Requests waiting to be merged and dispatched to `read` or `write`
+    struct disk_queue queue;
+
+    // Cached sectors of this disk, NULL for disks without a device
+    struct bcache* bcache;
+
     struct filesystem* filesystem;
 
     // Private data for the filesystem
@@ -23,7 +50,10 @@ struct disk
 };
 
 void disk_search_and_init();
+int disk_register(struct disk* disk);
 struct disk* disk_get(int index);
 int disk_read_block(struct disk* idisk, unsigned int lba, int total, void* buf);
+int disk_write_block(struct disk* idisk, unsigned int lba, int total, const void* buf);
+int disk_flush(struct disk* idisk);
 
 #endif
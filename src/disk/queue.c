@@ -0,0 +1,287 @@
+/*
+ * Block request queue.
+ *
+ * Every registered disk owns a `disk_queue` that sits between the callers
+ * of the disk layer and the driver's read and write callbacks. Requests
+ * added with `disk_queue_read()` or `disk_queue_write()` are kept in a list
+ * sorted by LBA. A request that continues (or precedes) a pending one in
+ * the same direction on disk and in memory is merged into it, so several
+ * small transfers reach the driver as one multi-sector command.
+ *
+ * `disk_queue_run()` drains the queue with a C-LOOK elevator: requests are
+ * served in ascending LBA order starting from the sector after the last
+ * dispatch, wrapping to the lowest pending LBA once the sweep passes the
+ * end. Each request is stamped with a deadline measured in dispatches; a
+ * request that has been passed over for VANA_DISK_QUEUE_DEADLINE commands
+ * is served next regardless of its position so no request starves.
+ *
+ * Reordering is only safe between requests that touch different sectors,
+ * or that both read. A request that overlaps a pending one where either
+ * writes drains the queue before it is added, so the caller's order is
+ * kept wherever it matters.
+ */
+#include "queue.h"
+#include "disk.h"
+#include "status.h"
+#include "memory/memory.h"
+
+void disk_queue_init(struct disk_queue* queue)
+{
+    memset(queue, 0, sizeof(struct disk_queue));
+}
+
+/* True if `first` ends where `second` starts both on disk and in memory. */
+static int disk_request_adjacent(struct disk* disk, unsigned int first_lba, int first_total, void* first_buf,
+                                 unsigned int second_lba, void* second_buf)
+{
+    return first_lba + first_total == second_lba &&
+           (char*)first_buf + first_total * disk->sector_size == (char*)second_buf;
+}
+
+static struct disk_request* disk_queue_new_request(struct disk_queue* queue)
+{
+    for (int i = 0; i < VANA_DISK_QUEUE_DEPTH; i++)
+    {
+        if (!queue->requests[i].used)
+        {
+            memset(&queue->requests[i], 0, sizeof(struct disk_request));
+            queue->requests[i].used = 1;
+            return &queue->requests[i];
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * True if a new transfer would overlap a pending request with at least one
+ * of the two writing, so that the order in which they reach the disk
+ * changes what is read or written.
+ */
+static int disk_queue_conflicts(struct disk_queue* queue, unsigned int lba, int total, int write)
+{
+    for (struct disk_request* request = queue->head; request; request = request->next)
+    {
+        if ((write || request->write) &&
+            lba < request->lba + request->total && request->lba < lba + total)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Try to fold a new request into its sorted neighbours.
+ *
+ * @param prev  Last pending request starting at or before `lba`, or NULL.
+ * @param next  First pending request starting after `lba`, or NULL.
+ * @return      Non-zero if the request was merged.
+ */
+static int disk_queue_merge(struct disk* disk, struct disk_request* prev, struct disk_request* next,
+                            unsigned int lba, int total, void* buf, int write)
+{
+    // Reads and writes are never combined into one command
+    if (prev && prev->write != write)
+    {
+        prev = 0;
+    }
+
+    if (next && next->write != write)
+    {
+        next = 0;
+    }
+
+    if (prev && disk_request_adjacent(disk, prev->lba, prev->total, prev->buf, lba, buf))
+    {
+        prev->total += total;
+
+        // The new request may have filled the gap to the following one
+        if (next && disk_request_adjacent(disk, prev->lba, prev->total, prev->buf, next->lba, next->buf))
+        {
+            prev->total += next->total;
+            if ((int32_t)(next->deadline - prev->deadline) < 0)
+            {
+                prev->deadline = next->deadline;
+            }
+            prev->next = next->next;
+            next->used = 0;
+        }
+        return 1;
+    }
+
+    if (next && disk_request_adjacent(disk, lba, total, buf, next->lba, next->buf))
+    {
+        next->lba = lba;
+        next->buf = buf;
+        next->total += total;
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Queue a transfer of `total` sectors starting at `lba`.
+ *
+ * @return Zero on success or a negative status code. A full queue, or
+ *         one holding a request this one must not be reordered with, is
+ *         drained first, in which case its error is returned.
+ */
+static int disk_queue_add(struct disk* disk, unsigned int lba, int total, void* buf, int write)
+{
+    if (total <= 0)
+    {
+        return -EINVARG;
+    }
+
+    struct disk_queue* queue = &disk->queue;
+    if (disk_queue_conflicts(queue, lba, total, write))
+    {
+        int res = disk_queue_run(disk);
+        if (res < 0)
+        {
+            return res;
+        }
+    }
+
+    struct disk_request* prev = 0;
+    struct disk_request* next = queue->head;
+    while (next && next->lba <= lba)
+    {
+        prev = next;
+        next = next->next;
+    }
+
+    if (disk_queue_merge(disk, prev, next, lba, total, buf, write))
+    {
+        return 0;
+    }
+
+    struct disk_request* request = disk_queue_new_request(queue);
+    if (!request)
+    {
+        int res = disk_queue_run(disk);
+        if (res < 0)
+        {
+            return res;
+        }
+
+        // The queue is empty now so the request becomes its only entry
+        prev = 0;
+        next = 0;
+        request = disk_queue_new_request(queue);
+    }
+
+    request->lba = lba;
+    request->total = total;
+    request->buf = buf;
+    request->write = write;
+    request->deadline = queue->dispatched + VANA_DISK_QUEUE_DEADLINE;
+    request->next = next;
+    if (prev)
+    {
+        prev->next = request;
+    }
+    else
+    {
+        queue->head = request;
+    }
+
+    return 0;
+}
+
+/*
+ * Queue a read of `total` sectors starting at `lba` into `buf`. The read is
+ * only guaranteed to have happened once `disk_queue_run()` returns.
+ */
+int disk_queue_read(struct disk* disk, unsigned int lba, int total, void* buf)
+{
+    return disk_queue_add(disk, lba, total, buf, 0);
+}
+
+/*
+ * Queue a write of `total` sectors from `buf` starting at `lba`. `buf` must
+ * stay unchanged until `disk_queue_run()` returns.
+ */
+int disk_queue_write(struct disk* disk, unsigned int lba, int total, const void* buf)
+{
+    if (!disk->write)
+    {
+        return -ERDONLY;
+    }
+
+    return disk_queue_add(disk, lba, total, (void*)buf, 1);
+}
+
+/*
+ * Choose the next request to dispatch: an expired request first, otherwise
+ * the next one along the elevator sweep.
+ */
+static struct disk_request* disk_queue_pick(struct disk_queue* queue)
+{
+    struct disk_request* oldest = queue->head;
+    struct disk_request* sweep = 0;
+    for (struct disk_request* request = queue->head; request; request = request->next)
+    {
+        if ((int32_t)(request->deadline - oldest->deadline) < 0)
+        {
+            oldest = request;
+        }
+
+        if (!sweep && request->lba >= queue->position)
+        {
+            sweep = request;
+        }
+    }
+
+    if ((int32_t)(oldest->deadline - queue->dispatched) <= 0)
+    {
+        return oldest;
+    }
+
+    // C-LOOK: nothing left ahead of the head, start again from the lowest LBA
+    return sweep ? sweep : queue->head;
+}
+
+static void disk_queue_unlink(struct disk_queue* queue, struct disk_request* request)
+{
+    struct disk_request** link = &queue->head;
+    while (*link != request)
+    {
+        link = &(*link)->next;
+    }
+
+    *link = request->next;
+}
+
+/*
+ * Dispatch every pending request to the driver.
+ *
+ * @return Zero if all requests succeeded, otherwise the first error. The
+ *         queue is always left empty.
+ */
+int disk_queue_run(struct disk* disk)
+{
+    int res = 0;
+    struct disk_queue* queue = &disk->queue;
+    while (queue->head)
+    {
+        struct disk_request* request = disk_queue_pick(queue);
+        disk_queue_unlink(queue, request);
+
+        int transfer_res = request->write ? disk->write(disk, request->lba, request->total, request->buf)
+                                          : disk->read(disk, request->lba, request->total, request->buf);
+        if (transfer_res < 0 && res == 0)
+        {
+            res = transfer_res;
+        }
+
+        queue->position = request->lba + request->total;
+        queue->dispatched++;
+        request->used = 0;
+    }
+
+    return res;
+}
@@ -0,0 +1,53 @@
+#ifndef DISK_QUEUE_H
+#define DISK_QUEUE_H
+
+#include <stdint.h>
+#include "config.h"
+
+struct disk;
+
+struct disk_request
+{
+    unsigned int lba;
+    int total;
+    void* buf;
+
+    // Non-zero for a transfer to the device
+    int write;
+
+    // Dispatch count by which the request must be serviced
+    uint32_t deadline;
+    int used;
+
+    // Next pending request in ascending LBA order
+    struct disk_request* next;
+};
+
+/*
+ * Pending requests of a single disk. Requests are kept sorted by LBA so
+ * neighbours can be merged and the elevator can sweep across the disk.
+ *
+ * Ordering rule: pending requests may reach the driver in any order, but
+ * a request overlapping a pending one where either is a write is never
+ * reordered with it. Adding it runs the queue first, so a read queued
+ * after a write to the same sectors sees the written data and the last of
+ * two overlapping writes wins.
+ */
+struct disk_queue
+{
+    struct disk_request requests[VANA_DISK_QUEUE_DEPTH];
+    struct disk_request* head;
+
+    // Sector following the last dispatched request
+    unsigned int position;
+
+    // Total commands dispatched, used as the clock for deadlines
+    uint32_t dispatched;
+};
+
+void disk_queue_init(struct disk_queue* queue);
+int disk_queue_read(struct disk* disk, unsigned int lba, int total, void* buf);
+int disk_queue_write(struct disk* disk, unsigned int lba, int total, const void* buf);
+int disk_queue_run(struct disk* disk);
+
+#endif
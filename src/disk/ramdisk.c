@@ -0,0 +1,147 @@
+/*
+ * RAM disk driver.
+ *
+ * A RAM disk is a `struct disk` whose sectors live in kernel memory, so
+ * block I/O is a memcpy in either direction. Disks can be created empty at runtime from the
+ * kernel heap, or wrap memory that already holds a disk image.
+ *
+ * The bootloader can load an initial RAM disk (initrd) to
+ * VANA_INITRD_ADDRESS. The image starts with a one sector
+ * `ramdisk_image_header`; `ramdisk_load_initrd()` validates it and registers
+ * the data that follows as a disk, after which `fs_resolve()` mounts
+ * whatever filesystem the image contains.
+ */
+#include "ramdisk.h"
+#include "disk.h"
+#include "config.h"
+#include "status.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+struct ramdisk
+{
+    char* memory;
+    uint32_t total_sectors;
+
+    struct disk disk;
+};
+
+/* Disk layer read callback. */
+static int ramdisk_read(struct disk* disk, unsigned int lba, int total, void* buf)
+{
+    struct ramdisk* ramdisk = disk->driver_private;
+    if (total < 0 || (uint64_t)lba + total > ramdisk->total_sectors)
+    {
+        return -EIO;
+    }
+
+    memcpy(buf, ramdisk->memory + lba * disk->sector_size, total * disk->sector_size);
+    return 0;
+}
+
+/* Disk layer write callback. */
+static int ramdisk_write(struct disk* disk, unsigned int lba, int total, const void* buf)
+{
+    struct ramdisk* ramdisk = disk->driver_private;
+    if (total < 0 || (uint64_t)lba + total > ramdisk->total_sectors)
+    {
+        return -EIO;
+    }
+
+    memcpy(ramdisk->memory + lba * disk->sector_size, (void*)buf, total * disk->sector_size);
+    return 0;
+}
+
+/*
+ * Register a RAM disk over existing memory.
+ *
+ * @param memory         Disk contents, `total_sectors` sectors long. The
+ *                       memory must remain valid for the life of the disk.
+ * @param total_sectors  Size of the disk in sectors.
+ * @return               The registered disk or NULL on failure.
+ */
+struct disk* ramdisk_create_from_memory(void* memory, int total_sectors)
+{
+    if (!memory || total_sectors <= 0)
+    {
+        return 0;
+    }
+
+    struct ramdisk* ramdisk = kzalloc(sizeof(struct ramdisk));
+    if (!ramdisk)
+    {
+        return 0;
+    }
+
+    ramdisk->memory = memory;
+    ramdisk->total_sectors = total_sectors;
+    ramdisk->disk.type = VANA_DISK_TYPE_RAM;
+    ramdisk->disk.sector_size = VANA_SECTOR_SIZE;
+    ramdisk->disk.read = ramdisk_read;
+    ramdisk->disk.write = ramdisk_write;
+    ramdisk->disk.driver_private = ramdisk;
+    if (disk_register(&ramdisk->disk) < 0)
+    {
+        kfree(ramdisk);
+        return 0;
+    }
+
+    return &ramdisk->disk;
+}
+
+/*
+ * Create an empty, zero filled RAM disk backed by the kernel heap.
+ *
+ * @return The registered disk or NULL on failure.
+ */
+struct disk* ramdisk_create(int total_sectors)
+{
+    if (total_sectors <= 0)
+    {
+        return 0;
+    }
+
+    void* memory = kzalloc(total_sectors * VANA_SECTOR_SIZE);
+    if (!memory)
+    {
+        return 0;
+    }
+
+    struct disk* disk = ramdisk_create_from_memory(memory, total_sectors);
+    if (!disk)
+    {
+        kfree(memory);
+    }
+
+    return disk;
+}
+
+/*
+ * Register the initrd loaded by the bootloader, if any.
+ *
+ * @return Zero if an initrd was registered, -EIO if none was loaded or its
+ *         header is invalid, -ENOMEM if it could not be registered.
+ */
+int ramdisk_load_initrd()
+{
+    uint32_t loaded_sectors = *(uint32_t*)(VANA_BOOT_SECTOR_ADDRESS + VANA_BOOT_INITRD_SECTORS_OFFSET);
+    if (loaded_sectors < 2 || loaded_sectors > VANA_INITRD_MAX_SECTORS)
+    {
+        return -EIO;
+    }
+
+    struct ramdisk_image_header* header = (struct ramdisk_image_header*)VANA_INITRD_ADDRESS;
+    if (memcmp(header->magic, VANA_RAMDISK_MAGIC, VANA_RAMDISK_MAGIC_SIZE) != 0 ||
+        header->total_sectors == 0 || header->total_sectors > loaded_sectors - 1)
+    {
+        return -EIO;
+    }
+
+    char* data = (char*)VANA_INITRD_ADDRESS + VANA_SECTOR_SIZE;
+    if (!ramdisk_create_from_memory(data, header->total_sectors))
+    {
+        return -ENOMEM;
+    }
+
+    return 0;
+}
@@ -0,0 +1,24 @@
+#ifndef RAMDISK_H
+#define RAMDISK_H
+
+#include <stdint.h>
+
+struct disk;
+
+// Identifies an initrd image. The header occupies the image's first sector
+// and the disk contents follow it.
+#define VANA_RAMDISK_MAGIC "VANARD01"
+#define VANA_RAMDISK_MAGIC_SIZE 8
+
+struct ramdisk_image_header
+{
+    char magic[VANA_RAMDISK_MAGIC_SIZE];
+    // Sectors of disk data following the header
+    uint32_t total_sectors;
+} __attribute__((packed));
+
+struct disk* ramdisk_create(int total_sectors);
+struct disk* ramdisk_create_from_memory(void* memory, int total_sectors);
+int ramdisk_load_initrd();
+
+#endif
@@ -0,0 +1,465 @@
+/*
+ * virtio-blk driver.
+ *
+ * Talks to the legacy (transitional) virtio PCI interface, whose registers
+ * live in the I/O space of BAR0. The device has a single split virtqueue:
+ *
+ *   - a descriptor table describing guest buffers,
+ *   - the available ring where the driver publishes request chains,
+ *   - the used ring where the device returns completed chains.
+ *
+ * Every request is a chain of three buffers: a header with the request type
+ * and sector, the data buffer and a status byte written by the device. When
+ * VIRTIO_RING_F_INDIRECT_DESC is negotiated the chain lives in a per-slot
+ * indirect table so each request occupies only one ring descriptor and the
+ * whole ring can be in flight at once.
+ *
+ * Reads and writes are split into VIRTIO_BLK_SECTORS_PER_REQUEST sized
+ * requests that are all published before the device is notified, so a large
+ * transfer costs a single I/O port write. A flush request, which has no data
+ * buffer, is sent by the flush callback when the device has a volatile
+ * write cache. With VIRTIO_RING_F_EVENT_IDX the device is only
+ * kicked when it asked to be. Completion is polled on the used ring, so the
+ * device is asked never to interrupt and no handler is installed: the
+ * legacy INTx line may be shared with another controller whose handler
+ * must not be replaced.
+ */
+#include "virtio_blk.h"
+#include "disk.h"
+#include "config.h"
+#include "status.h"
+#include "io/io.h"
+#include "pci/pci.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+// Iterations to spin on the used ring before giving up on the device
+#define VIRTIO_BLK_SPIN_TIMEOUT 100000000
+
+// Per request state the device reads from or writes to
+struct virtio_blk_slot
+{
+    struct vring_desc indirect[VIRTIO_BLK_DESCRIPTORS_PER_REQUEST];
+    struct virtio_blk_request_header header;
+    volatile uint8_t status;
+};
+
+struct virtio_blk_device
+{
+    uint16_t io_base;
+    uint32_t features;
+
+    // Entries in the descriptor table as reported by the device
+    uint16_t queue_size;
+    void* ring_memory;
+    struct vring_desc* desc;
+    volatile struct vring_avail* avail;
+    volatile struct vring_used* used;
+
+    // Used ring index up to which completions have been consumed
+    uint16_t last_used_idx;
+
+    struct virtio_blk_slot* slots;
+
+    // Requests that may be outstanding in one batch
+    int max_batch;
+    int sectors_per_request;
+
+    uint64_t capacity;
+
+    struct disk disk;
+};
+
+static struct virtio_blk_device* virtio_blk_devices[VANA_MAX_DISKS];
+static int virtio_blk_total_devices = 0;
+
+static inline void virtio_barrier()
+{
+    asm volatile("" ::: "memory");
+}
+
+/* Align `value` up to the legacy ring alignment. */
+static uint32_t virtio_ring_align(uint32_t value)
+{
+    return (value + VIRTIO_RING_ALIGN - 1) & ~(VIRTIO_RING_ALIGN - 1);
+}
+
+/* Bytes needed for the descriptor table and available ring, including used_event. */
+static uint32_t virtio_ring_avail_end(uint16_t queue_size)
+{
+    return sizeof(struct vring_desc) * queue_size + sizeof(uint16_t) * (3 + queue_size);
+}
+
+/* Total bytes occupied by a legacy virtqueue of `queue_size` entries. */
+static uint32_t virtio_ring_size(uint16_t queue_size)
+{
+    return virtio_ring_align(virtio_ring_avail_end(queue_size)) +
+           virtio_ring_align(sizeof(uint16_t) * 3 + sizeof(struct vring_used_elem) * queue_size);
+}
+
+/* The used_event field trails the available ring. */
+static volatile uint16_t* virtio_used_event(struct virtio_blk_device* device)
+{
+    return &device->avail->ring[device->queue_size];
+}
+
+/* The avail_event field trails the used ring. */
+static volatile uint16_t* virtio_avail_event(struct virtio_blk_device* device)
+{
+    return (volatile uint16_t*)&device->used->ring[device->queue_size];
+}
+
+/*
+ * Event index test from the virtio specification. True when `event` lies in
+ * the window of indices (old, new] that was just passed.
+ */
+static int virtio_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx)
+{
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+/*
+ * Index of the first descriptor used by a slot. With indirect descriptors
+ * each slot needs one ring entry, otherwise it owns three consecutive ones.
+ */
+static uint16_t virtio_blk_head(struct virtio_blk_device* device, int slot_index)
+{
+    if (device->features & VIRTIO_RING_F_INDIRECT_DESC)
+    {
+        return slot_index;
+    }
+
+    return slot_index * VIRTIO_BLK_DESCRIPTORS_PER_REQUEST;
+}
+
+/*
+ * Fill the slot and descriptors describing a request of the given type.
+ * Requests without data (`bytes` of zero) chain the header straight to the
+ * status byte.
+ */
+static void virtio_blk_prepare(struct virtio_blk_device* device, int slot_index, uint32_t type, uint64_t sector, void* buf, uint32_t bytes)
+{
+    struct virtio_blk_slot* slot = &device->slots[slot_index];
+    int descriptors = bytes ? VIRTIO_BLK_DESCRIPTORS_PER_REQUEST : VIRTIO_BLK_DESCRIPTORS_PER_REQUEST - 1;
+    slot->header.type = type;
+    slot->header.reserved = 0;
+    slot->header.sector = sector;
+    slot->status = 0xFF;
+
+    uint16_t head = virtio_blk_head(device, slot_index);
+    struct vring_desc* chain = &device->desc[head];
+
+    // Indirect tables are indexed from their own start, direct chains from
+    // the start of the descriptor table
+    uint16_t base = head;
+    if (device->features & VIRTIO_RING_F_INDIRECT_DESC)
+    {
+        chain = slot->indirect;
+        base = 0;
+
+        device->desc[head].addr = (uint32_t)chain;
+        device->desc[head].len = descriptors * sizeof(struct vring_desc);
+        device->desc[head].flags = VRING_DESC_F_INDIRECT;
+        device->desc[head].next = 0;
+    }
+
+    chain[0].addr = (uint32_t)&slot->header;
+    chain[0].len = sizeof(slot->header);
+    chain[0].flags = VRING_DESC_F_NEXT;
+    chain[0].next = base + 1;
+
+    if (bytes)
+    {
+        // The device writes into the buffer of a read and reads from it
+        // for a write
+        chain[1].addr = (uint32_t)buf;
+        chain[1].len = bytes;
+        chain[1].flags = VRING_DESC_F_NEXT | (type == VIRTIO_BLK_T_IN ? VRING_DESC_F_WRITE : 0);
+        chain[1].next = base + 2;
+    }
+
+    struct vring_desc* status = &chain[descriptors - 1];
+    status->addr = (uint32_t)&slot->status;
+    status->len = sizeof(slot->status);
+    status->flags = VRING_DESC_F_WRITE;
+    status->next = 0;
+}
+
+/*
+ * Publish the first `count` prepared slots and notify the device if it
+ * wants to be told. With event indices the device tells us the avail index
+ * it is waiting for; otherwise it sets NO_NOTIFY while it is processing.
+ */
+static void virtio_blk_kick(struct virtio_blk_device* device, int count)
+{
+    uint16_t old_idx = device->avail->idx;
+    for (int i = 0; i < count; i++)
+    {
+        device->avail->ring[(uint16_t)(old_idx + i) % device->queue_size] = virtio_blk_head(device, i);
+    }
+
+    if (device->features & VIRTIO_RING_F_EVENT_IDX)
+    {
+        // The device ignores NO_INTERRUPT with event indices, so keep the
+        // used event half the index space ahead where no batch reaches it
+        *virtio_used_event(device) = (uint16_t)(device->last_used_idx + 0x8000);
+    }
+
+    // Ring entries must be visible before the index that publishes them
+    virtio_barrier();
+    uint16_t new_idx = old_idx + count;
+    device->avail->idx = new_idx;
+    virtio_barrier();
+
+    int notify;
+    if (device->features & VIRTIO_RING_F_EVENT_IDX)
+    {
+        notify = virtio_need_event(*virtio_avail_event(device), new_idx, old_idx);
+    }
+    else
+    {
+        notify = !(device->used->flags & VRING_USED_F_NO_NOTIFY);
+    }
+
+    if (notify)
+    {
+        outw(device->io_base + VIRTIO_PCI_QUEUE_NOTIFY, 0);
+    }
+}
+
+/* Poll the used ring until `count` requests have completed. */
+static int virtio_blk_wait(struct virtio_blk_device* device, int count)
+{
+    uint16_t target = device->last_used_idx + count;
+    for (int i = 0; i < VIRTIO_BLK_SPIN_TIMEOUT; i++)
+    {
+        if (device->used->idx == target)
+        {
+            virtio_barrier();
+            device->last_used_idx = target;
+            return 0;
+        }
+    }
+
+    return -EIO;
+}
+
+/*
+ * Move sectors between memory and the device. The request is cut into
+ * batches of at most `max_batch` requests; each batch is published with a
+ * single kick and reaped before the slots are reused.
+ */
+static int virtio_blk_transfer(struct disk* disk, uint32_t type, unsigned int lba, int total, void* buf)
+{
+    int res = 0;
+    struct virtio_blk_device* device = disk->driver_private;
+    char* out = buf;
+
+    if ((uint64_t)lba + total > device->capacity)
+    {
+        return -EIO;
+    }
+
+    while (total > 0)
+    {
+        int batch = 0;
+        while (batch < device->max_batch && total > 0)
+        {
+            int count = total > device->sectors_per_request ? device->sectors_per_request : total;
+            virtio_blk_prepare(device, batch, type, lba, out, count * disk->sector_size);
+            batch++;
+            lba += count;
+            total -= count;
+            out += count * disk->sector_size;
+        }
+
+        virtio_blk_kick(device, batch);
+        res = virtio_blk_wait(device, batch);
+        if (res < 0)
+        {
+            break;
+        }
+
+        for (int i = 0; i < batch; i++)
+        {
+            if (device->slots[i].status != VIRTIO_BLK_S_OK)
+            {
+                res = -EIO;
+            }
+        }
+
+        if (res < 0)
+        {
+            break;
+        }
+    }
+
+    return res;
+}
+
+/* Disk layer read callback. */
+static int virtio_blk_read(struct disk* disk, unsigned int lba, int total, void* buf)
+{
+    return virtio_blk_transfer(disk, VIRTIO_BLK_T_IN, lba, total, buf);
+}
+
+/* Disk layer write callback. */
+static int virtio_blk_write(struct disk* disk, unsigned int lba, int total, const void* buf)
+{
+    return virtio_blk_transfer(disk, VIRTIO_BLK_T_OUT, lba, total, (void*)buf);
+}
+
+/*
+ * Disk layer flush callback, only installed when the device advertised a
+ * volatile write cache.
+ */
+static int virtio_blk_flush(struct disk* disk)
+{
+    struct virtio_blk_device* device = disk->driver_private;
+    virtio_blk_prepare(device, 0, VIRTIO_BLK_T_FLUSH, 0, 0, 0);
+    virtio_blk_kick(device, 1);
+    int res = virtio_blk_wait(device, 1);
+    if (res == 0 && device->slots[0].status != VIRTIO_BLK_S_OK)
+    {
+        res = -EIO;
+    }
+    return res;
+}
+
+/*
+ * Negotiate features and set up virtqueue 0.
+ */
+static int virtio_blk_setup(struct virtio_blk_device* device)
+{
+    uint16_t io = device->io_base;
+
+    outb(io + VIRTIO_PCI_STATUS, 0);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint32_t offered = insl(io + VIRTIO_PCI_HOST_FEATURES);
+    device->features = offered & (VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX | VIRTIO_BLK_F_SIZE_MAX |
+                                  VIRTIO_BLK_F_RO | VIRTIO_BLK_F_FLUSH);
+    outl(io + VIRTIO_PCI_GUEST_FEATURES, device->features);
+
+    device->capacity = insl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY) |
+                       ((uint64_t)insl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_CAPACITY + 4) << 32);
+
+    device->sectors_per_request = VIRTIO_BLK_SECTORS_PER_REQUEST;
+    if (device->features & VIRTIO_BLK_F_SIZE_MAX)
+    {
+        uint32_t size_max = insl(io + VIRTIO_PCI_CONFIG + VIRTIO_BLK_CONFIG_SIZE_MAX);
+        if (size_max >= VANA_SECTOR_SIZE && size_max / VANA_SECTOR_SIZE < device->sectors_per_request)
+        {
+            device->sectors_per_request = size_max / VANA_SECTOR_SIZE;
+        }
+    }
+
+    outw(io + VIRTIO_PCI_QUEUE_SELECT, 0);
+    device->queue_size = insw(io + VIRTIO_PCI_QUEUE_SIZE);
+    if (device->queue_size < VIRTIO_BLK_DESCRIPTORS_PER_REQUEST)
+    {
+        return -EIO;
+    }
+
+    // kzalloc hands out 4 KiB aligned, identity mapped memory as the
+    // legacy interface requires
+    device->ring_memory = kzalloc(virtio_ring_size(device->queue_size));
+    if (!device->ring_memory)
+    {
+        return -ENOMEM;
+    }
+
+    char* ring = device->ring_memory;
+    device->desc = (struct vring_desc*)ring;
+    device->avail = (volatile struct vring_avail*)(ring + sizeof(struct vring_desc) * device->queue_size);
+    device->used = (volatile struct vring_used*)(ring + virtio_ring_align(virtio_ring_avail_end(device->queue_size)));
+
+    device->max_batch = device->queue_size;
+    if (!(device->features & VIRTIO_RING_F_INDIRECT_DESC))
+    {
+        device->max_batch = device->queue_size / VIRTIO_BLK_DESCRIPTORS_PER_REQUEST;
+    }
+
+    device->slots = kzalloc(sizeof(struct virtio_blk_slot) * device->max_batch);
+    if (!device->slots)
+    {
+        return -ENOMEM;
+    }
+
+    // Completion is polled, interrupts would only need acknowledging
+    device->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+
+    outl(io + VIRTIO_PCI_QUEUE_PFN, (uint32_t)device->ring_memory >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
+    outb(io + VIRTIO_PCI_STATUS, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_DRIVER_OK);
+    return 0;
+}
+
+/* Initialise one virtio-blk function and register it as a disk. */
+static int virtio_blk_probe(struct pci_device* pci)
+{
+    int res = 0;
+    if (virtio_blk_total_devices >= VANA_MAX_DISKS)
+    {
+        return -ENOMEM;
+    }
+
+    struct virtio_blk_device* device = kzalloc(sizeof(struct virtio_blk_device));
+    if (!device)
+    {
+        return -ENOMEM;
+    }
+
+    pci_enable(pci, PCI_COMMAND_IO_SPACE | PCI_COMMAND_BUS_MASTER);
+    device->io_base = pci_get_bar(pci, 0);
+
+    res = virtio_blk_setup(device);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    virtio_blk_devices[virtio_blk_total_devices++] = device;
+
+    device->disk.type = VANA_DISK_TYPE_REAL;
+    device->disk.sector_size = VANA_SECTOR_SIZE;
+    device->disk.read = virtio_blk_read;
+    // Read-only devices are left without a write callback
+    device->disk.write = (device->features & VIRTIO_BLK_F_RO) ? 0 : virtio_blk_write;
+    device->disk.flush = (device->disk.write && (device->features & VIRTIO_BLK_F_FLUSH)) ? virtio_blk_flush : 0;
+    device->disk.driver_private = device;
+    return disk_register(&device->disk);
+
+out:
+    // The queue never went live so the device holds no pointers into
+    // memory released here
+    outb(device->io_base + VIRTIO_PCI_STATUS, VIRTIO_STATUS_FAILED);
+    if (device->ring_memory)
+    {
+        kfree(device->ring_memory);
+    }
+    if (device->slots)
+    {
+        kfree(device->slots);
+    }
+    kfree(device);
+    return res;
+}
+
+/*
+ * Register every virtio-blk function on the PCI bus as a disk.
+ *
+ * @return Zero when at least one device was found, -EIO otherwise.
+ */
+int virtio_blk_init()
+{
+    struct pci_device* pci = 0;
+    int index = 0;
+    while ((pci = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, index)) != 0)
+    {
+        virtio_blk_probe(pci);
+        index++;
+    }
+
+    return index > 0 ? 0 : -EIO;
+}
@@ -0,0 +1,101 @@
+#ifndef VIRTIO_BLK_H
+#define VIRTIO_BLK_H
+
+#include <stdint.h>
+
+// Transitional virtio-blk device as exposed by QEMU's legacy interface
+#define VIRTIO_PCI_VENDOR 0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK 0x1001
+
+// Legacy virtio header in the I/O space of BAR0
+#define VIRTIO_PCI_HOST_FEATURES 0x00
+#define VIRTIO_PCI_GUEST_FEATURES 0x04
+#define VIRTIO_PCI_QUEUE_PFN 0x08
+#define VIRTIO_PCI_QUEUE_SIZE 0x0C
+#define VIRTIO_PCI_QUEUE_SELECT 0x0E
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10
+#define VIRTIO_PCI_STATUS 0x12
+#define VIRTIO_PCI_ISR 0x13
+// Device specific configuration follows the header when MSI-X is disabled
+#define VIRTIO_PCI_CONFIG 0x14
+
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER 0x02
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FAILED 0x80
+
+#define VIRTIO_BLK_F_SIZE_MAX (1 << 1)
+#define VIRTIO_BLK_F_RO (1 << 5)
+#define VIRTIO_BLK_F_FLUSH (1 << 9)
+#define VIRTIO_RING_F_INDIRECT_DESC (1 << 28)
+#define VIRTIO_RING_F_EVENT_IDX (1 << 29)
+
+// Offsets into the virtio-blk configuration space
+#define VIRTIO_BLK_CONFIG_CAPACITY 0x00
+#define VIRTIO_BLK_CONFIG_SIZE_MAX 0x08
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_S_OK 0
+
+// Legacy rings are laid out on 4 KiB boundaries and addressed by page number
+#define VIRTIO_RING_ALIGN 4096
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12
+
+#define VRING_DESC_F_NEXT 1
+#define VRING_DESC_F_WRITE 2
+#define VRING_DESC_F_INDIRECT 4
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+#define VRING_USED_F_NO_NOTIFY 1
+
+// Sectors moved by a single request. Larger reads become several requests
+// that are published to the device together.
+#define VIRTIO_BLK_SECTORS_PER_REQUEST 256
+
+// Header, data buffer and status byte
+#define VIRTIO_BLK_DESCRIPTORS_PER_REQUEST 3
+
+// The ring structures are naturally aligned, so only the descriptor and
+// request header need packing to match the device's layout
+struct vring_desc
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} __attribute__((packed));
+
+struct vring_avail
+{
+    uint16_t flags;
+    uint16_t idx;
+    // `ring` has one entry per descriptor followed by the used_event field
+    uint16_t ring[];
+};
+
+struct vring_used_elem
+{
+    uint32_t id;
+    uint32_t len;
+};
+
+struct vring_used
+{
+    uint16_t flags;
+    uint16_t idx;
+    // `ring` has one entry per descriptor followed by the avail_event field
+    struct vring_used_elem ring[];
+};
+
+struct virtio_blk_request_header
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} __attribute__((packed));
+
+int virtio_blk_init();
+
+#endif
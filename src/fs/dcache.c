@@ -0,0 +1,457 @@
+/*
+ * Directory entry cache.
+ *
+ * Path walks in file.c resolve one component at a time through
+ * `dcache_lookup()`. Entries are hashed by (disk, parent, name) so a repeated
+ * lookup is a bucket scan instead of a directory read. Names that do not
+ * exist are cached as negative entries so failed opens are just as cheap.
+ *
+ * Entries are reference counted. Callers hold a reference while they use an
+ * entry and every child holds one on its parent, so a directory can only be
+ * evicted once nothing below it is cached. Unreferenced entries stay hashed
+ * on an LRU list and are recycled oldest first when the fixed pool of
+ * VANA_DCACHE_ENTRIES entries runs out. Evicting a positive entry drops its
+ * inode (inode.c) and hands its private data back to the filesystem through
+ * the `release` callback.
+ *
+ * Filesystems that flag themselves `case_insensitive` (FAT) have names
+ * hashed and compared without regard to case.
+ *
+ * Creating and removing files goes through the cache as well so cached
+ * entries never contradict the disk: `dcache_create()` and `dcache_mkdir()`
+ * turn a negative entry positive and `dcache_unlink()` turns a positive one
+ * negative.
+ */
+#include "dcache.h"
+#include "file.h"
+#include "inode.h"
+#include "status.h"
+#include "disk/disk.h"
+#include "string/string.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+static struct dentry* dcache_entries = 0;
+static struct dentry* dcache_buckets[VANA_DCACHE_BUCKETS];
+
+// Unused entries, linked through hash_next
+static struct dentry* dcache_free = 0;
+
+// Most and least recently released unreferenced entries
+static struct dentry* dcache_lru_head = 0;
+static struct dentry* dcache_lru_tail = 0;
+
+/*
+ * Allocate the entry pool. Called once from fs_init().
+ */
+int dcache_init()
+{
+    dcache_entries = kzalloc(sizeof(struct dentry) * VANA_DCACHE_ENTRIES);
+    if (!dcache_entries)
+    {
+        return -ENOMEM;
+    }
+
+    memset(dcache_buckets, 0, sizeof(dcache_buckets));
+    dcache_free = 0;
+    for (int i = VANA_DCACHE_ENTRIES - 1; i >= 0; i--)
+    {
+        dcache_entries[i].hash_next = dcache_free;
+        dcache_free = &dcache_entries[i];
+    }
+
+    dcache_lru_head = 0;
+    dcache_lru_tail = 0;
+    return 0;
+}
+
+static int dcache_case_insensitive(struct disk* disk)
+{
+    return disk->filesystem && disk->filesystem->case_insensitive;
+}
+
+/* FNV-1a over the name, mixed with the disk and parent identities. */
+static uint32_t dcache_hash(struct disk* disk, struct dentry* parent, const char* name)
+{
+    int fold = dcache_case_insensitive(disk);
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c; c++)
+    {
+        hash ^= (uint8_t)(fold ? tolower(*c) : *c);
+        hash *= 16777619u;
+    }
+
+    hash ^= (uint32_t)parent * 2654435761u;
+    hash ^= (uint32_t)disk;
+    return hash;
+}
+
+static int dcache_name_equal(struct disk* disk, const char* a, const char* b)
+{
+    if (dcache_case_insensitive(disk))
+    {
+        return istrncmp(a, b, VANA_MAX_PATH) == 0;
+    }
+
+    return strncmp(a, b, VANA_MAX_PATH) == 0;
+}
+
+static void dcache_lru_remove(struct dentry* dentry)
+{
+    if (dentry->lru_prev)
+    {
+        dentry->lru_prev->lru_next = dentry->lru_next;
+    }
+    else if (dcache_lru_head == dentry)
+    {
+        dcache_lru_head = dentry->lru_next;
+    }
+
+    if (dentry->lru_next)
+    {
+        dentry->lru_next->lru_prev = dentry->lru_prev;
+    }
+    else if (dcache_lru_tail == dentry)
+    {
+        dcache_lru_tail = dentry->lru_prev;
+    }
+
+    dentry->lru_prev = 0;
+    dentry->lru_next = 0;
+}
+
+static void dcache_lru_push(struct dentry* dentry)
+{
+    dentry->lru_prev = 0;
+    dentry->lru_next = dcache_lru_head;
+    if (dcache_lru_head)
+    {
+        dcache_lru_head->lru_prev = dentry;
+    }
+    dcache_lru_head = dentry;
+    if (!dcache_lru_tail)
+    {
+        dcache_lru_tail = dentry;
+    }
+}
+
+/* Take a reference on an entry, removing it from the LRU list if idle. */
+void dcache_get(struct dentry* dentry)
+{
+    if (dentry->refcount == 0)
+    {
+        dcache_lru_remove(dentry);
+    }
+    dentry->refcount++;
+}
+
+/* Drop a reference. Idle entries stay cached until they are evicted. */
+void dcache_put(struct dentry* dentry)
+{
+    if (!dentry || dentry->refcount <= 0)
+    {
+        return;
+    }
+
+    dentry->refcount--;
+    if (dentry->refcount == 0)
+    {
+        dcache_lru_push(dentry);
+    }
+}
+
+static void dcache_unhash(struct dentry* dentry)
+{
+    struct dentry** link = &dcache_buckets[dentry->hash % VANA_DCACHE_BUCKETS];
+    while (*link && *link != dentry)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if (*link)
+    {
+        *link = dentry->hash_next;
+    }
+    dentry->hash_next = 0;
+}
+
+/* Remove an idle entry from the cache and return it to the free list. */
+static void dcache_evict(struct dentry* dentry)
+{
+    dcache_unhash(dentry);
+    dcache_lru_remove(dentry);
+
+    inode_detach(dentry);
+    struct filesystem* fs = dentry->disk->filesystem;
+    if (!dentry->negative && dentry->fs_private && fs && fs->release)
+    {
+        fs->release(dentry->disk, dentry->fs_private);
+    }
+
+    // Dropping the parent reference may make the parent the next victim
+    struct dentry* parent = dentry->parent;
+    memset(dentry, 0, sizeof(struct dentry));
+    dentry->hash_next = dcache_free;
+    dcache_free = dentry;
+    dcache_put(parent);
+}
+
+/* Evict every idle entry whose parent is `dentry`. */
+static void dcache_prune_children(struct dentry* dentry)
+{
+    for (int i = 0; i < VANA_DCACHE_ENTRIES; i++)
+    {
+        struct dentry* child = &dcache_entries[i];
+        if (child->parent == dentry && child->refcount == 0)
+        {
+            dcache_evict(child);
+        }
+    }
+}
+
+/* Take an entry from the free list, evicting the least recently used one if needed. */
+static struct dentry* dcache_alloc()
+{
+    if (!dcache_free && dcache_lru_tail)
+    {
+        dcache_evict(dcache_lru_tail);
+    }
+
+    struct dentry* dentry = dcache_free;
+    if (!dentry)
+    {
+        return 0;
+    }
+
+    dcache_free = dentry->hash_next;
+    memset(dentry, 0, sizeof(struct dentry));
+    return dentry;
+}
+
+static struct dentry* dcache_find(struct disk* disk, struct dentry* parent, const char* name, uint32_t hash)
+{
+    for (struct dentry* dentry = dcache_buckets[hash % VANA_DCACHE_BUCKETS]; dentry; dentry = dentry->hash_next)
+    {
+        if (dentry->hash == hash && dentry->disk == disk && dentry->parent == parent &&
+            dcache_name_equal(disk, dentry->name, name))
+        {
+            return dentry;
+        }
+    }
+
+    return 0;
+}
+
+/* Hash a freshly filled entry and hand the first reference to the caller. */
+static void dcache_insert(struct dentry* dentry)
+{
+    uint32_t bucket = dentry->hash % VANA_DCACHE_BUCKETS;
+    dentry->refcount = 1;
+    dentry->hash_next = dcache_buckets[bucket];
+    dcache_buckets[bucket] = dentry;
+}
+
+/*
+ * Return a referenced entry for the root directory of `disk`. The root has
+ * no parent and a NULL `fs_private`, which filesystems interpret as their
+ * root directory.
+ */
+struct dentry* dcache_root(struct disk* disk)
+{
+    uint32_t hash = dcache_hash(disk, 0, "/");
+    struct dentry* dentry = dcache_find(disk, 0, "/", hash);
+    if (dentry)
+    {
+        dcache_get(dentry);
+        return dentry;
+    }
+
+    dentry = dcache_alloc();
+    if (!dentry)
+    {
+        return 0;
+    }
+
+    dentry->disk = disk;
+    strcpy(dentry->name, "/");
+    dentry->hash = hash;
+    dcache_insert(dentry);
+    return dentry;
+}
+
+/*
+ * Look up `name` inside the directory `parent`.
+ *
+ * On a cache miss the filesystem's `lookup` callback is asked for the entry
+ * and the answer, including "does not exist", is cached.
+ *
+ * @param dentry_out  Receives a referenced entry, which may be negative.
+ * @return            Zero on success, -ENOENT if `parent` itself is
+ *                    negative, or another negative status code if the
+ *                    lookup failed and nothing was cached.
+ */
+int dcache_lookup(struct dentry* parent, const char* name, struct dentry** dentry_out)
+{
+    struct disk* disk = parent->disk;
+    if (parent->negative)
+    {
+        return -ENOENT;
+    }
+
+    if (strnlen(name, VANA_MAX_PATH) >= VANA_MAX_PATH)
+    {
+        return -EBADPATH;
+    }
+
+    uint32_t hash = dcache_hash(disk, parent, name);
+    struct dentry* dentry = dcache_find(disk, parent, name, hash);
+    if (dentry)
+    {
+        dcache_get(dentry);
+        *dentry_out = dentry;
+        return 0;
+    }
+
+    struct filesystem* fs = disk->filesystem;
+    if (!fs || !fs->lookup)
+    {
+        return -EUNIMP;
+    }
+
+    void* private = 0;
+    int res = fs->lookup(disk, parent->fs_private, name, &private);
+    if (res < 0 && res != -ENOENT)
+    {
+        return res;
+    }
+
+    dentry = dcache_alloc();
+    if (!dentry)
+    {
+        if (res == 0 && private && fs->release)
+        {
+            fs->release(disk, private);
+        }
+        return -ENOMEM;
+    }
+
+    dentry->disk = disk;
+    dentry->parent = parent;
+    strncpy(dentry->name, name, sizeof(dentry->name));
+    dentry->hash = hash;
+    dentry->negative = res == -ENOENT;
+    dentry->fs_private = dentry->negative ? 0 : private;
+    dcache_get(parent);
+    dcache_insert(dentry);
+
+    *dentry_out = dentry;
+    return 0;
+}
+
+/*
+ * Turn a negative entry positive by creating what it names with the
+ * filesystem callback `create`, either the filesystem's `create` or its
+ * `mkdir`.
+ */
+static int dcache_instantiate(struct dentry* dentry, FS_CREATE_FUNCTION create)
+{
+    struct disk* disk = dentry->disk;
+    if (!dentry->negative || !dentry->parent)
+    {
+        return -EINVARG;
+    }
+
+    if (!create)
+    {
+        return -ERDONLY;
+    }
+
+    void* private = 0;
+    int res = create(disk, dentry->parent->fs_private, dentry->name, &private);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    dentry->fs_private = private;
+    dentry->negative = 0;
+    return 0;
+}
+
+/*
+ * Create the file a negative entry names through the filesystem's `create`
+ * callback. On success the entry becomes positive.
+ *
+ * @return Zero on success, -EINVARG if the entry is not negative, -ERDONLY
+ *         if the filesystem cannot create files, or the filesystem's error.
+ */
+int dcache_create(struct dentry* dentry)
+{
+    struct filesystem* fs = dentry->disk->filesystem;
+    return dcache_instantiate(dentry, fs ? fs->create : 0);
+}
+
+/*
+ * Create the directory a negative entry names through the filesystem's
+ * `mkdir` callback. On success the entry becomes positive.
+ *
+ * @return Zero on success, -EINVARG if the entry is not negative, -ERDONLY
+ *         if the filesystem cannot create directories, or the filesystem's
+ *         error.
+ */
+int dcache_mkdir(struct dentry* dentry)
+{
+    struct filesystem* fs = dentry->disk->filesystem;
+    return dcache_instantiate(dentry, fs ? fs->mkdir : 0);
+}
+
+/*
+ * Remove the file a positive entry names through the filesystem's `unlink`
+ * callback. The caller's reference must be the only one, so open files and
+ * directories with cached children cannot be removed. On success the entry
+ * becomes negative.
+ *
+ * @return Zero on success, -EISTKN if the entry is in use, -ERDONLY if the
+ *         filesystem cannot remove files, or the filesystem's error.
+ */
+int dcache_unlink(struct dentry* dentry)
+{
+    struct disk* disk = dentry->disk;
+    struct filesystem* fs = disk->filesystem;
+    if (dentry->negative || !dentry->parent)
+    {
+        return -EINVARG;
+    }
+
+    // Idle children, such as the negative entries left behind by emptying
+    // a directory, hold references that would keep it from being removed
+    if (dentry->refcount > 1)
+    {
+        dcache_prune_children(dentry);
+    }
+
+    if (dentry->refcount > 1)
+    {
+        return -EISTKN;
+    }
+
+    if (!fs || !fs->unlink)
+    {
+        return -ERDONLY;
+    }
+
+    int res = fs->unlink(disk, dentry->fs_private);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    inode_detach(dentry);
+    if (fs->release)
+    {
+        fs->release(disk, dentry->fs_private);
+    }
+    dentry->fs_private = 0;
+    dentry->negative = 1;
+    return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef DCACHE_H
+#define DCACHE_H
+
+#include <stdint.h>
+#include "config.h"
+
+struct disk;
+struct inode;
+
+/*
+ * A cached directory entry. Positive entries carry the filesystem's handle
+ * for the entry in `fs_private`; negative entries record that the name does
+ * not exist in the parent directory.
+ */
+struct dentry
+{
+    struct disk* disk;
+
+    // NULL for the root directory of a disk
+    struct dentry* parent;
+
+    char name[VANA_MAX_PATH];
+    uint32_t hash;
+
+    int negative;
+    void* fs_private;
+
+    // Shared inode of a positive entry, created when it is first opened
+    struct inode* inode;
+
+    // References held by callers and by child entries
+    int refcount;
+
+    // Root of a mount covering this entry; path walks continue there
+    struct dentry* mounted;
+
+    struct dentry* hash_next;
+
+    // Unreferenced entries are kept on the LRU list until evicted
+    struct dentry* lru_prev;
+    struct dentry* lru_next;
+};
+
+int dcache_init();
+struct dentry* dcache_root(struct disk* disk);
+int dcache_lookup(struct dentry* parent, const char* name, struct dentry** dentry_out);
+void dcache_get(struct dentry* dentry);
+void dcache_put(struct dentry* dentry);
+int dcache_create(struct dentry* dentry);
+int dcache_unlink(struct dentry* dentry);
+int dcache_mkdir(struct dentry* dentry);
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef FAT_H
+#define FAT_H
+
+/*
+ * On-disk structures and per-mount state shared by the FAT16 and FAT32
+ * drivers. The directory, cluster chain and allocation code in fat16.c
+ * serves both variants; fat32.c only adds FAT32 boot sector and FSInfo
+ * handling on top of it.
+ */
+#include "file.h"
+#include <stdint.h>
+
+#define FAT_TYPE_16 16
+#define FAT_TYPE_32 32
+
+// Significant bits of a FAT entry. Values from mask - 0xF upwards are
+// reserved or bad and values from mask - 7 upwards end a chain.
+#define VANA_FAT16_ENTRY_MASK 0xFFFF
+#define VANA_FAT32_ENTRY_MASK 0x0FFFFFFF
+
+// Fat directory entry attributes bitmask
+#define FAT_FILE_READ_ONLY 0x01
+#define FAT_FILE_HIDDEN 0x02
+#define FAT_FILE_SYSTEM 0x04
+#define FAT_FILE_VOLUME_LABEL 0x08
+#define FAT_FILE_SUBDIRECTORY 0x10
+#define FAT_FILE_ARCHIVED 0x20
+#define FAT_FILE_DEVICE 0x40
+#define FAT_FILE_RESERVED 0x80
+
+struct fat_header_extended
+{
+    uint8_t drive_number;
+    uint8_t win_nt_bit;
+    uint8_t signature;
+    uint32_t volume_id;
+    uint8_t volume_id_string[11];
+    uint8_t system_id_string[8];
+} __attribute__((packed));
+
+// FAT32 replaces the FAT16 extended header with its own, which ends in the
+// same fields
+struct fat32_header_extended
+{
+    uint32_t sectors_per_fat;
+    uint16_t flags;
+    uint16_t version;
+    uint32_t root_cluster;
+    uint16_t fsinfo_sector;
+    uint16_t backup_boot_sector;
+    uint8_t reserved[12];
+    struct fat_header_extended extended_header;
+} __attribute__((packed));
+
+struct fat_header
+{
+    uint8_t short_jmp_ins[3];
+    uint8_t oem_identifier[8];
+    uint16_t bytes_per_sector;
+    uint8_t sectors_per_cluster;
+    uint16_t reserved_sectors;
+    uint8_t fat_copies;
+    uint16_t root_dir_entries;
+    uint16_t number_of_sectors;
+    uint8_t media_type;
+    uint16_t sectors_per_fat;
+    uint16_t sectors_per_track;
+    uint16_t number_of_heads;
+    uint32_t hidden_setors;
+    uint32_t sectors_big;
+} __attribute__((packed));
+
+struct fat_h
+{
+    struct fat_header primary_header;
+    union fat_h_e {
+        struct fat_header_extended extended_header;
+        struct fat32_header_extended fat32_header;
+    } shared;
+};
+
+struct fat_directory_item
+{
+    uint8_t filename[8];
+    uint8_t ext[3];
+    uint8_t attribute;
+    uint8_t reserved;
+    uint8_t creation_time_tenths_of_a_sec;
+    uint16_t creation_time;
+    uint16_t creation_date;
+    uint16_t last_access;
+    uint16_t high_16_bits_first_cluster;
+    uint16_t last_mod_time;
+    uint16_t last_mod_date;
+    uint16_t low_16_bits_first_cluster;
+    uint32_t filesize;
+} __attribute__((packed));
+
+// A group of VANA_FAT_TABLE_READAHEAD cached FAT32 table sectors
+struct fat_table_group
+{
+    // Index of the group held, FAT_GROUP_NONE while the slot is unused
+    uint32_t group;
+    // Value of fat_group_clock when the group was last used
+    uint32_t last_used;
+    // VANA_FAT_TABLE_READAHEAD sectors, allocated when the slot is first used
+    char *data;
+};
+
+#define FAT_GROUP_NONE 0xFFFFFFFF
+
+struct fat_private
+{
+    struct fat_h header;
+
+    // FAT_TYPE_16 or FAT_TYPE_32 and the matching entry mask
+    int type;
+    uint32_t entry_mask;
+    uint32_t sectors_per_fat;
+
+    // Location of the fixed size root directory and the first data cluster.
+    // A FAT32 root directory is a cluster chain starting at root_cluster
+    // and has no fixed sectors.
+    uint32_t root_dir_sector;
+    uint32_t root_dir_total_sectors;
+    uint32_t first_data_sector;
+    uint32_t root_cluster;
+
+    // In-memory copy of a FAT16 table, NULL for FAT32
+    uint16_t *fat_table;
+    // Number of entries in the first file allocation table
+    uint32_t fat_total_entries;
+    // One bit per FAT sector modified since the last sync
+    uint8_t *fat_dirty;
+    // FAT32 only: VANA_FAT_TABLE_GROUPS slots caching groups of table
+    // sectors, and per group its slot index plus one or zero when the group
+    // is not resident
+    struct fat_table_group *fat_groups;
+    uint32_t *fat_group_slot;
+    uint32_t fat_group_clock;
+
+    // Data clusters are numbered 2 to total_clusters + 1
+    uint32_t total_clusters;
+    // One bit per cluster, set while the cluster is allocated. Only built
+    // for FAT16; FAT32 tests the FAT entry itself.
+    uint32_t *cluster_bitmap;
+    uint32_t free_clusters;
+    // Cluster the search for a free cluster starts from
+    uint32_t next_free_hint;
+
+    // FSInfo sector of a FAT32 volume holding the two values above, or
+    // zero if the volume has none
+    uint32_t fsinfo_sector;
+};
+
+// Shared mount helpers, see fat16.c
+int fat_mount(struct disk *disk, struct fat_private *private);
+void fat_free_private(struct disk *disk);
+int fat_count_free_clusters(struct disk *disk);
+
+// Shared filesystem callbacks, see fat16.c
+int fat16_lookup(struct disk *disk, void *dir_private, const char *name, void **entry_private_out);
+void fat16_release(struct disk *disk, void *entry_private);
+void *fat16_open(struct disk *disk, struct inode *inode, FILE_MODE mode);
+void fat16_free_inode(struct disk *disk, struct inode *inode);
+int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, char *out_ptr);
+int fat16_pread(struct disk *disk, void *descriptor, uint32_t offset, uint32_t total, char *out);
+int fat16_readpage(struct disk *disk, struct inode *inode, uint32_t index, char *page);
+int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int fat16_stat(struct disk *disk, void *private, struct file_stat *stat);
+int fat16_close(void *private);
+int fat16_readdir(struct disk *disk, void *private, FILE_DIRENT_EMIT emit, void *arg);
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, const char *in);
+int fat16_pwrite(struct disk *disk, void *descriptor, uint32_t offset, uint32_t total, const char *in);
+int fat16_truncate(struct disk *disk, void *descriptor, uint32_t size);
+int fat16_create(struct disk *disk, void *dir_private, const char *name, void **entry_private_out);
+int fat16_unlink(struct disk *disk, void *entry_private);
+
+// Write the free cluster count and hint back to the FSInfo sector, see fat32.c
+int fat32_update_fsinfo(struct disk *disk);
+
+#endif
@@ -2,17 +2,38 @@
  * FAT16 filesystem implementation.
  *
  * The driver parses the on-disk FAT headers to locate the root
- * directory then uses helper streams to traverse subdirectories
- * and follow cluster chains. Cluster handling converts between
+ * directory then walks directories through the block cache and
+ * follows cluster chains. Cluster handling converts between
  * cluster numbers, absolute sectors and file offsets so callers
  * can read arbitrary portions of a file without caring about the
  * underlying layout.
+ *
+ * Writes allocate clusters from an in-memory free cluster bitmap built
+ * at mount. Changes to the FAT and to directory entries are made in
+ * memory and in the block cache and written back by fat16_sync(), which
+ * copies every modified FAT sector into all `fat_copies` tables.
+ *
+ * File data is written in whole sectors straight from the caller's buffer
+ * through the disk queue, which each write or truncate runs once. Partial
+ * sectors at either end of a write are patched in the block cache and go
+ * out with the next sync, which is also the only time the drive's write
+ * cache is flushed.
+ *
+ * Everything past the boot sector is shared with the FAT32 driver in
+ * fat32.c, which mounts through fat_mount() and uses the same callbacks.
+ * The differences (entry width, the cluster-chained root directory, the
+ * lazily read table and FSInfo in place of the bitmap) are driven by the
+ * fields of struct fat_private.
  */
 #include "fat16.h"
+#include "fat.h"
 #include "config.h"
 #include "string/string.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
+#include "disk/bcache.h"
+#include "inode.h"
+#include "pcache.h"
 #include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
@@ -21,129 +42,97 @@
 
 #define VANA_FAT16_SIGNATURE 0x29
 #define VANA_FAT16_FAT_ENTRY_SIZE 0x02
-#define VANA_FAT16_BAD_SECTOR 0xFF7
+#define VANA_FAT32_FAT_ENTRY_SIZE 0x04
 #define VANA_FAT16_UNUSED 0x00
 
-typedef unsigned int FAT_ITEM_TYPE;
-#define FAT_ITEM_TYPE_DIRECTORY 0
-#define FAT_ITEM_TYPE_FILE 1
-
-// Fat directory entry attributes bitmask
-#define FAT_FILE_READ_ONLY 0x01
-#define FAT_FILE_HIDDEN 0x02
-#define FAT_FILE_SYSTEM 0x04
-#define FAT_FILE_VOLUME_LABEL 0x08
-#define FAT_FILE_SUBDIRECTORY 0x10
-#define FAT_FILE_ARCHIVED 0x20
-#define FAT_FILE_DEVICE 0x40
-#define FAT_FILE_RESERVED 0x80
-
-struct fat_header_extended
-{
-    uint8_t drive_number;
-    uint8_t win_nt_bit;
-    uint8_t signature;
-    uint32_t volume_id;
-    uint8_t volume_id_string[11];
-    uint8_t system_id_string[8];
-} __attribute__((packed));
-
-struct fat_header
-{
-    uint8_t short_jmp_ins[3];
-    uint8_t oem_identifier[8];
-    uint16_t bytes_per_sector;
-    uint8_t sectors_per_cluster;
-    uint16_t reserved_sectors;
-    uint8_t fat_copies;
-    uint16_t root_dir_entries;
-    uint16_t number_of_sectors;
-    uint8_t media_type;
-    uint16_t sectors_per_fat;
-    uint16_t sectors_per_track;
-    uint16_t number_of_heads;
-    uint32_t hidden_setors;
-    uint32_t sectors_big;
-} __attribute__((packed));
-
-struct fat_h
-{
-    struct fat_header primary_header;
-    union fat_h_e {
-        struct fat_header_extended extended_header;
-    } shared;
+// Directory visitors return one of these or a negative status code
+#define FAT_WALK_CONTINUE 0
+#define FAT_WALK_STOP 1
+// Returned by the walker itself once the end of directory marker is seen
+#define FAT_WALK_END 2
+
+// Walker flag visiting unused entries instead of live ones
+#define FAT_WALK_FREE_SLOTS 0x01
+
+// First byte of the name of a deleted directory entry
+#define FAT_ENTRY_DELETED 0xE5
+
+// A directory entry found by lookup and where it is stored on disk. Open
+// descriptors of the entry share `item`, so a write through one is seen by
+// all of them.
+struct fat_entry
+{
+    struct fat_directory_item item;
+    uint32_t sector;
+    uint32_t offset;
 };
 
-struct fat_directory_item
-{
-    uint8_t filename[8];
-    uint8_t ext[3];
-    uint8_t attribute;
-    uint8_t reserved;
-    uint8_t creation_time_tenths_of_a_sec;
-    uint16_t creation_time;
-    uint16_t creation_date;
-    uint16_t last_access;
-    uint16_t high_16_bits_first_cluster;
-    uint16_t last_mod_time;
-    uint16_t last_mod_date;
-    uint16_t low_16_bits_first_cluster;
-    uint32_t filesize;
-} __attribute__((packed));
-
-struct fat_directory
-{
-    struct fat_directory_item *item;
-    int total;
-    int sector_pos;
-    int ending_sector_pos;
+typedef int (*FAT_DIRECTORY_VISITOR)(struct fat_directory_item *item, uint32_t sector, uint32_t offset, void *arg);
+
+// A run of physically contiguous clusters in a cluster chain
+struct fat_extent
+{
+    // Index of the run's first cluster within the file
+    uint32_t file_cluster;
+    // Cluster number of the run's first cluster on disk
+    uint32_t disk_cluster;
+    // Clusters in the run
+    uint32_t count;
 };
 
-struct fat_item
+// A cluster chain described as extents sorted by file_cluster
+struct fat_extent_map
 {
-    union {
-        struct fat_directory_item *item;
-        struct fat_directory *directory;
-    };
+    struct fat_extent *extents;
+    int total;
+    int capacity;
+    uint32_t total_clusters;
 
-    FAT_ITEM_TYPE type;
+    // Non-zero once the chain has been walked
+    int built;
 };
 
 struct fat_file_descriptor
 {
-    struct fat_item *item;
     uint32_t pos;
-};
 
-struct fat_private
-{
-    struct fat_h header;
-    struct fat_directory root_directory;
+    struct disk *disk;
+    // Entry the descriptor was opened from, kept alive by the dentry cache
+    struct fat_entry *entry;
+    FILE_MODE mode;
 
-    // Used to stream data clusters
-    struct disk_stream *cluster_read_stream;
-    // Used to stream the file allocation table
-    struct disk_stream *fat_read_stream;
+    // The extent map of the file, stored in its inode and shared with
+    // every other descriptor. Built on the first access so later reads and
+    // seeks skip the chain walk, and kept in step as the chain changes.
+    struct fat_extent_map *extents;
 
-    // Used in situations where we stream the directory
-    struct disk_stream *directory_stream;
+    // Non-zero once the descriptor changed the file, synced on close
+    int dirty;
 };
 
 int fat16_resolve(struct disk *disk);
-void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode);
-int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, char *out_ptr);
-int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode);
-int fat16_stat(struct disk* disk, void* private, struct file_stat* stat);
-int fat16_close(void* private);
 
 struct filesystem fat16_fs =
     {
         .resolve = fat16_resolve,
+        .lookup = fat16_lookup,
+        .release = fat16_release,
         .open = fat16_open,
+        .free_inode = fat16_free_inode,
+        .readpage = fat16_readpage,
         .read = fat16_read,
+        .pread = fat16_pread,
         .seek = fat16_seek,
         .stat = fat16_stat,
-        .close = fat16_close
+        .close = fat16_close,
+        .readdir = fat16_readdir,
+        .write = fat16_write,
+        .pwrite = fat16_pwrite,
+        .truncate = fat16_truncate,
+        .create = fat16_create,
+        .unlink = fat16_unlink,
+        // 8.3 names are stored in upper case and matched case-insensitively
+        .case_insensitive = 1
     };
 
 struct filesystem *fat16_init()
@@ -152,22 +141,6 @@ struct filesystem *fat16_init()
     return &fat16_fs;
 }
 
-/*
- * Initialise the per-disk FAT bookkeeping structure. Three disk streams are
- * created so that directory traversals, FAT lookups and cluster reads can
- * occur independently without constant seeking.
- */
-static void fat16_init_private(struct disk *disk, struct fat_private *private)
-{
-    memset(private, 0, sizeof(struct fat_private));
-private
-    ->cluster_read_stream = diskstreamer_new(disk->id);
-private
-    ->fat_read_stream = diskstreamer_new(disk->id);
-private
-    ->directory_stream = diskstreamer_new(disk->id);
-}
-
 /* Convert a logical sector index into an absolute byte address. */
 int fat16_sector_to_absolute(struct disk *disk, int sector)
 {
@@ -175,124 +148,226 @@ int fat16_sector_to_absolute(struct disk *disk, int sector)
 }
 
 /*
- * Count the number of valid directory entries starting at the given sector.
- * Reading stops once a zero filename entry is encountered. Deleted entries are
- * skipped while the directory stream advances sector by sector.
+ * Derive the location of the root directory and the data region from the
+ * boot sector. The root directory follows the FAT copies and the data
+ * region follows the root directory. FAT32 has no fixed size root
+ * directory, so its data region starts right after the FATs.
  */
-int fat16_get_total_items_for_directory(struct disk *disk, uint32_t directory_start_sector)
+static void fat16_init_layout(struct disk *disk, struct fat_private *fat_private)
 {
-    struct fat_directory_item item;
-    struct fat_directory_item empty_item;
-    memset(&empty_item, 0, sizeof(empty_item));
-
-    struct fat_private *fat_private = disk->fs_private;
+    struct fat_header *primary_header = &fat_private->header.primary_header;
+    uint32_t root_dir_size = primary_header->root_dir_entries * sizeof(struct fat_directory_item);
+    fat_private->root_dir_sector = primary_header->reserved_sectors + primary_header->fat_copies * fat_private->sectors_per_fat;
+    fat_private->root_dir_total_sectors = (root_dir_size + disk->sector_size - 1) / disk->sector_size;
+    fat_private->first_data_sector = fat_private->root_dir_sector + fat_private->root_dir_total_sectors;
+
+    uint32_t total_sectors = primary_header->number_of_sectors ? primary_header->number_of_sectors : primary_header->sectors_big;
+    uint32_t data_sectors = total_sectors > fat_private->first_data_sector ? total_sectors - fat_private->first_data_sector : 0;
+    fat_private->total_clusters = primary_header->sectors_per_cluster ? data_sectors / primary_header->sectors_per_cluster : 0;
+
+    // The FAT has to describe every cluster and the largest cluster number
+    // must stay below the reserved values
+    uint32_t max_cluster = fat_private->entry_mask - 0x10;
+    if (fat_private->total_clusters + 2 > fat_private->fat_total_entries)
+    {
+        fat_private->total_clusters = fat_private->fat_total_entries - 2;
+    }
+    if (fat_private->total_clusters > max_cluster - 1)
+    {
+        fat_private->total_clusters = max_cluster - 1;
+    }
+}
 
-    int res = 0;
-    int i = 0;
-    int directory_start_pos = directory_start_sector * disk->sector_size;
-    struct disk_stream *stream = fat_private->directory_stream;
-    if (diskstreamer_seek(stream, directory_start_pos) != VANA_ALL_OK)
+/*
+ * Build the free cluster bitmap from the cached FAT16 table so allocations
+ * never have to scan the table itself.
+ */
+static int fat16_build_cluster_bitmap(struct disk *disk, struct fat_private *private)
+{
+    uint16_t *fat_table = private->fat_table;
+    uint32_t last_cluster = private->total_clusters + 1;
+    private->cluster_bitmap = kzalloc((last_cluster / 32 + 1) * sizeof(uint32_t));
+    if (!private->cluster_bitmap)
     {
-        res = -EIO;
-        goto out;
+        return -ENOMEM;
     }
 
-    while (1)
+    private->free_clusters = 0;
+    for (uint32_t cluster = 2; cluster <= last_cluster; cluster++)
     {
-        if (diskstreamer_read(stream, &item, sizeof(item)) != VANA_ALL_OK)
+        if (fat_table[cluster] == VANA_FAT16_UNUSED)
         {
-            res = -EIO;
-            goto out;
+            private->free_clusters++;
         }
-
-        if (item.filename[0] == 0x00)
+        else
         {
-            // We are done
-            break;
+            private->cluster_bitmap[cluster / 32] |= 1U << (cluster % 32);
         }
+    }
 
-        // Is the item unused
-        if (item.filename[0] == 0xE5)
+    private->next_free_hint = 2;
+    return 0;
+}
+
+/* Free the cached file allocation table and its bookkeeping. */
+static void fat16_free_fat_table(struct fat_private *private)
+{
+    if (private->fat_table)
+    {
+        kfree(private->fat_table);
+        private->fat_table = 0;
+    }
+    if (private->fat_dirty)
+    {
+        kfree(private->fat_dirty);
+        private->fat_dirty = 0;
+    }
+    if (private->fat_groups)
+    {
+        for (int i = 0; i < VANA_FAT_TABLE_GROUPS; i++)
         {
-            continue;
+            if (private->fat_groups[i].data)
+            {
+                kfree(private->fat_groups[i].data);
+            }
         }
-
-        i++;
+        kfree(private->fat_groups);
+        private->fat_groups = 0;
+    }
+    if (private->fat_group_slot)
+    {
+        kfree(private->fat_group_slot);
+        private->fat_group_slot = 0;
     }
-
-    res = i;
-
-out:
-    return res;
 }
 
 /*
- * Load the FAT root directory into memory.
- * The start sector is derived from header fields and the entire directory
- * is read using the directory stream. The resulting array and metadata are
- * stored in the supplied fat_directory structure.
+ * Set up the in-memory copy of the first file allocation table and the
+ * bitmap tracking its modified sectors.
+ *
+ * A FAT16 table holds at most 65536 16-bit entries (128 KiB) and is read
+ * whole, so every cluster chain walk becomes array lookups instead of a
+ * disk read per entry. A FAT32 table can be far larger. Its sectors are
+ * read on first use in groups of VANA_FAT_TABLE_READAHEAD, and at most
+ * VANA_FAT_TABLE_GROUPS groups are held at once, so mounting reads nothing
+ * and the memory used does not depend on the size of the volume beyond a
+ * slot index per group.
  */
-int fat16_get_root_directory(struct disk *disk, struct fat_private *fat_private, struct fat_directory *directory)
+static int fat16_load_fat_table(struct disk *disk, struct fat_private *fat_private)
 {
     int res = 0;
-    struct fat_directory_item *dir = 0x00;
     struct fat_header *primary_header = &fat_private->header.primary_header;
-    int root_dir_sector_pos = (primary_header->fat_copies * primary_header->sectors_per_fat) + primary_header->reserved_sectors;
-    int root_dir_entries = fat_private->header.primary_header.root_dir_entries;
-    int root_dir_size = (root_dir_entries * sizeof(struct fat_directory_item));
-    int total_sectors = root_dir_size / disk->sector_size;
-    if (root_dir_size % disk->sector_size)
+    uint32_t fat_size = fat_private->sectors_per_fat * disk->sector_size;
+    if (fat_size == 0)
     {
-        total_sectors += 1;
+        return -EFSNOTUS;
     }
 
-    int total_items = fat16_get_total_items_for_directory(disk, root_dir_sector_pos);
-
-    dir = kzalloc(root_dir_size);
-    if (!dir)
+    fat_private->fat_dirty = kzalloc(fat_private->sectors_per_fat / 8 + 1);
+    if (!fat_private->fat_dirty)
     {
         res = -ENOMEM;
-        goto err_out;
+        goto out;
     }
 
-    struct disk_stream *stream = fat_private->directory_stream;
-    if (diskstreamer_seek(stream, fat16_sector_to_absolute(disk, root_dir_sector_pos)) != VANA_ALL_OK)
+    if (fat_private->type == FAT_TYPE_32)
     {
-        res = -EIO;
-        goto err_out;
+        uint32_t groups = (fat_private->sectors_per_fat + VANA_FAT_TABLE_READAHEAD - 1) / VANA_FAT_TABLE_READAHEAD;
+        fat_private->fat_total_entries = fat_size / VANA_FAT32_FAT_ENTRY_SIZE;
+        fat_private->fat_groups = kzalloc(sizeof(struct fat_table_group) * VANA_FAT_TABLE_GROUPS);
+        fat_private->fat_group_slot = kzalloc(groups * sizeof(uint32_t));
+        if (!fat_private->fat_groups || !fat_private->fat_group_slot)
+        {
+            res = -ENOMEM;
+            goto out;
+        }
+
+        for (int i = 0; i < VANA_FAT_TABLE_GROUPS; i++)
+        {
+            fat_private->fat_groups[i].group = FAT_GROUP_NONE;
+        }
+        goto out;
     }
 
-    if (diskstreamer_read(stream, dir, root_dir_size) != VANA_ALL_OK)
+    fat_private->fat_total_entries = fat_size / VANA_FAT16_FAT_ENTRY_SIZE;
+    fat_private->fat_table = kzalloc(fat_size);
+    if (!fat_private->fat_table)
     {
-        res = -EIO;
-        goto err_out;
+        res = -ENOMEM;
+        goto out;
     }
 
-    directory->item = dir;
-    directory->total = total_items;
-    directory->sector_pos = root_dir_sector_pos;
-    directory->ending_sector_pos = root_dir_sector_pos + total_sectors;
+    res = disk_read_block(disk, primary_header->reserved_sectors, fat_private->sectors_per_fat, fat_private->fat_table);
+
 out:
+    if (res < 0)
+    {
+        fat16_free_fat_table(fat_private);
+    }
     return res;
+}
 
-err_out:
-    if (dir)
+/*
+ * Set up the mount state shared by FAT16 and FAT32 once the variant's
+ * resolve code has checked the boot sector and filled in `header`, `type`,
+ * `sectors_per_fat` and, for FAT32, `root_cluster`. Directories are only
+ * read when they are searched or opened.
+ */
+int fat_mount(struct disk *disk, struct fat_private *private)
+{
+    struct fat_header *primary_header = &private->header.primary_header;
+    private->entry_mask = private->type == FAT_TYPE_32 ? VANA_FAT32_ENTRY_MASK : VANA_FAT16_ENTRY_MASK;
+    if (primary_header->sectors_per_cluster == 0 || primary_header->bytes_per_sector != disk->sector_size)
+    {
+        return -EFSNOTUS;
+    }
+
+    int res = fat16_load_fat_table(disk, private);
+    if (res < 0)
     {
-        kfree(dir);
+        return res;
     }
 
+    fat16_init_layout(disk, private);
+    if (private->type == FAT_TYPE_16)
+    {
+        res = fat16_build_cluster_bitmap(disk, private);
+    }
     return res;
 }
+
+/* Free the mount state of a disk whose resolve failed. */
+void fat_free_private(struct disk *disk)
+{
+    struct fat_private *private = disk->fs_private;
+    if (!private)
+    {
+        return;
+    }
+
+    fat16_free_fat_table(private);
+    if (private->cluster_bitmap)
+    {
+        kfree(private->cluster_bitmap);
+    }
+    kfree(private);
+    disk->fs_private = 0;
+}
+
 /*
  * Verify the disk contains a FAT16 filesystem and load its initial metadata.
- * This populates the fat_private structure, reads the boot sector header and
- * parses the root directory so future lookups can be performed quickly.
+ * This populates the fat_private structure from the boot sector header and
+ * hands over to fat_mount(), which caches the FAT, builds the free cluster
+ * bitmap and locates the root directory.
  */
 int fat16_resolve(struct disk *disk)
 {
     int res = 0;
     struct fat_private *fat_private = kzalloc(sizeof(struct fat_private));
-    fat16_init_private(disk, fat_private);
+    if (!fat_private)
+    {
+        return -ENOMEM;
+    }
 
     disk->fs_private = fat_private;
     disk->filesystem = &fat16_fs;
@@ -310,17 +385,17 @@ int fat16_resolve(struct disk *disk)
         goto out;
     }
 
-    if (fat_private->header.shared.extended_header.signature != 0x29)
+    // FAT32 volumes have no 16-bit FAT size and are left to the FAT32 driver
+    if (fat_private->header.shared.extended_header.signature != VANA_FAT16_SIGNATURE ||
+        fat_private->header.primary_header.sectors_per_fat == 0)
     {
         res = -EFSNOTUS;
         goto out;
     }
 
-    if (fat16_get_root_directory(disk, fat_private, &fat_private->root_directory) != VANA_ALL_OK)
-    {
-        res = -EIO;
-        goto out;
-    }
+    fat_private->type = FAT_TYPE_16;
+    fat_private->sectors_per_fat = fat_private->header.primary_header.sectors_per_fat;
+    res = fat_mount(disk, fat_private);
 
 out:
     if (stream)
@@ -330,8 +405,7 @@ out:
 
     if (res < 0)
     {
-        kfree(fat_private);
-        disk->fs_private = 0;
+        fat_free_private(disk);
     }
     return res;
 }
@@ -373,35 +447,23 @@ void fat16_get_full_relative_filename(struct fat_directory_item *item, char *out
     }
 }
 
-/* Duplicate a directory entry so the caller can own the memory. */
-struct fat_directory_item *fat16_clone_directory_item(struct fat_directory_item *item, int size)
-{
-    struct fat_directory_item *item_copy = 0;
-    if (size < sizeof(struct fat_directory_item))
-    {
-        return 0;
-    }
-
-    item_copy = kzalloc(size);
-    if (!item_copy)
-    {
-        return 0;
-    }
-
-    memcpy(item_copy, item, size);
-    return item_copy;
-}
-
 /* Extract the starting cluster number from a directory item. */
 static uint32_t fat16_get_first_cluster(struct fat_directory_item *item)
 {
     return (item->high_16_bits_first_cluster << 16) | item->low_16_bits_first_cluster;
 };
 
+/* Store the starting cluster number in a directory item. */
+static void fat16_set_first_cluster(struct fat_directory_item *item, uint32_t cluster)
+{
+    item->high_16_bits_first_cluster = cluster >> 16;
+    item->low_16_bits_first_cluster = cluster & 0xFFFF;
+}
+
 /* Convert a cluster index to the absolute sector that stores it. */
-static int fat16_cluster_to_sector(struct fat_private *private, int cluster)
+static uint32_t fat16_cluster_to_sector(struct fat_private *private, uint32_t cluster)
 {
-    return private->root_directory.ending_sector_pos + ((cluster - 2) * private->header.primary_header.sectors_per_cluster);
+    return private->first_data_sector + ((cluster - 2) * private->header.primary_header.sectors_per_cluster);
 }
 
 /* The FAT begins immediately after the reserved sectors. */
@@ -410,431 +472,2048 @@ static uint32_t fat16_get_first_fat_sector(struct fat_private *private)
     return private->header.primary_header.reserved_sectors;
 }
 
+/* Non-zero if a FAT entry value ends a cluster chain. */
+static int fat16_is_end_of_chain(struct fat_private *private, uint32_t entry)
+{
+    return entry >= private->entry_mask - 7;
+}
+
 /*
- * Read the FAT entry for the supplied cluster. The FAT table
- * stores 16-bit indices forming a linked list of clusters.
+ * Non-zero if a FAT entry value names a data cluster. Clusters 0 and 1 are
+ * reserved and the top 16 values are reserved, bad or end of chain marks.
  */
-static int fat16_get_fat_entry(struct disk *disk, int cluster)
+static int fat16_is_data_cluster(struct fat_private *private, uint32_t entry)
 {
-    int res = -1;
-    struct fat_private *private = disk->fs_private;
-    struct disk_stream *stream = private->fat_read_stream;
-    if (!stream)
-    {
-        goto out;
-    }
-
-    uint32_t fat_table_position = fat16_get_first_fat_sector(private) * disk->sector_size;
-    res = diskstreamer_seek(stream, fat_table_position + (cluster * VANA_FAT16_FAT_ENTRY_SIZE));
-    if (res < 0)
-    {
-        goto out;
-    }
-
-    uint16_t result = 0;
-    res = diskstreamer_read(stream, &result, sizeof(result));
-    if (res < 0)
-    {
-        goto out;
-    }
-
-    res = result;
-out:
-    return res;
+    return entry >= 2 && entry < private->entry_mask - 0xF;
 }
+
 /*
- * Walk the FAT chain in order to find the cluster that contains a given file
- * offset. Each cluster pointer is read from the FAT table until the desired
- * offset has been reached or an invalid entry is hit.
+ * Copy a modified sector of the cached FAT into every one of the
+ * `fat_copies` tables through the block cache and clear its dirty bit.
  */
-static int fat16_get_cluster_for_offset(struct disk *disk, int starting_cluster, int offset)
+static int fat16_write_fat_sector(struct disk *disk, uint32_t sector, char *data)
 {
-    int res = 0;
     struct fat_private *private = disk->fs_private;
-    int size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
-    int cluster_to_use = starting_cluster;
-    int clusters_ahead = offset / size_of_cluster_bytes;
-    for (int i = 0; i < clusters_ahead; i++)
+    struct fat_header *primary_header = &private->header.primary_header;
+    for (uint32_t copy = 0; copy < primary_header->fat_copies; copy++)
     {
-        int entry = fat16_get_fat_entry(disk, cluster_to_use);
-        if (entry == 0xFFf8 || entry == 0xFFFF)
+        struct bcache_block *block = 0;
+        uint32_t lba = primary_header->reserved_sectors + copy * private->sectors_per_fat + sector;
+        int res = bcache_get_new(disk, lba, &block);
+        if (res < 0)
         {
-            // We are at the last entry in the file
-            res = -EIO;
-            goto out;
+            return res;
         }
 
-        // Sector is marked as bad?
-        if (entry == VANA_FAT16_BAD_SECTOR)
-        {
-            res = -EIO;
-            goto out;
-        }
+        memcpy(block->data, data, disk->sector_size);
+        bcache_mark_dirty(block);
+        bcache_put(block);
+    }
 
-        // Reserved sector?
-        if (entry == 0xFF0 || entry == 0xFF6)
+    private->fat_dirty[sector / 8] &= ~(1 << (sector % 8));
+    return 0;
+}
+
+/* Write the modified sectors of a resident FAT32 group, see fat16_write_fat_sector(). */
+static int fat16_write_fat_group(struct disk *disk, struct fat_table_group *slot)
+{
+    struct fat_private *private = disk->fs_private;
+    uint32_t first_sector = slot->group * VANA_FAT_TABLE_READAHEAD;
+    for (uint32_t i = 0; i < VANA_FAT_TABLE_READAHEAD && first_sector + i < private->sectors_per_fat; i++)
+    {
+        uint32_t sector = first_sector + i;
+        if (!(private->fat_dirty[sector / 8] & (1 << (sector % 8))))
         {
-            res = -EIO;
-            goto out;
+            continue;
         }
 
-        if (entry == 0x00)
+        int res = fat16_write_fat_sector(disk, sector, slot->data + i * disk->sector_size);
+        if (res < 0)
         {
-            res = -EIO;
-            goto out;
+            return res;
         }
-
-        cluster_to_use = entry;
     }
 
-    res = cluster_to_use;
-out:
-    return res;
+    return 0;
 }
+
 /*
- * Read a sequence of bytes from a file starting at the given cluster. The
- * helper seeks the supplied stream to the correct sector and handles reads
- * that span multiple clusters by recursing until all bytes have been copied.
+ * Take a slot for a FAT32 group about to be read: an unused one, or else
+ * the least recently used one after its modified sectors were handed to
+ * the block cache.
  */
-static int fat16_read_internal_from_stream(struct disk *disk, struct disk_stream *stream, int cluster, int offset, int total, void *out)
+static int fat16_claim_fat_group(struct disk *disk, struct fat_table_group **slot_out)
 {
-    int res = 0;
     struct fat_private *private = disk->fs_private;
-    int size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
-    int cluster_to_use = fat16_get_cluster_for_offset(disk, cluster, offset);
-    if (cluster_to_use < 0)
+    struct fat_table_group *victim = 0;
+    for (int i = 0; i < VANA_FAT_TABLE_GROUPS; i++)
     {
-        res = cluster_to_use;
-        goto out;
-    }
-
-    int offset_from_cluster = offset % size_of_cluster_bytes;
+        struct fat_table_group *slot = &private->fat_groups[i];
+        if (slot->group == FAT_GROUP_NONE)
+        {
+            if (!slot->data)
+            {
+                slot->data = kzalloc(VANA_FAT_TABLE_READAHEAD * disk->sector_size);
+                if (!slot->data)
+                {
+                    break;
+                }
+            }
+
+            *slot_out = slot;
+            return 0;
+        }
 
-    int starting_sector = fat16_cluster_to_sector(private, cluster_to_use);
-    int starting_pos = (starting_sector * disk->sector_size) + offset_from_cluster;
-    int total_to_read = total > size_of_cluster_bytes ? size_of_cluster_bytes : total;
-    res = diskstreamer_seek(stream, starting_pos);
-    if (res != VANA_ALL_OK)
-    {
-        goto out;
+        if (!victim || slot->last_used < victim->last_used)
+        {
+            victim = slot;
+        }
     }
 
-    res = diskstreamer_read(stream, out, total_to_read);
-    if (res != VANA_ALL_OK)
+    if (!victim)
     {
-        goto out;
+        return -ENOMEM;
     }
 
-    total -= total_to_read;
-    if (total > 0)
+    int res = fat16_write_fat_group(disk, victim);
+    if (res < 0)
     {
-        // We still have more to read
-        res = fat16_read_internal_from_stream(disk, stream, cluster, offset + total_to_read, total, out + total_to_read);
+        return res;
     }
 
-out:
-    return res;
-}
-
-/* Convenience wrapper that reads using the per-disk cluster stream. */
-static int fat16_read_internal(struct disk *disk, int starting_cluster, int offset, int total, void *out)
-{
-    struct fat_private *fs_private = disk->fs_private;
-    struct disk_stream *stream = fs_private->cluster_read_stream;
-    return fat16_read_internal_from_stream(disk, stream, starting_cluster, offset, total, out);
+    private->fat_group_slot[victim->group] = 0;
+    victim->group = FAT_GROUP_NONE;
+    *slot_out = victim;
+    return 0;
 }
 
-/* Release memory owned by a fat_directory structure. */
-void fat16_free_directory(struct fat_directory *directory)
+/*
+ * Find the entry of `cluster` in a FAT32 table. The group of
+ * VANA_FAT_TABLE_READAHEAD sectors holding it is read with one request on
+ * first use, evicting the least recently used group once
+ * VANA_FAT_TABLE_GROUPS are resident. The returned pointer is only valid
+ * until the next call.
+ */
+static int fat16_load_fat_entry(struct disk *disk, uint32_t cluster, uint32_t **entry_out)
 {
-    if (!directory)
+    struct fat_private *private = disk->fs_private;
+    uint32_t entries_per_group = VANA_FAT_TABLE_READAHEAD * disk->sector_size / VANA_FAT32_FAT_ENTRY_SIZE;
+    uint32_t group = cluster / entries_per_group;
+    struct fat_table_group *slot = 0;
+    if (private->fat_group_slot[group])
     {
-        return;
+        slot = &private->fat_groups[private->fat_group_slot[group] - 1];
     }
-
-    if (directory->item)
+    else
     {
-        kfree(directory->item);
+        int res = fat16_claim_fat_group(disk, &slot);
+        if (res < 0)
+        {
+            return res;
+        }
+
+        uint32_t first_sector = group * VANA_FAT_TABLE_READAHEAD;
+        uint32_t sectors = private->sectors_per_fat - first_sector;
+        if (sectors > VANA_FAT_TABLE_READAHEAD)
+        {
+            sectors = VANA_FAT_TABLE_READAHEAD;
+        }
+
+        // An evicted group's changes may still be dirty in the block cache
+        uint32_t lba = fat16_get_first_fat_sector(private) + first_sector;
+        res = bcache_sync_range(disk, lba, sectors);
+        if (res == 0)
+        {
+            res = disk_read_block(disk, lba, sectors, slot->data);
+        }
+        if (res < 0)
+        {
+            return res;
+        }
+
+        slot->group = group;
+        private->fat_group_slot[group] = slot - private->fat_groups + 1;
     }
 
-    kfree(directory);
+    slot->last_used = ++private->fat_group_clock;
+    *entry_out = (uint32_t *)slot->data + cluster % entries_per_group;
+    return 0;
 }
 
-/* Free a fat_item and any directory or entry it references. */
-void fat16_fat_item_free(struct fat_item *item)
+/*
+ * Read the FAT entry for the supplied cluster. The FAT table stores 16 or
+ * 28-bit indices forming a linked list of clusters and is served from the
+ * cached copy; the top four bits of a FAT32 entry are reserved and masked.
+ */
+static int fat16_get_fat_entry(struct disk *disk, int cluster)
 {
-    if (item->type == FAT_ITEM_TYPE_DIRECTORY)
+    struct fat_private *private = disk->fs_private;
+    if (cluster < 0 || (uint32_t)cluster >= private->fat_total_entries)
     {
-        fat16_free_directory(item->directory);
+        return -EIO;
     }
-    else if (item->type == FAT_ITEM_TYPE_FILE)
+
+    if (private->type == FAT_TYPE_32)
     {
-        kfree(item->item);
+        uint32_t *fat_entry = 0;
+        int res = fat16_load_fat_entry(disk, cluster, &fat_entry);
+        if (res < 0)
+        {
+            return res;
+        }
+        return *fat_entry & VANA_FAT32_ENTRY_MASK;
     }
 
-    kfree(item);
+    return private->fat_table[cluster];
 }
 
 /*
- * Given a directory entry for a subdirectory, read the entire directory
- * cluster chain into memory and return it as a fat_directory structure.
+ * Change the FAT entry of a cluster. The cached table, the free cluster
+ * bitmap and count are updated and the FAT sector is marked for the next
+ * sync.
+ *
+ * @return Zero, or a negative status code if the FAT32 group holding the
+ *         entry could not be read.
  */
-struct fat_directory *fat16_load_fat_directory(struct disk *disk, struct fat_directory_item *item)
+static int fat16_set_fat_entry(struct disk *disk, uint32_t cluster, uint32_t value)
 {
-    int res = 0;
-    struct fat_directory *directory = 0;
-    struct fat_private *fat_private = disk->fs_private;
-    if (!(item->attribute & FAT_FILE_SUBDIRECTORY))
+    struct fat_private *private = disk->fs_private;
+    int was_free = 0;
+    uint32_t sector = 0;
+    if (private->type == FAT_TYPE_32)
     {
-        res = -EINVARG;
-        goto out;
-    }
+        uint32_t *fat_entry = 0;
+        int res = fat16_load_fat_entry(disk, cluster, &fat_entry);
+        if (res < 0)
+        {
+            return res;
+        }
 
-    directory = kzalloc(sizeof(struct fat_directory));
-    if (!directory)
-    {
-        res = -ENOMEM;
-        goto out;
+        // The reserved top bits keep their value
+        was_free = (*fat_entry & VANA_FAT32_ENTRY_MASK) == VANA_FAT16_UNUSED;
+        *fat_entry = (*fat_entry & ~VANA_FAT32_ENTRY_MASK) | (value & VANA_FAT32_ENTRY_MASK);
+        sector = cluster * VANA_FAT32_FAT_ENTRY_SIZE / disk->sector_size;
     }
-
-    int cluster = fat16_get_first_cluster(item);
-    int cluster_sector = fat16_cluster_to_sector(fat_private, cluster);
-    int total_items = fat16_get_total_items_for_directory(disk, cluster_sector);
-    directory->total = total_items;
-    int directory_size = directory->total * sizeof(struct fat_directory_item);
-    directory->item = kzalloc(directory_size);
-    if (!directory->item)
+    else
     {
-        res = -ENOMEM;
-        goto out;
+        uint16_t *fat_table = private->fat_table;
+        was_free = fat_table[cluster] == VANA_FAT16_UNUSED;
+        fat_table[cluster] = value;
+        sector = cluster * VANA_FAT16_FAT_ENTRY_SIZE / disk->sector_size;
     }
 
-    res = fat16_read_internal(disk, cluster, 0x00, directory_size, directory->item);
-    if (res != VANA_ALL_OK)
+    private->fat_dirty[sector / 8] |= 1 << (sector % 8);
+
+    if (cluster < 2 || cluster > private->total_clusters + 1)
     {
-        goto out;
+        return 0;
     }
 
-out:
-    if (res != VANA_ALL_OK)
+    if (value == VANA_FAT16_UNUSED && !was_free)
     {
-        fat16_free_directory(directory);
+        if (private->cluster_bitmap)
+        {
+            private->cluster_bitmap[cluster / 32] &= ~(1U << (cluster % 32));
+        }
+        private->free_clusters++;
     }
-    return directory;
-}
-/*
- * Wrap a directory entry in a fat_item structure. Directories are lazily
- * loaded so only the descriptor is cloned for files while subdirectories are
- * read immediately.
- */
-struct fat_item *fat16_new_fat_item_for_directory_item(struct disk *disk, struct fat_directory_item *item)
-{
-    struct fat_item *f_item = kzalloc(sizeof(struct fat_item));
-    if (!f_item)
+    else if (value != VANA_FAT16_UNUSED && was_free)
     {
-        return 0;
-    }
+        if (private->cluster_bitmap)
+        {
+            private->cluster_bitmap[cluster / 32] |= 1U << (cluster % 32);
+        }
 
-    if (item->attribute & FAT_FILE_SUBDIRECTORY)
-    {
-        f_item->directory = fat16_load_fat_directory(disk, item);
-        f_item->type = FAT_ITEM_TYPE_DIRECTORY;
-        return f_item;
+        // A count taken from FSInfo is only a hint and may be too low
+        if (private->free_clusters)
+        {
+            private->free_clusters--;
+        }
     }
 
-    f_item->type = FAT_ITEM_TYPE_FILE;
-    f_item->item = fat16_clone_directory_item(item, sizeof(struct fat_directory_item));
-    return f_item;
+    return 0;
 }
 
-/* Search a directory for an entry matching the given name. */
-struct fat_item *fat16_find_item_in_directory(struct disk *disk, struct fat_directory *directory, const char *name)
+/*
+ * Count the free clusters by reading the whole FAT. Only needed for FAT32
+ * volumes whose FSInfo sector does not hold a usable count.
+ */
+int fat_count_free_clusters(struct disk *disk)
 {
-    struct fat_item *f_item = 0;
-    char tmp_filename[VANA_MAX_PATH];
-    for (int i = 0; i < directory->total; i++)
+    struct fat_private *private = disk->fs_private;
+    uint32_t free_clusters = 0;
+    for (uint32_t cluster = 2; cluster <= private->total_clusters + 1; cluster++)
     {
-        fat16_get_full_relative_filename(&directory->item[i], tmp_filename, sizeof(tmp_filename));
-        if (istrncmp(tmp_filename, name, sizeof(tmp_filename)) == 0)
+        int entry = fat16_get_fat_entry(disk, cluster);
+        if (entry < 0)
+        {
+            return entry;
+        }
+
+        if (entry == VANA_FAT16_UNUSED)
         {
-            // Found it let's create a new fat_item
-            f_item = fat16_new_fat_item_for_directory_item(disk, &directory->item[i]);
+            free_clusters++;
         }
     }
 
-    return f_item;
+    private->free_clusters = free_clusters;
+    return 0;
 }
+
 /*
- * Traverse the directory hierarchy described by the parsed path and return
- * the final fat_item representing the file or directory.
+ * Non-zero if `cluster` is not allocated, zero if it is, or a negative
+ * status code. FAT16 answers from the bitmap and FAT32 from the FAT entry.
  */
-struct fat_item *fat16_get_directory_entry(struct disk *disk, struct path_part *path)
+static int fat16_cluster_is_free(struct disk *disk, uint32_t cluster)
 {
-    struct fat_private *fat_private = disk->fs_private;
-    struct fat_item *current_item = 0;
-    struct fat_item *root_item = fat16_find_item_in_directory(disk, &fat_private->root_directory, path->part);
-    if (!root_item)
+    struct fat_private *private = disk->fs_private;
+    if (private->cluster_bitmap)
     {
-        goto out;
+        return !(private->cluster_bitmap[cluster / 32] & (1U << (cluster % 32)));
     }
 
-    struct path_part *next_part = path->next;
-    current_item = root_item;
-    while (next_part != 0)
-    {
-        if (current_item->type != FAT_ITEM_TYPE_DIRECTORY)
-        {
-            current_item = 0;
+    int entry = fat16_get_fat_entry(disk, cluster);
+    return entry < 0 ? entry : entry == VANA_FAT16_UNUSED;
+}
+
+/*
+ * Choose a free cluster for a chain that still needs `wanted` clusters.
+ *
+ * `goal`, the cluster following the chain's current last cluster, is taken
+ * when it is free so the chain stays contiguous. Otherwise the search
+ * starts from the next free hint and looks for a run of `wanted` free
+ * clusters, using the first free cluster seen if no run is long enough.
+ * On FAT16 fully allocated bitmap words are skipped. FAT32 reads FAT
+ * entries instead and stops looking for a longer run once it is
+ * VANA_FAT32_RUN_SEARCH clusters past the first free one, so a fragmented
+ * volume does not pull its whole FAT into memory.
+ *
+ * @return Zero with the cluster in `cluster_out`, -ENOSPC or the error
+ *         that stopped the FAT from being read.
+ */
+static int fat16_find_free_cluster(struct disk *disk, uint32_t goal, uint32_t wanted, uint32_t *cluster_out)
+{
+    struct fat_private *private = disk->fs_private;
+    uint32_t first_cluster = 2;
+    uint32_t last_cluster = private->total_clusters + 1;
+    if (private->free_clusters == 0)
+    {
+        return -ENOSPC;
+    }
+
+    if (goal >= first_cluster && goal <= last_cluster)
+    {
+        int is_free = fat16_cluster_is_free(disk, goal);
+        if (is_free < 0)
+        {
+            return is_free;
+        }
+
+        if (is_free)
+        {
+            *cluster_out = goal;
+            return 0;
+        }
+    }
+
+    uint32_t fallback = 0;
+    uint32_t run_start = 0;
+    uint32_t run_length = 0;
+    uint32_t cluster = private->next_free_hint;
+    for (uint32_t i = 0; i < private->total_clusters; i++, cluster++)
+    {
+        if (cluster > last_cluster || cluster < first_cluster)
+        {
+            // Runs do not wrap around the end of the disk
+            cluster = first_cluster;
+            run_length = 0;
+        }
+
+        if (private->cluster_bitmap && cluster % 32 == 0 && i + 32 <= private->total_clusters &&
+            private->cluster_bitmap[cluster / 32] == 0xFFFFFFFF)
+        {
+            cluster += 31;
+            i += 31;
+            run_length = 0;
+            continue;
+        }
+
+        if (!private->cluster_bitmap && fallback && cluster - fallback >= VANA_FAT32_RUN_SEARCH)
+        {
             break;
         }
 
-        struct fat_item *tmp_item = fat16_find_item_in_directory(disk, current_item->directory, next_part->part);
-        fat16_fat_item_free(current_item);
-        current_item = tmp_item;
-        next_part = next_part->next;
+        int is_free = fat16_cluster_is_free(disk, cluster);
+        if (is_free < 0)
+        {
+            return is_free;
+        }
+
+        if (!is_free)
+        {
+            run_length = 0;
+            continue;
+        }
+
+        if (run_length == 0)
+        {
+            run_start = cluster;
+        }
+        run_length++;
+
+        if (!fallback)
+        {
+            fallback = cluster;
+        }
+
+        if (run_length >= wanted)
+        {
+            *cluster_out = run_start;
+            return 0;
+        }
     }
-out:
-    return current_item;
+
+    if (!fallback)
+    {
+        return -ENOSPC;
+    }
+
+    *cluster_out = fallback;
+    return 0;
 }
 
 /*
- * Filesystem open callback. Resolves the path to a fat_item and allocates a
- * file descriptor used for subsequent operations.
+ * Copy every FAT sector modified since the last sync into all FAT copies
+ * through the block cache, refresh the FSInfo sector of a FAT32 volume,
+ * then write back the disk's dirty blocks, which include modified
+ * directory sectors and partially written data sectors, and flush the
+ * drive's write cache.
  */
-void *fat16_open(struct disk *disk, struct path_part *path, FILE_MODE mode)
+static int fat16_sync(struct disk *disk)
 {
-    struct fat_file_descriptor *descriptor = 0;
-    int err_code = 0;
-    if (mode != FILE_MODE_READ)
+    struct fat_private *private = disk->fs_private;
+    if (private->fat_groups)
     {
-        err_code = -ERDONLY;
-        goto err_out;
+        // Evicted FAT32 groups already handed their changes to the block cache
+        for (int i = 0; i < VANA_FAT_TABLE_GROUPS; i++)
+        {
+            if (private->fat_groups[i].group == FAT_GROUP_NONE)
+            {
+                continue;
+            }
+
+            int res = fat16_write_fat_group(disk, &private->fat_groups[i]);
+            if (res < 0)
+            {
+                return res;
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t sector = 0; sector < private->sectors_per_fat; sector++)
+        {
+            if (!(private->fat_dirty[sector / 8] & (1 << (sector % 8))))
+            {
+                continue;
+            }
+
+            int res = fat16_write_fat_sector(disk, sector, (char *)private->fat_table + sector * disk->sector_size);
+            if (res < 0)
+            {
+                return res;
+            }
+        }
     }
 
-    descriptor = kzalloc(sizeof(struct fat_file_descriptor));
-    if (!descriptor)
+    if (private->fsinfo_sector)
     {
-        err_code = -ENOMEM;
-        goto err_out;
+        int res = fat32_update_fsinfo(disk);
+        if (res < 0)
+        {
+            return res;
+        }
     }
 
-    descriptor->item = fat16_get_directory_entry(disk, path);
-    if (!descriptor->item)
+    int res = bcache_sync(disk);
+    if (res < 0)
     {
-        err_code = -EIO;
-        goto err_out;
+        return res;
     }
 
-    descriptor->pos = 0;
-    return descriptor;
+    return disk_flush(disk);
+}
 
-err_out:
-    if(descriptor)
-        kfree(descriptor);
+/*
+ * Append a cluster to an extent map. The cluster joins the last extent when
+ * it physically follows it, otherwise a new extent is started. The extent
+ * array grows a heap block at a time.
+ */
+static int fat16_extent_map_append(struct fat_extent_map *map, uint32_t cluster)
+{
+    if (map->total > 0)
+    {
+        struct fat_extent *last = &map->extents[map->total - 1];
+        if (last->disk_cluster + last->count == cluster)
+        {
+            last->count++;
+            map->total_clusters++;
+            return 0;
+        }
+    }
 
-    return ERROR(err_code);
+    if (map->total == map->capacity)
+    {
+        int new_capacity = map->capacity + VANA_HEAP_BLOCK_SIZE / sizeof(struct fat_extent);
+        struct fat_extent *extents = kzalloc(new_capacity * sizeof(struct fat_extent));
+        if (!extents)
+        {
+            return -ENOMEM;
+        }
+
+        if (map->extents)
+        {
+            memcpy(extents, map->extents, map->total * sizeof(struct fat_extent));
+            kfree(map->extents);
+        }
+        map->extents = extents;
+        map->capacity = new_capacity;
+    }
+
+    struct fat_extent *extent = &map->extents[map->total++];
+    extent->file_cluster = map->total_clusters;
+    extent->disk_cluster = cluster;
+    extent->count = 1;
+    map->total_clusters++;
+    return 0;
 }
 
-/* Helper for close() to release a fat_file_descriptor. */
-static void fat16_free_file_descriptor(struct fat_file_descriptor* desc)
+/* Release the extent array of a map and reset it to the unbuilt state. */
+static void fat16_extent_map_free(struct fat_extent_map *map)
 {
-    fat16_fat_item_free(desc->item);
-    kfree(desc);
+    if (map->extents)
+    {
+        kfree(map->extents);
+    }
+
+    memset(map, 0, sizeof(struct fat_extent_map));
 }
 
+/*
+ * Walk the cluster chain starting at `first_cluster` once and record it as
+ * runs of physically contiguous clusters. Chains that contain free, bad or
+ * reserved entries are rejected. Empty files (first cluster 0) produce an
+ * empty map.
+ */
+static int fat16_build_extent_map(struct disk *disk, uint32_t first_cluster, struct fat_extent_map *map)
+{
+    int res = 0;
+    struct fat_private *private = disk->fs_private;
+    memset(map, 0, sizeof(struct fat_extent_map));
+
+    uint32_t cluster = first_cluster;
+    while (cluster != 0 && !fat16_is_end_of_chain(private, cluster))
+    {
+        // Free, bad and reserved values cannot be part of a chain and a
+        // chain longer than the FAT must contain a loop
+        if (!fat16_is_data_cluster(private, cluster) || map->total_clusters >= private->fat_total_entries)
+        {
+            res = -EIO;
+            goto out;
+        }
+
+        res = fat16_extent_map_append(map, cluster);
+        if (res < 0)
+        {
+            goto out;
+        }
 
-/* Filesystem close callback. */
-int fat16_close(void* private)
+        int entry = fat16_get_fat_entry(disk, cluster);
+        if (entry <= 0)
+        {
+            res = -EIO;
+            goto out;
+        }
+
+        cluster = entry;
+    }
+
+    map->built = 1;
+
+out:
+    if (res < 0)
+    {
+        fat16_extent_map_free(map);
+    }
+    return res;
+}
+
+/*
+ * Binary search the extent holding the file relative cluster index.
+ *
+ * @return The extent or NULL if the index lies beyond the end of the chain.
+ */
+static struct fat_extent *fat16_extent_for_cluster(struct fat_extent_map *map, uint32_t file_cluster)
 {
-    fat16_free_file_descriptor((struct fat_file_descriptor*) private);
+    int low = 0;
+    int high = map->total - 1;
+    while (low <= high)
+    {
+        int middle = (low + high) / 2;
+        struct fat_extent *extent = &map->extents[middle];
+        if (file_cluster < extent->file_cluster)
+        {
+            high = middle - 1;
+        }
+        else if (file_cluster >= extent->file_cluster + extent->count)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            return extent;
+        }
+    }
+
     return 0;
 }
 
-/* Populate a file_stat structure for an open descriptor. */
-int fat16_stat(struct disk* disk, void* private, struct file_stat* stat)
+/*
+ * Read `total` bytes starting `offset` bytes into sector `lba`. Whole
+ * sectors are queued as one multi-sector request straight into `out` and
+ * only read once the caller runs the disk queue, after any of them still
+ * dirty in the block cache were written back. Partial sectors at either end
+ * are copied from the block cache, where partial writes leave them.
+ * Positions are kept as sectors so volumes larger than 4 GiB can be
+ * addressed.
+ */
+static int fat16_read_disk_bytes(struct disk *disk, uint32_t lba, uint32_t offset, uint32_t total, char *out)
 {
     int res = 0;
-    struct fat_file_descriptor* descriptor = (struct fat_file_descriptor*) private;
-    struct fat_item* desc_item = descriptor->item;
-    if (desc_item->type != FAT_ITEM_TYPE_FILE)
+    lba += offset / disk->sector_size;
+    offset %= disk->sector_size;
+    while (total > 0)
     {
-        res = -EINVARG;
-        goto out;
-    }
+        uint32_t sectors = total / disk->sector_size;
+        if (offset == 0 && sectors > 0)
+        {
+            res = bcache_sync_range(disk, lba, sectors);
+            if (res < 0)
+            {
+                break;
+            }
+
+            res = disk_queue_read(disk, lba, sectors, out);
+            if (res < 0)
+            {
+                break;
+            }
+
+            lba += sectors;
+            out += sectors * disk->sector_size;
+            total -= sectors * disk->sector_size;
+            continue;
+        }
 
-    struct fat_directory_item* ritem = desc_item->item;
-    stat->filesize = ritem->filesize;
-    stat->flags = 0x00;
+        uint32_t bytes = disk->sector_size - offset;
+        if (bytes > total)
+        {
+            bytes = total;
+        }
 
-    if (ritem->attribute & FAT_FILE_READ_ONLY)
-    {
-        stat->flags |= FILE_STAT_READ_ONLY;
+        struct bcache_block *block = 0;
+        res = bcache_get(disk, lba, &block);
+        if (res < 0)
+        {
+            break;
+        }
+
+        memcpy(out, block->data + offset, bytes);
+        bcache_put(block);
+        lba++;
+        offset = 0;
+        out += bytes;
+        total -= bytes;
     }
-out:
+
     return res;
 }
 
-/* Read one or more objects from an open file descriptor. */
-int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, char *out_ptr)
+/*
+ * Read a sequence of bytes from a file described by an extent map. The
+ * extent holding the offset is found directly and the read continues to the
+ * end of that physically contiguous run, so each run costs a single disk
+ * request no matter how many clusters it spans. The requests of all runs
+ * are queued first and dispatched together, so the disk queue can sort and
+ * merge them.
+ */
+static int fat16_read_internal(struct disk *disk, struct fat_extent_map *map, uint32_t offset, uint32_t total, char *out)
 {
     int res = 0;
-    struct fat_file_descriptor *fat_desc = descriptor;
-    struct fat_directory_item *item = fat_desc->item->item;
-    int offset = fat_desc->pos;
-    for (uint32_t i = 0; i < nmemb; i++)
+    int run_res = 0;
+    struct fat_private *private = disk->fs_private;
+    uint32_t size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
+    while (total > 0)
     {
-        res = fat16_read_internal(disk, fat16_get_first_cluster(item), offset, size, out_ptr);
-        if (ISERR(res))
+        uint32_t file_cluster = offset / size_of_cluster_bytes;
+        struct fat_extent *extent = fat16_extent_for_cluster(map, file_cluster);
+        if (!extent)
+        {
+            // The chain ends before the requested offset
+            res = -EIO;
+            goto out;
+        }
+
+        uint32_t offset_in_run = (file_cluster - extent->file_cluster) * size_of_cluster_bytes + offset % size_of_cluster_bytes;
+        uint32_t run_bytes_left = extent->count * size_of_cluster_bytes - offset_in_run;
+        uint32_t total_to_read = total > run_bytes_left ? run_bytes_left : total;
+
+        res = fat16_read_disk_bytes(disk, fat16_cluster_to_sector(private, extent->disk_cluster), offset_in_run, total_to_read, out);
+        if (res < 0)
         {
             goto out;
         }
 
-        out_ptr += size;
-        offset += size;
+        offset += total_to_read;
+        out += total_to_read;
+        total -= total_to_read;
     }
-    fat_desc->pos = offset;
-    res = nmemb;
+
 out:
-    return res;
+    // Queued reads target `out`, so they are dispatched even after an error
+    run_res = disk_queue_run(disk);
+    return res < 0 ? res : run_res;
 }
 
-/* Adjust the read position for an open FAT file descriptor. */
-int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode)
+/*
+ * Make sure the shared extent map of a descriptor's file describes its
+ * cluster chain, building it on first use or after the chain was cut.
+ */
+static int fat16_descriptor_extents(struct disk *disk, struct fat_file_descriptor *desc)
+{
+    if (desc->extents->built)
+    {
+        return 0;
+    }
+
+    return fat16_build_extent_map(disk, fat16_get_first_cluster(&desc->entry->item), desc->extents);
+}
+
+/*
+ * Cut the cluster chain of an entry down to its first `clusters` clusters
+ * and return the rest to the free bitmap. A length of zero frees the whole
+ * chain and clears the entry's first cluster. The file's extent map `map`,
+ * if given, is dropped to be rebuilt on next use.
+ */
+static int fat16_shrink_chain(struct disk *disk, struct fat_entry *entry, struct fat_extent_map *map, uint32_t clusters)
 {
     int res = 0;
-    struct fat_file_descriptor *desc = private;
-    struct fat_item *desc_item = desc->item;
-    if (desc_item->type != FAT_ITEM_TYPE_FILE)
+    struct fat_private *private = disk->fs_private;
+    uint32_t cluster = fat16_get_first_cluster(&entry->item);
+    if (clusters == 0)
     {
-        res = -EINVARG;
-        goto out;
+        fat16_set_first_cluster(&entry->item, 0);
+    }
+    else
+    {
+        for (uint32_t i = 1; i < clusters && fat16_is_data_cluster(private, cluster); i++)
+        {
+            cluster = fat16_get_fat_entry(disk, cluster);
+        }
+
+        if (!fat16_is_data_cluster(private, cluster))
+        {
+            // The chain is already this short
+            return 0;
+        }
+
+        uint32_t next = fat16_get_fat_entry(disk, cluster);
+        res = fat16_set_fat_entry(disk, cluster, private->entry_mask);
+        if (res < 0)
+        {
+            goto out;
+        }
+        cluster = next;
     }
 
-    struct fat_directory_item *ritem = desc_item->item;
-    if (offset >= ritem->filesize)
+    uint32_t freed = 0;
+    while (fat16_is_data_cluster(private, cluster) && freed++ < private->fat_total_entries)
     {
-        res = -EIO;
-        goto out;
+        uint32_t next = fat16_get_fat_entry(disk, cluster);
+        res = fat16_set_fat_entry(disk, cluster, VANA_FAT16_UNUSED);
+        if (res < 0)
+        {
+            break;
+        }
+        cluster = next;
     }
 
-    switch (seek_mode)
+out:
+    if (map)
     {
-    case SEEK_SET:
-        desc->pos = offset;
-        break;
+        fat16_extent_map_free(map);
+    }
+    return res;
+}
 
-    case SEEK_END:
-        res = -EUNIMP;
-        break;
+/*
+ * Grow the cluster chain of an entry to `clusters` clusters, keeping the
+ * built extent map `map` in step. New clusters continue the last run when
+ * possible.
+ *
+ * @return Zero, or a negative status code such as -ENOSPC with the
+ *         clusters added so far still linked into the chain.
+ */
+static int fat16_extend_chain(struct disk *disk, struct fat_entry *entry, struct fat_extent_map *map, uint32_t clusters)
+{
+    int res = 0;
+    struct fat_private *private = disk->fs_private;
+    while (map->total_clusters < clusters)
+    {
+        uint32_t last = 0;
+        if (map->total > 0)
+        {
+            struct fat_extent *extent = &map->extents[map->total - 1];
+            last = extent->disk_cluster + extent->count - 1;
+        }
 
-    case SEEK_CUR:
-        desc->pos += offset;
-        break;
+        uint32_t cluster = 0;
+        res = fat16_find_free_cluster(disk, last ? last + 1 : 0, clusters - map->total_clusters, &cluster);
+        if (res < 0)
+        {
+            break;
+        }
 
-    default:
-        res = -EINVARG;
-        break;
+        res = fat16_extent_map_append(map, cluster);
+        if (res < 0)
+        {
+            break;
+        }
+
+        res = fat16_set_fat_entry(disk, cluster, private->entry_mask);
+        if (res == 0 && last)
+        {
+            res = fat16_set_fat_entry(disk, last, cluster);
+            if (res < 0)
+            {
+                fat16_set_fat_entry(disk, cluster, VANA_FAT16_UNUSED);
+            }
+        }
+        if (res < 0)
+        {
+            break;
+        }
+
+        if (!last)
+        {
+            fat16_set_first_cluster(&entry->item, cluster);
+        }
+
+        private->next_free_hint = cluster + 1;
     }
-out:
+
     return res;
 }
+
+/*
+ * Write `total` bytes starting `offset` bytes into sector `lba`. Whole
+ * sectors are queued as one request straight from `in`, so `in` must stay
+ * valid until the caller runs the disk queue; copies of them in the block
+ * cache are updated to match. A partial sector at either end is patched in
+ * the block cache and left dirty for the next sync.
+ */
+static int fat16_write_disk_bytes(struct disk *disk, uint32_t lba, uint32_t offset, uint32_t total, const char *in)
+{
+    int res = 0;
+    lba += offset / disk->sector_size;
+    offset %= disk->sector_size;
+    while (total > 0)
+    {
+        uint32_t sectors = total / disk->sector_size;
+        if (offset == 0 && sectors > 0)
+        {
+            bcache_update_range(disk, lba, sectors, in);
+            res = disk_queue_write(disk, lba, sectors, in);
+            if (res < 0)
+            {
+                break;
+            }
+
+            lba += sectors;
+            in += sectors * disk->sector_size;
+            total -= sectors * disk->sector_size;
+            continue;
+        }
+
+        uint32_t bytes = disk->sector_size - offset;
+        if (bytes > total)
+        {
+            bytes = total;
+        }
+
+        struct bcache_block *block = 0;
+        res = bcache_get(disk, lba, &block);
+        if (res < 0)
+        {
+            break;
+        }
+
+        memcpy(block->data + offset, (void *)in, bytes);
+        bcache_mark_dirty(block);
+        bcache_put(block);
+        lba++;
+        offset = 0;
+        in += bytes;
+        total -= bytes;
+    }
+
+    return res;
+}
+
+/*
+ * Write a sequence of bytes to a file described by an extent map whose
+ * chain is already long enough, one request per contiguous run. The
+ * requests are only queued; the caller runs the disk queue before `in`
+ * goes away.
+ */
+static int fat16_write_internal(struct disk *disk, struct fat_extent_map *map, uint32_t offset, uint32_t total, const char *in)
+{
+    int res = 0;
+    struct fat_private *private = disk->fs_private;
+    uint32_t size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
+    while (total > 0)
+    {
+        uint32_t file_cluster = offset / size_of_cluster_bytes;
+        struct fat_extent *extent = fat16_extent_for_cluster(map, file_cluster);
+        if (!extent)
+        {
+            res = -EIO;
+            break;
+        }
+
+        uint32_t offset_in_run = (file_cluster - extent->file_cluster) * size_of_cluster_bytes + offset % size_of_cluster_bytes;
+        uint32_t run_bytes_left = extent->count * size_of_cluster_bytes - offset_in_run;
+        uint32_t total_to_write = total > run_bytes_left ? run_bytes_left : total;
+
+        res = fat16_write_disk_bytes(disk, fat16_cluster_to_sector(private, extent->disk_cluster), offset_in_run, total_to_write, in);
+        if (res < 0)
+        {
+            break;
+        }
+
+        offset += total_to_write;
+        in += total_to_write;
+        total -= total_to_write;
+    }
+
+    return res;
+}
+
+// Source of zero fill writes, allocated on first use and never freed so
+// queued requests can point at it
+static char *fat16_zero_block = 0;
+
+/*
+ * Fill a range of a file with zeros, used when a file grows without data.
+ * Like fat16_write_internal() the writes are only queued.
+ */
+static int fat16_write_zeros(struct disk *disk, struct fat_extent_map *map, uint32_t offset, uint32_t total)
+{
+    int res = 0;
+    if (!fat16_zero_block)
+    {
+        fat16_zero_block = kzalloc(VANA_HEAP_BLOCK_SIZE);
+        if (!fat16_zero_block)
+        {
+            return -ENOMEM;
+        }
+    }
+
+    while (total > 0 && res == 0)
+    {
+        uint32_t chunk = total > VANA_HEAP_BLOCK_SIZE ? VANA_HEAP_BLOCK_SIZE : total;
+        res = fat16_write_internal(disk, map, offset, chunk, fat16_zero_block);
+        offset += chunk;
+        total -= chunk;
+    }
+
+    return res;
+}
+
+/* Copy an entry's item back into its directory sector in the block cache. */
+static int fat16_write_entry(struct disk *disk, struct fat_entry *entry)
+{
+    struct bcache_block *block = 0;
+    int res = bcache_get(disk, entry->sector, &block);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    memcpy(block->data + entry->offset, &entry->item, sizeof(struct fat_directory_item));
+    bcache_mark_dirty(block);
+    bcache_put(block);
+    return 0;
+}
+
+/*
+ * Change the size of an entry's file. Shrinking frees the clusters past
+ * the new end; growing allocates clusters and zero fills the new bytes.
+ * The directory entry is updated in the block cache.
+ */
+static int fat16_resize(struct disk *disk, struct fat_file_descriptor *desc, uint32_t size)
+{
+    struct fat_private *private = disk->fs_private;
+    struct fat_entry *entry = desc->entry;
+    uint32_t size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
+    uint32_t old_size = entry->item.filesize;
+    uint32_t clusters = size / size_of_cluster_bytes + (size % size_of_cluster_bytes ? 1 : 0);
+
+    int res = fat16_descriptor_extents(disk, desc);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    uint32_t old_clusters = desc->extents->total_clusters;
+    if (clusters < old_clusters)
+    {
+        res = fat16_shrink_chain(disk, entry, desc->extents, clusters);
+    }
+    else if (clusters > old_clusters)
+    {
+        res = fat16_extend_chain(disk, entry, desc->extents, clusters);
+        if (res < 0)
+        {
+            fat16_shrink_chain(disk, entry, desc->extents, old_clusters);
+        }
+    }
+
+    if (res == 0 && size > old_size)
+    {
+        res = fat16_write_zeros(disk, desc->extents, old_size, size - old_size);
+        int run_res = disk_queue_run(disk);
+        res = res < 0 ? res : run_res;
+    }
+
+    if (res == 0)
+    {
+        entry->item.filesize = size;
+        entry->item.attribute |= FAT_FILE_ARCHIVED;
+    }
+
+    desc->dirty = 1;
+    int write_res = fat16_write_entry(disk, entry);
+    return res < 0 ? res : write_res;
+}
+
+/*
+ * Visit the live entries of one directory sector held in the block cache.
+ * Deleted entries, long name entries and the volume label are skipped.
+ * With FAT_WALK_FREE_SLOTS only deleted and never used entries are visited
+ * instead and the end of directory marker does not end the walk.
+ *
+ * @return FAT_WALK_CONTINUE to go on with the next sector, FAT_WALK_STOP if
+ *         the visitor stopped, FAT_WALK_END at the end of directory marker
+ *         or a negative status code.
+ */
+static int fat16_walk_directory_sector(struct disk *disk, uint32_t sector, int flags, FAT_DIRECTORY_VISITOR visitor, void *arg)
+{
+    struct bcache_block *block = 0;
+    int res = bcache_get(disk, sector, &block);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct fat_directory_item *items = (struct fat_directory_item *)block->data;
+    int items_per_sector = disk->sector_size / sizeof(struct fat_directory_item);
+    for (int i = 0; i < items_per_sector; i++)
+    {
+        int unused = items[i].filename[0] == 0x00 || items[i].filename[0] == FAT_ENTRY_DELETED;
+        if (flags & FAT_WALK_FREE_SLOTS)
+        {
+            if (!unused)
+            {
+                continue;
+            }
+        }
+        else if (items[i].filename[0] == 0x00)
+        {
+            res = FAT_WALK_END;
+            break;
+        }
+        else if (unused || (items[i].attribute & FAT_FILE_VOLUME_LABEL))
+        {
+            continue;
+        }
+
+        res = visitor(&items[i], sector, i * sizeof(struct fat_directory_item), arg);
+        if (res != FAT_WALK_CONTINUE)
+        {
+            break;
+        }
+    }
+
+    bcache_put(block);
+    return res;
+}
+
+/*
+ * First cluster of the directory described by `item`, or of the root
+ * directory when `item` is NULL. Zero stands for the fixed size FAT16 root
+ * directory. FAT32 ".." entries pointing at the root store zero as well
+ * and are mapped to the root directory's cluster chain.
+ */
+static uint32_t fat16_directory_cluster(struct fat_private *private, struct fat_directory_item *item)
+{
+    uint32_t cluster = item ? fat16_get_first_cluster(item) : 0;
+    return cluster ? cluster : private->root_cluster;
+}
+
+/*
+ * Walk a directory in place, one cached sector at a time, calling `visitor`
+ * for every live entry until it stops the walk or the directory ends.
+ *
+ * @param first_cluster  First cluster of the directory, or 0 for the fixed
+ *                       size FAT16 root directory.
+ * @param flags          FAT_WALK_FREE_SLOTS or zero.
+ * @return               Zero or a negative status code.
+ */
+static int fat16_walk_directory(struct disk *disk, uint32_t first_cluster, int flags, FAT_DIRECTORY_VISITOR visitor, void *arg)
+{
+    int res = FAT_WALK_CONTINUE;
+    struct fat_private *private = disk->fs_private;
+    if (first_cluster == 0)
+    {
+        for (uint32_t i = 0; i < private->root_dir_total_sectors && res == FAT_WALK_CONTINUE; i++)
+        {
+            res = fat16_walk_directory_sector(disk, private->root_dir_sector + i, flags, visitor, arg);
+        }
+
+        return res < 0 ? res : 0;
+    }
+
+    uint32_t cluster = first_cluster;
+    uint32_t clusters_walked = 0;
+    while (res == FAT_WALK_CONTINUE)
+    {
+        if (!fat16_is_data_cluster(private, cluster) || clusters_walked++ >= private->fat_total_entries)
+        {
+            res = -EIO;
+            break;
+        }
+
+        uint32_t sector = fat16_cluster_to_sector(private, cluster);
+        for (int i = 0; i < private->header.primary_header.sectors_per_cluster && res == FAT_WALK_CONTINUE; i++)
+        {
+            res = fat16_walk_directory_sector(disk, sector + i, flags, visitor, arg);
+        }
+
+        int entry = fat16_get_fat_entry(disk, cluster);
+        if (entry <= 0)
+        {
+            res = res == FAT_WALK_CONTINUE ? -EIO : res;
+            break;
+        }
+
+        if (fat16_is_end_of_chain(private, entry))
+        {
+            break;
+        }
+        cluster = entry;
+    }
+
+    return res < 0 ? res : 0;
+}
+
+struct fat_lookup
+{
+    const char *name;
+    struct fat_entry *entry;
+};
+
+/* Directory visitor stopping at the first entry whose name matches. */
+static int fat16_match_directory_item(struct fat_directory_item *item, uint32_t sector, uint32_t offset, void *arg)
+{
+    struct fat_lookup *lookup = arg;
+    char tmp_filename[VANA_MAX_PATH];
+    fat16_get_full_relative_filename(item, tmp_filename, sizeof(tmp_filename));
+    if (istrncmp(tmp_filename, lookup->name, sizeof(tmp_filename)) != 0)
+    {
+        return FAT_WALK_CONTINUE;
+    }
+
+    memcpy(&lookup->entry->item, item, sizeof(struct fat_directory_item));
+    lookup->entry->sector = sector;
+    lookup->entry->offset = offset;
+    return FAT_WALK_STOP;
+}
+
+/*
+ * Filesystem lookup callback used by the dentry cache. Searches the root
+ * directory when `dir_private` is NULL, otherwise the subdirectory described
+ * by the fat_entry it points to. The directory is searched in place through
+ * the block cache and the search stops at the first match. The entry
+ * private data is a fat_entry recording the item and where it is stored.
+ */
+int fat16_lookup(struct disk *disk, void *dir_private, const char *name, void **entry_private_out)
+{
+    int res = 0;
+    struct fat_directory_item *dir_item = 0;
+    if (dir_private)
+    {
+        struct fat_entry *dir_entry = dir_private;
+        if (!(dir_entry->item.attribute & FAT_FILE_SUBDIRECTORY))
+        {
+            return -ENOENT;
+        }
+        dir_item = &dir_entry->item;
+    }
+
+    uint32_t cluster = fat16_directory_cluster(disk->fs_private, dir_item);
+
+    struct fat_entry *entry = kzalloc(sizeof(struct fat_entry));
+    if (!entry)
+    {
+        return -ENOMEM;
+    }
+
+    // Marks the entry as not found until the visitor fills it in
+    entry->item.filename[0] = 0x00;
+    struct fat_lookup lookup = {.name = name, .entry = entry};
+    res = fat16_walk_directory(disk, cluster, 0, fat16_match_directory_item, &lookup);
+    if (res == 0 && entry->item.filename[0] == 0x00)
+    {
+        res = -ENOENT;
+    }
+
+    if (res < 0)
+    {
+        kfree(entry);
+        return res;
+    }
+
+    *entry_private_out = entry;
+    return 0;
+}
+
+/* Filesystem release callback freeing a fat_entry created by lookup. */
+void fat16_release(struct disk *disk, void *entry_private)
+{
+    kfree(entry_private);
+}
+
+/*
+ * Filesystem open callback. Allocates a file descriptor for the entry found
+ * by lookup and gives the file's inode an extent map on its first open, so
+ * every descriptor of the file shares one map. FILE_MODE_WRITE truncates
+ * the file and FILE_MODE_APPEND positions every write at its end; both are
+ * refused for directories, read-only files and disks that cannot be
+ * written. Directories, the root included, are opened to be listed with
+ * fat16_readdir().
+ */
+void *fat16_open(struct disk *disk, struct inode *inode, FILE_MODE mode)
+{
+    struct fat_file_descriptor *descriptor = 0;
+    int err_code = 0;
+    struct fat_entry *entry = inode->fs_private;
+    if (mode != FILE_MODE_READ)
+    {
+        // A NULL entry is the root directory
+        if (!entry || (entry->item.attribute & FAT_FILE_SUBDIRECTORY))
+        {
+            err_code = -EINVARG;
+            goto err_out;
+        }
+
+        if ((entry->item.attribute & FAT_FILE_READ_ONLY) || !disk->write)
+        {
+            err_code = -ERDONLY;
+            goto err_out;
+        }
+    }
+
+    if (!inode->private)
+    {
+        inode->private = kzalloc(sizeof(struct fat_extent_map));
+        if (!inode->private)
+        {
+            err_code = -ENOMEM;
+            goto err_out;
+        }
+    }
+
+    descriptor = kzalloc(sizeof(struct fat_file_descriptor));
+    if (!descriptor)
+    {
+        err_code = -ENOMEM;
+        goto err_out;
+    }
+
+    descriptor->pos = 0;
+    descriptor->disk = disk;
+    descriptor->entry = entry;
+    descriptor->mode = mode;
+    descriptor->extents = inode->private;
+    if (mode == FILE_MODE_WRITE && entry->item.filesize > 0)
+    {
+        err_code = fat16_resize(disk, descriptor, 0);
+        if (err_code < 0)
+        {
+            goto err_out;
+        }
+    }
+
+    return descriptor;
+
+err_out:
+    if (descriptor)
+    {
+        kfree(descriptor);
+    }
+
+    return ERROR(err_code);
+}
+
+/* Filesystem free_inode callback releasing the extent map of a file. */
+void fat16_free_inode(struct disk *disk, struct inode *inode)
+{
+    struct fat_extent_map *map = inode->private;
+    if (map)
+    {
+        fat16_extent_map_free(map);
+        kfree(map);
+        inode->private = 0;
+    }
+}
+
+/*
+ * Filesystem close callback. Metadata changed through the descriptor is
+ * written back first; if that fails the descriptor stays open.
+ */
+int fat16_close(void* private)
+{
+    struct fat_file_descriptor* desc = private;
+    if (desc->dirty)
+    {
+        int res = fat16_sync(desc->disk);
+        if (res < 0)
+        {
+            return res;
+        }
+    }
+
+    kfree(desc);
+    return 0;
+}
+
+/* Non-zero if the descriptor is open on a regular file. */
+static int fat16_descriptor_is_file(struct fat_file_descriptor *desc)
+{
+    return desc->entry && !(desc->entry->item.attribute & FAT_FILE_SUBDIRECTORY);
+}
+
+struct fat_readdir
+{
+    FILE_DIRENT_EMIT emit;
+    void *arg;
+    // Entries visited so far and the descriptor's position among them
+    uint32_t index;
+    uint32_t *pos;
+    int refused;
+};
+
+/*
+ * Directory visitor handing every entry from the descriptor's position on
+ * to the VFS. The position counts the entries the walk visits, so it stays
+ * put across calls as long as the directory does not change.
+ */
+static int fat16_readdir_item(struct fat_directory_item *item, uint32_t sector, uint32_t offset, void *arg)
+{
+    struct fat_readdir *readdir = arg;
+    uint32_t index = readdir->index++;
+    if (index < *readdir->pos)
+    {
+        return FAT_WALK_CONTINUE;
+    }
+
+    // "." and ".." of subdirectories
+    if (item->filename[0] != '.')
+    {
+        char name[VANA_MAX_PATH];
+        fat16_get_full_relative_filename(item, name, sizeof(name));
+        int directory = item->attribute & FAT_FILE_SUBDIRECTORY;
+        if (readdir->emit(readdir->arg, name, directory ? FILE_DIRENT_DIRECTORY : FILE_DIRENT_FILE,
+                          directory ? 0 : item->filesize, fat16_get_first_cluster(item)) < 0)
+        {
+            readdir->refused = 1;
+            return FAT_WALK_STOP;
+        }
+    }
+
+    *readdir->pos = index + 1;
+    return FAT_WALK_CONTINUE;
+}
+
+/*
+ * Filesystem readdir callback. Walks the directory's sectors in place
+ * through the block cache, as lookup does, and reports each entry with the
+ * type, size and first cluster from its directory item.
+ */
+int fat16_readdir(struct disk *disk, void *private, FILE_DIRENT_EMIT emit, void *arg)
+{
+    struct fat_file_descriptor *desc = private;
+    if (fat16_descriptor_is_file(desc))
+    {
+        return -EINVARG;
+    }
+
+    struct fat_directory_item *dir_item = desc->entry ? &desc->entry->item : 0;
+    uint32_t cluster = fat16_directory_cluster(disk->fs_private, dir_item);
+    struct fat_readdir readdir = {.emit = emit, .arg = arg, .index = 0, .pos = &desc->pos, .refused = 0};
+    int res = fat16_walk_directory(disk, cluster, 0, fat16_readdir_item, &readdir);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return readdir.refused;
+}
+
+/* Populate a file_stat structure for an open descriptor. */
+int fat16_stat(struct disk* disk, void* private, struct file_stat* stat)
+{
+    struct fat_file_descriptor* descriptor = (struct fat_file_descriptor*) private;
+    if (!fat16_descriptor_is_file(descriptor))
+    {
+        return -EINVARG;
+    }
+
+    struct fat_directory_item* ritem = &descriptor->entry->item;
+    stat->filesize = ritem->filesize;
+    stat->flags = 0x00;
+
+    if (ritem->attribute & FAT_FILE_READ_ONLY)
+    {
+        stat->flags |= FILE_STAT_READ_ONLY;
+    }
+    return 0;
+}
+
+/*
+ * Read `total` bytes of a file from `offset`, which the caller has checked
+ * lie within the file, with one request per contiguous run of clusters
+ * directly into `out`.
+ */
+static int fat16_read_at(struct disk *disk, struct fat_file_descriptor *fat_desc, uint32_t offset, uint32_t total, char *out)
+{
+    int res = fat16_descriptor_extents(disk, fat_desc);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return fat16_read_internal(disk, fat_desc->extents, offset, total, out);
+}
+
+/*
+ * Read one or more objects from an open file descriptor.
+ *
+ * The byte span of all `nmemb` objects is computed once and clamped to the
+ * objects that fit before the end of the file, then read with a single
+ * call.
+ *
+ * @return The number of complete objects read, which is less than `nmemb`
+ *         only at the end of the file, or a negative status code.
+ */
+int fat16_read(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, char *out_ptr)
+{
+    int res = 0;
+    struct fat_file_descriptor *fat_desc = descriptor;
+    if (!fat16_descriptor_is_file(fat_desc))
+    {
+        res = -EINVARG;
+        goto out;
+    }
+
+    struct fat_directory_item *item = &fat_desc->entry->item;
+    if (fat_desc->pos >= item->filesize)
+    {
+        res = 0;
+        goto out;
+    }
+
+    uint32_t available = item->filesize - fat_desc->pos;
+    if (nmemb > available / size)
+    {
+        nmemb = available / size;
+    }
+
+    uint32_t total = size * nmemb;
+    if (total == 0)
+    {
+        res = 0;
+        goto out;
+    }
+
+    res = fat16_read_at(disk, fat_desc, fat_desc->pos, total, out_ptr);
+    if (ISERR(res))
+    {
+        goto out;
+    }
+
+    fat_desc->pos += total;
+    res = nmemb;
+out:
+    return res;
+}
+
+/*
+ * Filesystem pread callback: read up to `total` bytes from `offset`
+ * without touching the descriptor's position.
+ *
+ * @return The number of bytes read, zero at or past the end of the file,
+ *         or a negative status code.
+ */
+int fat16_pread(struct disk *disk, void *descriptor, uint32_t offset, uint32_t total, char *out)
+{
+    struct fat_file_descriptor *fat_desc = descriptor;
+    if (!fat16_descriptor_is_file(fat_desc))
+    {
+        return -EINVARG;
+    }
+
+    uint32_t filesize = fat_desc->entry->item.filesize;
+    if (offset >= filesize || total == 0)
+    {
+        return 0;
+    }
+
+    if (total > filesize - offset)
+    {
+        total = filesize - offset;
+    }
+
+    int res = fat16_read_at(disk, fat_desc, offset, total, out);
+    return res < 0 ? res : (int)total;
+}
+
+/*
+ * Filesystem readpage callback filling a page cache page from the file's
+ * shared extent map. Only files that have been opened have a map, and the
+ * page cache is only filled through open descriptors.
+ */
+int fat16_readpage(struct disk *disk, struct inode *inode, uint32_t index, char *page)
+{
+    int res = 0;
+    struct fat_entry *entry = inode->fs_private;
+    struct fat_extent_map *map = inode->private;
+    if (!entry || !map || (entry->item.attribute & FAT_FILE_SUBDIRECTORY))
+    {
+        return -EINVARG;
+    }
+
+    uint32_t offset = index * PCACHE_PAGE_SIZE;
+    uint32_t total = 0;
+    if (offset < entry->item.filesize)
+    {
+        total = entry->item.filesize - offset;
+        if (total > PCACHE_PAGE_SIZE)
+        {
+            total = PCACHE_PAGE_SIZE;
+        }
+    }
+
+    if (total > 0)
+    {
+        if (!map->built)
+        {
+            res = fat16_build_extent_map(disk, fat16_get_first_cluster(&entry->item), map);
+            if (res < 0)
+            {
+                return res;
+            }
+        }
+
+        res = fat16_read_internal(disk, map, offset, total, page);
+        if (res < 0)
+        {
+            return res;
+        }
+    }
+
+    memset(page + total, 0, PCACHE_PAGE_SIZE - total);
+    return 0;
+}
+
+/*
+ * Move the position of an open FAT file descriptor. `offset` is signed
+ * relative to the current position or the end of the file. Positions past
+ * the end are allowed: reads there return nothing and a write zero fills
+ * the gap.
+ */
+int fat16_seek(void *private, uint32_t offset, FILE_SEEK_MODE seek_mode)
+{
+    struct fat_file_descriptor *desc = private;
+    if (!fat16_descriptor_is_file(desc))
+    {
+        return -EINVARG;
+    }
+
+    int64_t base = 0;
+    switch (seek_mode)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+
+    case SEEK_CUR:
+        base = desc->pos;
+        break;
+
+    case SEEK_END:
+        base = desc->entry->item.filesize;
+        break;
+
+    default:
+        return -EINVARG;
+    }
+
+    int64_t pos = base + (int32_t)offset;
+    if (pos < 0 || pos > 0xFFFFFFFF)
+    {
+        return -EINVARG;
+    }
+
+    desc->pos = (uint32_t)pos;
+    return 0;
+}
+
+/*
+ * Write `total` bytes at `offset` of a file open for writing.
+ *
+ * The chain is first extended to cover the whole span, preferring clusters
+ * that continue the file's last run, then the data is written with one
+ * request per contiguous run. Writing past the end of the file zero fills
+ * any gap and grows the file. The directory entry is updated in the block
+ * cache and written back when the descriptor is closed.
+ *
+ * @return Zero or a negative status code, in which case the file keeps its
+ *         previous size.
+ */
+static int fat16_write_at(struct disk *disk, struct fat_file_descriptor *fat_desc, uint32_t offset, uint32_t total, const char *in)
+{
+    int res = 0;
+    int run_res = 0;
+    struct fat_private *private = disk->fs_private;
+    struct fat_entry *entry = fat_desc->entry;
+    uint32_t end = offset + total;
+    if (end < offset)
+    {
+        return -EINVARG;
+    }
+
+    res = fat16_descriptor_extents(disk, fat_desc);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    uint32_t size_of_cluster_bytes = private->header.primary_header.sectors_per_cluster * disk->sector_size;
+    uint32_t old_clusters = fat_desc->extents->total_clusters;
+    uint32_t clusters = end / size_of_cluster_bytes + (end % size_of_cluster_bytes ? 1 : 0);
+    uint32_t old_size = entry->item.filesize;
+    fat_desc->dirty = 1;
+    if (clusters > old_clusters)
+    {
+        res = fat16_extend_chain(disk, entry, fat_desc->extents, clusters);
+        if (res < 0)
+        {
+            goto out;
+        }
+    }
+
+    if (offset > old_size)
+    {
+        res = fat16_write_zeros(disk, fat_desc->extents, old_size, offset - old_size);
+        if (res < 0)
+        {
+            goto out;
+        }
+    }
+
+    res = fat16_write_internal(disk, fat_desc->extents, offset, total, in);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    if (end > entry->item.filesize)
+    {
+        entry->item.filesize = end;
+    }
+    entry->item.attribute |= FAT_FILE_ARCHIVED;
+
+out:
+    // Queued writes point into `in`, so they are dispatched even after an error
+    run_res = disk_queue_run(disk);
+    if (res == 0 && run_res < 0)
+    {
+        res = run_res;
+        entry->item.filesize = old_size;
+    }
+
+    if (res < 0 && clusters > old_clusters)
+    {
+        // Give back whatever was allocated for the failed write
+        fat16_shrink_chain(disk, entry, fat_desc->extents, old_clusters);
+    }
+
+    int write_res = fat16_write_entry(disk, entry);
+    return res < 0 ? res : write_res;
+}
+
+/* Non-zero if the descriptor may be written through. */
+static int fat16_descriptor_writable(struct fat_file_descriptor *desc)
+{
+    return fat16_descriptor_is_file(desc) && desc->mode != FILE_MODE_READ;
+}
+
+/*
+ * Write one or more objects at the descriptor's position, or at the end of
+ * the file in append mode, see fat16_write_at().
+ *
+ * @return `nmemb` or a negative status code.
+ */
+int fat16_write(struct disk *disk, void *descriptor, uint32_t size, uint32_t nmemb, const char *in)
+{
+    struct fat_file_descriptor *fat_desc = descriptor;
+    if (!fat16_descriptor_writable(fat_desc))
+    {
+        return fat16_descriptor_is_file(fat_desc) ? -ERDONLY : -EINVARG;
+    }
+
+    if (fat_desc->mode == FILE_MODE_APPEND)
+    {
+        fat_desc->pos = fat_desc->entry->item.filesize;
+    }
+
+    if (nmemb > 0xFFFFFFFF / size)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t total = size * nmemb;
+    int res = fat16_write_at(disk, fat_desc, fat_desc->pos, total, in);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    fat_desc->pos += total;
+    return nmemb;
+}
+
+/*
+ * Filesystem pwrite callback: write `total` bytes at `offset` without
+ * touching the descriptor's position. Descriptors opened for appending
+ * write at `offset` too.
+ *
+ * @return `total` or a negative status code.
+ */
+int fat16_pwrite(struct disk *disk, void *descriptor, uint32_t offset, uint32_t total, const char *in)
+{
+    struct fat_file_descriptor *fat_desc = descriptor;
+    if (!fat16_descriptor_writable(fat_desc))
+    {
+        return fat16_descriptor_is_file(fat_desc) ? -ERDONLY : -EINVARG;
+    }
+
+    int res = fat16_write_at(disk, fat_desc, offset, total, in);
+    return res < 0 ? res : (int)total;
+}
+
+/* Filesystem truncate callback, see fat16_resize(). */
+int fat16_truncate(struct disk *disk, void *descriptor, uint32_t size)
+{
+    struct fat_file_descriptor *fat_desc = descriptor;
+    if (!fat16_descriptor_is_file(fat_desc))
+    {
+        return -EINVARG;
+    }
+
+    if (fat_desc->mode == FILE_MODE_READ)
+    {
+        return -ERDONLY;
+    }
+
+    return fat16_resize(disk, fat_desc, size);
+}
+
+/*
+ * Convert a name to the blank padded, upper case 8.3 form stored in a
+ * directory entry. Names that do not fit 8.3 or use characters FAT does
+ * not allow are rejected; long file names are not supported.
+ */
+static int fat16_make_short_name(const char *name, struct fat_directory_item *item)
+{
+    const char *invalid = "\"*+,/:;<=>?[\\]|";
+    memset(item->filename, ' ', sizeof(item->filename));
+    memset(item->ext, ' ', sizeof(item->ext));
+
+    int length = 0;
+    int dot = -1;
+    for (length = 0; name[length]; length++)
+    {
+        if (name[length] == '.')
+        {
+            if (dot >= 0)
+            {
+                return -EBADPATH;
+            }
+            dot = length;
+            continue;
+        }
+
+        if (name[length] <= ' ' || (uint8_t)name[length] >= 0x7F)
+        {
+            return -EBADPATH;
+        }
+
+        for (const char *c = invalid; *c; c++)
+        {
+            if (name[length] == *c)
+            {
+                return -EBADPATH;
+            }
+        }
+    }
+
+    int base_length = dot >= 0 ? dot : length;
+    int ext_length = dot >= 0 ? length - dot - 1 : 0;
+    if (base_length == 0 || base_length > sizeof(item->filename) || ext_length > sizeof(item->ext) ||
+        (dot >= 0 && ext_length == 0))
+    {
+        return -EBADPATH;
+    }
+
+    for (int i = 0; i < base_length; i++)
+    {
+        item->filename[i] = toupper(name[i]);
+    }
+
+    for (int i = 0; i < ext_length; i++)
+    {
+        item->ext[i] = toupper(name[dot + 1 + i]);
+    }
+
+    // A leading 0xE5 is stored as 0x05 so the entry does not look deleted
+    if (item->filename[0] == FAT_ENTRY_DELETED)
+    {
+        item->filename[0] = 0x05;
+    }
+    return 0;
+}
+
+struct fat_slot
+{
+    uint32_t sector;
+    uint32_t offset;
+    int found;
+};
+
+/* Directory visitor stopping at the first unused entry. */
+static int fat16_find_free_slot(struct fat_directory_item *item, uint32_t sector, uint32_t offset, void *arg)
+{
+    struct fat_slot *slot = arg;
+    slot->sector = sector;
+    slot->offset = offset;
+    slot->found = 1;
+    return FAT_WALK_STOP;
+}
+
+/*
+ * Add a zeroed cluster to the end of a full subdirectory and return the
+ * location of its first entry. The new sectors are created in the block
+ * cache without reading the disk.
+ */
+static int fat16_grow_directory(struct disk *disk, uint32_t first_cluster, struct fat_slot *slot)
+{
+    struct fat_private *private = disk->fs_private;
+    struct fat_extent_map map;
+    int res = fat16_build_extent_map(disk, first_cluster, &map);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (map.total == 0)
+    {
+        res = -EIO;
+        goto out;
+    }
+
+    struct fat_extent *extent = &map.extents[map.total - 1];
+    uint32_t last = extent->disk_cluster + extent->count - 1;
+    uint32_t cluster = 0;
+    res = fat16_find_free_cluster(disk, last + 1, 1, &cluster);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    uint32_t sector = fat16_cluster_to_sector(private, cluster);
+    for (int i = 0; i < private->header.primary_header.sectors_per_cluster; i++)
+    {
+        struct bcache_block *block = 0;
+        res = bcache_get_new(disk, sector + i, &block);
+        if (res < 0)
+        {
+            goto out;
+        }
+
+        memset(block->data, 0, disk->sector_size);
+        bcache_mark_dirty(block);
+        bcache_put(block);
+    }
+
+    res = fat16_set_fat_entry(disk, cluster, private->entry_mask);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    res = fat16_set_fat_entry(disk, last, cluster);
+    if (res < 0)
+    {
+        fat16_set_fat_entry(disk, cluster, VANA_FAT16_UNUSED);
+        goto out;
+    }
+    private->next_free_hint = cluster + 1;
+
+    slot->sector = sector;
+    slot->offset = 0;
+    slot->found = 1;
+
+out:
+    fat16_extent_map_free(&map);
+    return res;
+}
+
+/*
+ * Filesystem create callback. Stores an empty file entry in the first
+ * unused slot of the directory, growing a subdirectory by a cluster when
+ * it is full; the fixed size FAT16 root directory cannot grow while a
+ * FAT32 root directory grows like any other. The change is
+ * written back before returning.
+ */
+int fat16_create(struct disk *disk, void *dir_private, const char *name, void **entry_private_out)
+{
+    int res = 0;
+    struct fat_directory_item *dir_item = 0;
+    if (!disk->write)
+    {
+        return -ERDONLY;
+    }
+
+    if (dir_private)
+    {
+        struct fat_entry *dir_entry = dir_private;
+        if (!(dir_entry->item.attribute & FAT_FILE_SUBDIRECTORY))
+        {
+            return -ENOENT;
+        }
+        dir_item = &dir_entry->item;
+    }
+
+    uint32_t cluster = fat16_directory_cluster(disk->fs_private, dir_item);
+
+    struct fat_entry *entry = kzalloc(sizeof(struct fat_entry));
+    if (!entry)
+    {
+        return -ENOMEM;
+    }
+
+    res = fat16_make_short_name(name, &entry->item);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    struct fat_slot slot = {0};
+    res = fat16_walk_directory(disk, cluster, FAT_WALK_FREE_SLOTS, fat16_find_free_slot, &slot);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    if (!slot.found)
+    {
+        if (cluster == 0)
+        {
+            res = -ENOSPC;
+            goto out;
+        }
+
+        res = fat16_grow_directory(disk, cluster, &slot);
+        if (res < 0)
+        {
+            goto out;
+        }
+    }
+
+    entry->item.attribute = FAT_FILE_ARCHIVED;
+    entry->sector = slot.sector;
+    entry->offset = slot.offset;
+    res = fat16_write_entry(disk, entry);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    res = fat16_sync(disk);
+
+out:
+    if (res < 0)
+    {
+        kfree(entry);
+        return res;
+    }
+
+    *entry_private_out = entry;
+    return 0;
+}
+
+/*
+ * Filesystem unlink callback. Frees the file's clusters and marks its
+ * directory entry deleted. Directories are not removed.
+ */
+int fat16_unlink(struct disk *disk, void *entry_private)
+{
+    struct fat_entry *entry = entry_private;
+    if (!entry || (entry->item.attribute & FAT_FILE_SUBDIRECTORY))
+    {
+        return -EINVARG;
+    }
+
+    if ((entry->item.attribute & FAT_FILE_READ_ONLY) || !disk->write)
+    {
+        return -ERDONLY;
+    }
+
+    int res = fat16_shrink_chain(disk, entry, 0, 0);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    entry->item.filename[0] = FAT_ENTRY_DELETED;
+    res = fat16_write_entry(disk, entry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return fat16_sync(disk);
+}
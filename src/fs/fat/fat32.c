@@ -0,0 +1,239 @@
+/*
+ * FAT32 filesystem implementation.
+ *
+ * FAT32 differs from FAT16 in its boot sector, in its 28-bit FAT entries
+ * and in storing the root directory as an ordinary cluster chain. Directory
+ * walks, extent maps, reads, writes and allocation are the shared code in
+ * fat16.c; this file checks the FAT32 boot sector, fills in the fields of
+ * struct fat_private that select FAT32 behaviour and keeps the FSInfo
+ * sector up to date.
+ *
+ * A FAT32 table can run to megabytes, so the shared code reads it on
+ * demand instead of at mount and does not build a free cluster bitmap.
+ * The FSInfo sector supplies the free cluster count and the cluster the
+ * last allocation stopped at, so mounting reads neither the FAT nor
+ * anything but the boot and FSInfo sectors, and the first allocation
+ * starts where free space is expected instead of at cluster 2. Both values
+ * are written back on every sync.
+ */
+#include "fat32.h"
+#include "fat.h"
+#include "config.h"
+#include "string/string.h"
+#include "disk/disk.h"
+#include "disk/streamer.h"
+#include "disk/bcache.h"
+#include "memory/heap/kheap.h"
+#include "status.h"
+#include <stdint.h>
+
+// Extended boot signature, 0x28 on volumes without the label fields
+#define VANA_FAT32_SIGNATURE 0x29
+#define VANA_FAT32_SIGNATURE_SHORT 0x28
+
+// Only the FAT selected by the low bits is current when this flag is set
+#define VANA_FAT32_FLAG_NO_MIRROR 0x80
+#define VANA_FAT32_ACTIVE_FAT_MASK 0x0F
+
+#define VANA_FAT32_FSINFO_LEAD_SIGNATURE 0x41615252
+#define VANA_FAT32_FSINFO_STRUCT_SIGNATURE 0x61417272
+#define VANA_FAT32_FSINFO_TRAIL_SIGNATURE 0xAA550000
+// Value of an FSInfo field that was never computed
+#define VANA_FAT32_FSINFO_UNKNOWN 0xFFFFFFFF
+
+struct fat32_fsinfo
+{
+    uint32_t lead_signature;
+    uint8_t reserved[480];
+    uint32_t struct_signature;
+    uint32_t free_count;
+    uint32_t next_free;
+    uint8_t reserved2[12];
+    uint32_t trail_signature;
+} __attribute__((packed));
+
+int fat32_resolve(struct disk *disk);
+
+struct filesystem fat32_fs =
+    {
+        .resolve = fat32_resolve,
+        .lookup = fat16_lookup,
+        .release = fat16_release,
+        .open = fat16_open,
+        .free_inode = fat16_free_inode,
+        .readpage = fat16_readpage,
+        .read = fat16_read,
+        .pread = fat16_pread,
+        .seek = fat16_seek,
+        .stat = fat16_stat,
+        .close = fat16_close,
+        .readdir = fat16_readdir,
+        .write = fat16_write,
+        .pwrite = fat16_pwrite,
+        .truncate = fat16_truncate,
+        .create = fat16_create,
+        .unlink = fat16_unlink,
+        // 8.3 names are stored in upper case and matched case-insensitively
+        .case_insensitive = 1
+    };
+
+struct filesystem *fat32_init()
+{
+    strcpy(fat32_fs.name, "FAT32");
+    return &fat32_fs;
+}
+
+/* Non-zero if the sector holds an FSInfo structure. */
+static int fat32_fsinfo_valid(struct fat32_fsinfo *fsinfo)
+{
+    return fsinfo->lead_signature == VANA_FAT32_FSINFO_LEAD_SIGNATURE &&
+           fsinfo->struct_signature == VANA_FAT32_FSINFO_STRUCT_SIGNATURE &&
+           fsinfo->trail_signature == VANA_FAT32_FSINFO_TRAIL_SIGNATURE;
+}
+
+/*
+ * Take the free cluster count and the next free hint from the FSInfo
+ * sector. Values that are unset or out of range are ignored: a missing
+ * hint starts the search at cluster 2 and a missing count is recomputed by
+ * fat_count_free_clusters(), the only case in which mounting reads the
+ * whole FAT.
+ */
+static int fat32_read_fsinfo(struct disk *disk, struct fat_private *private, uint32_t fsinfo_sector)
+{
+    uint32_t free_clusters = VANA_FAT32_FSINFO_UNKNOWN;
+    uint32_t next_free = VANA_FAT32_FSINFO_UNKNOWN;
+
+    // Sector 0 is the boot sector, so zero means the volume has no FSInfo
+    if (fsinfo_sector != 0 && fsinfo_sector < private->header.primary_header.reserved_sectors)
+    {
+        struct bcache_block *block = 0;
+        int res = bcache_get(disk, fsinfo_sector, &block);
+        if (res < 0)
+        {
+            return res;
+        }
+
+        struct fat32_fsinfo *fsinfo = (struct fat32_fsinfo *)block->data;
+        if (fat32_fsinfo_valid(fsinfo))
+        {
+            private->fsinfo_sector = fsinfo_sector;
+            free_clusters = fsinfo->free_count;
+            next_free = fsinfo->next_free;
+        }
+        bcache_put(block);
+    }
+
+    uint32_t last_cluster = private->total_clusters + 1;
+    private->next_free_hint = next_free >= 2 && next_free <= last_cluster ? next_free : 2;
+    if (free_clusters <= private->total_clusters)
+    {
+        private->free_clusters = free_clusters;
+        return 0;
+    }
+
+    return fat_count_free_clusters(disk);
+}
+
+/*
+ * Store the current free cluster count and next free hint in the FSInfo
+ * sector through the block cache. Called by fat16_sync() for volumes that
+ * have one; the sector is written back with the rest of the metadata.
+ */
+int fat32_update_fsinfo(struct disk *disk)
+{
+    struct fat_private *private = disk->fs_private;
+    struct bcache_block *block = 0;
+    int res = bcache_get(disk, private->fsinfo_sector, &block);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct fat32_fsinfo *fsinfo = (struct fat32_fsinfo *)block->data;
+    fsinfo->free_count = private->free_clusters;
+    fsinfo->next_free = private->next_free_hint;
+    bcache_mark_dirty(block);
+    bcache_put(block);
+    return 0;
+}
+
+/*
+ * Verify the disk contains a FAT32 filesystem and mount it. The boot
+ * sector is checked and the shared state set up by fat_mount(), which
+ * leaves the FAT itself on disk until it is first used. The free cluster
+ * count and allocation hint come from the FSInfo sector.
+ */
+int fat32_resolve(struct disk *disk)
+{
+    int res = 0;
+    struct fat_private *fat_private = kzalloc(sizeof(struct fat_private));
+    if (!fat_private)
+    {
+        return -ENOMEM;
+    }
+
+    disk->fs_private = fat_private;
+    disk->filesystem = &fat32_fs;
+
+    struct disk_stream *stream = diskstreamer_new(disk->id);
+    if (!stream)
+    {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    if (diskstreamer_read(stream, &fat_private->header, sizeof(fat_private->header)) != VANA_ALL_OK)
+    {
+        res = -EIO;
+        goto out;
+    }
+
+    // FAT32 keeps the FAT16 table size and root directory size at zero
+    struct fat_header *primary_header = &fat_private->header.primary_header;
+    struct fat32_header_extended *fat32_header = &fat_private->header.shared.fat32_header;
+    uint8_t signature = fat32_header->extended_header.signature;
+    if ((signature != VANA_FAT32_SIGNATURE && signature != VANA_FAT32_SIGNATURE_SHORT) ||
+        primary_header->sectors_per_fat != 0 || primary_header->root_dir_entries != 0 ||
+        fat32_header->version != 0)
+    {
+        res = -EFSNOTUS;
+        goto out;
+    }
+
+    // Every FAT copy is read and written as a mirror of the first, which
+    // would be wrong for a volume running from another copy
+    if ((fat32_header->flags & VANA_FAT32_FLAG_NO_MIRROR) && (fat32_header->flags & VANA_FAT32_ACTIVE_FAT_MASK))
+    {
+        res = -EFSNOTUS;
+        goto out;
+    }
+
+    fat_private->type = FAT_TYPE_32;
+    fat_private->sectors_per_fat = fat32_header->sectors_per_fat;
+    fat_private->root_cluster = fat32_header->root_cluster;
+    res = fat_mount(disk, fat_private);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    if (fat_private->root_cluster < 2 || fat_private->root_cluster > fat_private->total_clusters + 1)
+    {
+        res = -EFSNOTUS;
+        goto out;
+    }
+
+    res = fat32_read_fsinfo(disk, fat_private, fat32_header->fsinfo_sector);
+
+out:
+    if (stream)
+    {
+        diskstreamer_close(stream);
+    }
+
+    if (res < 0)
+    {
+        fat_free_private(disk);
+    }
+    return res;
+}
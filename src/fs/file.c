@@ -1,18 +1,36 @@
 /*
  * Generic file API implementation.
  *
- * The kernel maintains two global tables:
- *  - ``filesystems`` stores pointers to registered ``struct filesystem``
- *    objects. Drivers call ``fs_insert_filesystem()`` during
- *    initialization so that the VFS layer can delegate path operations to
- *    them.
- *  - ``file_descriptors`` tracks open files. ``fopen()`` allocates a new
- *    entry when a path is successfully resolved and uses the index as the
- *    public file descriptor returned to callers.
+ * ``filesystems`` stores pointers to registered ``struct filesystem``
+ * objects. Drivers call ``fs_insert_filesystem()`` during initialization so
+ * that the VFS layer can delegate path operations to them.
  *
- * Only a FAT16 driver is currently provided and the implementation assumes
- * 512 byte sectors and classic 8.3 filenames.  Long filename extensions and
- * other FAT variants (such as FAT32) are not supported.
+ * Open files are ``struct file_descriptor`` objects allocated from a slab
+ * cache. The numbers handed out by ``fopen()`` index the ``file_table`` of
+ * the current process, or the kernel's own table when no process is
+ * running, so each process numbers its files from 1 independently of every
+ * other. A table keeps a bitmap of the numbers in use and ``fopen()`` takes
+ * the lowest free one with a find-first-zero over a few words instead of
+ * scanning the descriptors. Kernel code that keeps a file open on behalf of
+ * a process, such as a mapping, holds the descriptor itself through
+ * ``file_open()`` and takes no number in any table.
+ *
+ * Paths are resolved one component at a time through the dentry cache
+ * (dcache.c), so repeated opens of the same path are served from memory and
+ * only cache misses reach the filesystem's ``lookup`` callback. A walk starts
+ * at the root of the path's drive in the mount table (mount.c) and crosses
+ * into any mount covering an entry on the way. All descriptors open on the
+ * same file share its inode (inode.c), which caches fstat() results and
+ * holds the filesystem's per-file state.
+ *
+ * Descriptors opened for reading on disk-backed volumes read through the
+ * page cache (pcache.c), so the data of a file is read from the device once
+ * and shared with every later reader and process mapping. Writes and
+ * truncates go to the filesystem and then refresh the file's cached pages.
+ *
+ * FAT16 and FAT32 drivers are provided and the implementation assumes 512
+ * byte sectors and classic 8.3 filenames.  Long filename extensions are not
+ * supported. A tmpfs driver (tmpfs/tmpfs.c) serves RAM-only volumes.
  */
 #include "file.h"
 #include "config.h"
@@ -21,15 +39,26 @@
 #include "string/string.h"
 #include "disk/disk.h"
 #include "fat/fat16.h"
+#include "fat/fat32.h"
+#include "tmpfs/tmpfs.h"
+#include "dcache.h"
+#include "mount.h"
+#include "inode.h"
+#include "pcache.h"
 #include "status.h"
 #include "kernel.h"
+#include "memory/heap/slab.h"
+#include "task/task.h"
+#include "task/process.h"
 
 // Registered filesystems. A NULL entry means the slot is free.
 struct filesystem* filesystems[VANA_MAX_FILESYSTEMS];
 
-// Active file descriptors indexed by ``fd-1``. Descriptor 0 is unused so that
-// a valid descriptor is always non-zero from the caller's perspective.
-struct file_descriptor* file_descriptors[VANA_MAX_FILE_DESCRIPTORS];
+// Open file objects, shared by every descriptor table
+static struct slab_cache file_descriptor_cache;
+
+// Descriptor numbers used by the kernel outside of any process
+static struct file_table kernel_files;
 
 // Locate a free entry in the filesystem table
 static struct filesystem** fs_get_free_filesystem()
@@ -66,12 +95,16 @@ void fs_insert_filesystem(struct filesystem* filesystem)
 /*
  * Insert any filesystem drivers that are compiled directly into the kernel.
  *
- * At present this function registers only the FAT16 driver which means all
- * path operations ultimately resolve to a FAT16 formatted disk.
+ * The FAT16 and FAT32 drivers are registered, so path operations resolve
+ * to a disk formatted with either. Each refuses the other's volumes. tmpfs
+ * comes first so device-less tmpfs volumes are claimed before the FAT
+ * drivers try to read a boot sector from them.
  */
 static void fs_static_load()
 {
+    fs_insert_filesystem(tmpfs_init());
     fs_insert_filesystem(fat16_init());
+    fs_insert_filesystem(fat32_init());
 }
 
 /*
@@ -86,52 +119,90 @@ static void fs_load()
 /*
  * Initialise the filesystem layer.
  *
- * Clears the descriptor table and registers any built-in filesystem drivers.
- * This must be called once during kernel startup before any file operations.
+ * Clears the kernel's descriptor table and registers any built-in
+ * filesystem drivers. This must be called once during kernel startup before
+ * any file operations.
  */
 void fs_init()
 {
-    memset(file_descriptors, 0, sizeof(file_descriptors));
+    memset(&kernel_files, 0, sizeof(kernel_files));
+    slab_init(&file_descriptor_cache, sizeof(struct file_descriptor));
+    if (dcache_init() < 0)
+    {
+        panic("Failed to allocate the dentry cache\n");
+    }
+    if (pcache_init() < 0)
+    {
+        panic("Failed to allocate the page cache\n");
+    }
     fs_load();
 }
 
-// Free a file descriptor that was previously allocated
+// Release the VFS state of a descriptor whose filesystem side is closed
 static void file_free_descriptor(struct file_descriptor* desc)
 {
-    file_descriptors[desc->index-1] = 0;
-    kfree(desc);
+    inode_put(desc->inode);
+    dcache_put(desc->dentry);
+    slab_free(&file_descriptor_cache, desc);
+}
+
+// The descriptor table fopen() and friends use for the running code
+static struct file_table* file_table_current()
+{
+    struct task* task = task_current();
+    if (task && task->process)
+    {
+        return &task->process->files;
+    }
+
+    return &kernel_files;
 }
 
-// Allocate a new file descriptor structure for an opened file
-static int file_new_descriptor(struct file_descriptor** desc_out)
+/*
+ * Reserve the lowest free descriptor number of a table.
+ *
+ * @return The number, or -ENOMEM if every number is in use.
+ */
+static int file_table_reserve(struct file_table* table)
 {
-    int res = -ENOMEM;
-    for (int i = 0; i < VANA_MAX_FILE_DESCRIPTORS; i++)
+    for (int i = 0; i < FILE_TABLE_WORDS; i++)
     {
-        if (file_descriptors[i] == 0)
+        uint32_t free = ~table->used[i];
+        if (free)
         {
-            struct file_descriptor* desc = kzalloc(sizeof(struct file_descriptor));
-            desc->index = i + 1; // descriptors start at 1
-            file_descriptors[i] = desc;
-            *desc_out = desc;
-            res = 0;
-            break;
+            int bit = __builtin_ctz(free);
+            table->used[i] |= 1u << bit;
+            return i * 32 + bit + 1; // descriptors start at 1
         }
     }
 
-    return res;
+    return -ENOMEM;
+}
+
+// Return a descriptor number to its table
+static void file_table_release(struct file_table* table, int fd)
+{
+    int index = fd - 1;
+    table->descriptors[index] = 0;
+    table->used[index / 32] &= ~(1u << (index % 32));
 }
 
-// Resolve a descriptor index to its file_descriptor structure
+// Resolve a descriptor number of the current table to its open file
 static struct file_descriptor* file_get_descriptor(int fd)
 {
-    if (fd <= 0 || fd >= VANA_MAX_FILE_DESCRIPTORS)
+    if (fd <= 0 || fd > VANA_MAX_FILE_DESCRIPTORS)
     {
         return 0;
     }
 
     int index = fd - 1; // descriptors start at 1
-    return file_descriptors[index];
+    struct file_table* table = file_table_current();
+    if (!(table->used[index / 32] & (1u << (index % 32))))
+    {
+        return 0;
+    }
+
+    return table->descriptors[index];
 }
 
 /*
@@ -174,80 +245,189 @@ static FILE_MODE file_get_mode_by_string(const char* str)
     return mode;
 }
 
+/* Step from an entry to the root of whatever is mounted on it, if anything. */
+static struct dentry* file_follow_mounts(struct dentry* dentry)
+{
+    while (dentry->mounted)
+    {
+        struct dentry* root = dentry->mounted;
+        dcache_get(root);
+        dcache_put(dentry);
+        dentry = root;
+    }
+
+    return dentry;
+}
+
+/*
+ * Walk a parsed path component by component from the root of its drive
+ * and return a referenced dentry for its final component, which may be
+ * negative. Every earlier component has to exist. The walk crosses into
+ * mounts covering any entry on the way, and covering the final entry too
+ * if `follow_final` is set.
+ *
+ * @return Zero on success, -EIO if nothing is mounted at the drive,
+ *         -ENOENT if a directory on the way does not exist, or another
+ *         negative status code.
+ */
+static int file_lookup_final(struct path_root* root_path, int follow_final, struct dentry** dentry_out)
+{
+    struct dentry* current = mount_root(root_path->drive_no);
+    if (!current)
+    {
+        return -EIO;
+    }
+
+    current = file_follow_mounts(current);
+    for (int i = 0; i < root_path->count; i++)
+    {
+        if (current->negative)
+        {
+            dcache_put(current);
+            return -ENOENT;
+        }
+
+        struct dentry* next = 0;
+        int res = dcache_lookup(current, root_path->parts[i], &next);
+        dcache_put(current);
+        if (res < 0)
+        {
+            return res;
+        }
+
+        current = next;
+        if (i + 1 < root_path->count || follow_final)
+        {
+            current = file_follow_mounts(current);
+        }
+    }
+
+    *dentry_out = current;
+    return 0;
+}
+
 /*
- * Open a file by path.
+ * Resolve a parsed path to a referenced dentry. When `create` is set a
+ * missing final component is created as an empty file.
+ *
+ * @return Zero with a positive entry in `dentry_out`, -ENOENT if any
+ *         component does not exist, or another negative status code.
+ */
+static int file_lookup_path(struct path_root* root_path, int create, struct dentry** dentry_out)
+{
+    struct dentry* dentry = 0;
+    int res = file_lookup_final(root_path, 1, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (dentry->negative && create)
+    {
+        res = dcache_create(dentry);
+        if (res < 0)
+        {
+            dcache_put(dentry);
+            return res;
+        }
+    }
+
+    if (dentry->negative)
+    {
+        dcache_put(dentry);
+        return -ENOENT;
+    }
+
+    *dentry_out = dentry;
+    return 0;
+}
+
+/*
+ * Open a file by path without giving it a descriptor number, for kernel
+ * code that keeps the file itself. Close it with file_close().
  *
  * @param filename  Absolute path in the form "<drive>:/dir/file".
- * @param mode_str  Standard C style mode string ("r", "w", "a").
- * @return          A positive descriptor index on success, or 0 on error.
+ * @param mode_str  Standard C style mode string ("r", "w", "a"). The write
+ *                  modes create the file if it does not exist; "w" also
+ *                  truncates an existing file. Directories, including the
+ *                  root of a drive, can be opened with "r" for fgetdents().
+ * @return          Zero with the open file in `desc_out`, or a negative
+ *                  status code.
  */
-int fopen(const char* filename, const char* mode_str)
+int file_open(const char* filename, const char* mode_str, struct file_descriptor** desc_out)
 {
     int res = 0;
     struct disk* disk = NULL;
     FILE_MODE mode = FILE_MODE_INVALID;
     void* descriptor_private_data = NULL;
     struct file_descriptor* desc = 0;
+    struct dentry* dentry = 0;
+    struct inode* inode = 0;
+    struct path_root root_path;
 
-    struct path_root* root_path = pathparser_parse(filename, NULL);
-    if (!root_path)
+    if (pathparser_parse(filename, &root_path) < 0)
     {
         res = -EINVARG;
         goto out;
     }
 
-    if (!root_path->first)
+    // A drive's root directory can only be opened to list it
+    mode = file_get_mode_by_string(mode_str);
+    if (mode == FILE_MODE_INVALID || (root_path.count == 0 && mode != FILE_MODE_READ))
     {
         res = -EINVARG;
         goto out;
     }
 
-    disk = disk_get(root_path->drive_no);
-    if (!disk)
+    res = file_lookup_path(&root_path, mode != FILE_MODE_READ, &dentry);
+    if (res < 0)
     {
-        res = -EIO;
         goto out;
     }
 
-    if (!disk->filesystem)
+    // The entry may be on another disk than the drive's root if the path
+    // crossed a mount
+    disk = dentry->disk;
+    inode = inode_get(dentry);
+    if (!inode)
     {
-        res = -EIO;
+        res = -ENOMEM;
         goto out;
     }
 
-    mode = file_get_mode_by_string(mode_str);
-    if (mode == FILE_MODE_INVALID)
+    descriptor_private_data = disk->filesystem->open(disk, inode, mode);
+    if (ISERR(descriptor_private_data))
     {
-        res = -EINVARG;
+        res = ERROR_I(descriptor_private_data);
+        descriptor_private_data = NULL;
         goto out;
     }
 
-    descriptor_private_data = disk->filesystem->open(disk, root_path->first, mode);
-    if (ISERR(descriptor_private_data))
+    if (mode == FILE_MODE_WRITE)
     {
-        res = ERROR_I(descriptor_private_data);
-        goto out;
+        // Opening for writing truncated the file
+        inode->stat_valid = 0;
+        pcache_invalidate(inode, 0, PCACHE_TO_END);
     }
 
-    res = file_new_descriptor(&desc);
-    if (res < 0)
+    desc = slab_alloc(&file_descriptor_cache);
+    if (!desc)
     {
+        res = -ENOMEM;
         goto out;
     }
 
     desc->filesystem = disk->filesystem;
     desc->private = descriptor_private_data;
     desc->disk = disk;
-    res = desc->index;
+    desc->dentry = dentry;
+    desc->inode = inode;
+    desc->mode = mode;
+    *desc_out = desc;
 
 out:
     if (res < 0)
     {
-        if (root_path)
-        {
-            pathparser_free(root_path);
-        }
-
         if (disk && descriptor_private_data)
         {
             disk->filesystem->close(descriptor_private_data);
@@ -257,15 +437,112 @@ out:
         {
             file_free_descriptor(desc);
         }
+        else
+        {
+            inode_put(inode);
+            dcache_put(dentry);
+        }
+    }
 
-        res = 0;
+    return res;
+}
+
+/*
+ * Open a file by path and give it the lowest free descriptor number of the
+ * current process.
+ *
+ * @param filename  Absolute path in the form "<drive>:/dir/file".
+ * @param mode_str  Mode string as for file_open().
+ * @return          A positive descriptor number on success, or 0 on error.
+ */
+int fopen(const char* filename, const char* mode_str)
+{
+    struct file_table* table = file_table_current();
+    int fd = file_table_reserve(table);
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    struct file_descriptor* desc = 0;
+    if (file_open(filename, mode_str, &desc) < 0)
+    {
+        file_table_release(table, fd);
+        return 0;
+    }
+
+    table->descriptors[fd - 1] = desc;
+    return fd;
+}
+
+/*
+ * Close a file opened with file_open().
+ *
+ * @return ``VANA_ALL_OK`` on success or a negative error code, in which
+ *         case the file stays open.
+ */
+int file_close(struct file_descriptor* desc)
+{
+    int res = desc->filesystem->close(desc->private);
+    if (res == VANA_ALL_OK)
+    {
+        file_free_descriptor(desc);
     }
 
     return res;
 }
 
 /*
- * Retrieve file statistics for an open descriptor.
+ * Close every file left open in a table, for a process that is exiting.
+ * The VFS side of each file is released even if its filesystem reports an
+ * error, as nothing can refer to the descriptor afterwards.
+ */
+void file_table_close_all(struct file_table* table)
+{
+    for (int fd = 1; fd <= VANA_MAX_FILE_DESCRIPTORS; fd++)
+    {
+        struct file_descriptor* desc = table->descriptors[fd - 1];
+        if (desc)
+        {
+            desc->filesystem->close(desc->private);
+            file_free_descriptor(desc);
+        }
+        file_table_release(table, fd);
+    }
+}
+
+// Stat an open file, answering from its inode while the cached result holds
+int file_stat(struct file_descriptor* desc, struct file_stat* stat)
+{
+    struct inode* inode = desc->inode;
+    if (!inode->stat_valid)
+    {
+        int res = desc->filesystem->stat(desc->disk, desc->private, &inode->stat);
+        if (res < 0)
+        {
+            return res;
+        }
+        inode->stat_valid = 1;
+    }
+
+    *stat = inode->stat;
+    return 0;
+}
+
+/*
+ * Non-zero if reads through the descriptor are served by the page cache.
+ * Only read-only descriptors qualify, so `desc->pos` is only the driver's
+ * position mirrored for descriptors that can write. Volumes without a device, such as tmpfs,
+ * already hold their data in memory and are read through the driver.
+ */
+static int file_reads_cached(struct file_descriptor* desc)
+{
+    return desc->mode == FILE_MODE_READ && desc->filesystem->readpage && desc->disk->read;
+}
+
+/*
+ * Retrieve file statistics for an open descriptor. The result is cached in
+ * the file's inode until the file is next written or truncated.
  *
  * @param fd    Descriptor returned by ``fopen``.
  * @param stat  Output structure filled with size and flag information.
@@ -273,15 +550,13 @@ out:
  */
 int fstat(int fd, struct file_stat* stat)
 {
-    int res = 0;
     struct file_descriptor* desc = file_get_descriptor(fd);
     if (!desc)
     {
         return -EIO;
     }
 
-    res = desc->filesystem->stat(desc->disk, desc->private, stat);
-    return res;
+    return file_stat(desc, stat);
 }
 
 /*
@@ -292,22 +567,61 @@ int fstat(int fd, struct file_stat* stat)
  */
 int fclose(int fd)
 {
-    int res = 0;
     struct file_descriptor* desc = file_get_descriptor(fd);
     if (!desc)
     {
         return -EIO;
     }
 
-    res = desc->filesystem->close(desc->private);
+    int res = file_close(desc);
     if (res == VANA_ALL_OK)
     {
-        file_free_descriptor(desc);
+        file_table_release(file_table_current(), fd);
     }
 
     return res;
 }
 
+// Move the position kept in the descriptor itself
+static int file_seek_position(struct file_descriptor* desc, int offset, FILE_SEEK_MODE whence)
+{
+    int64_t base = 0;
+    switch (whence)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+
+    case SEEK_CUR:
+        base = desc->pos;
+        break;
+
+    case SEEK_END:
+    {
+        struct file_stat stat;
+        int res = file_stat(desc, &stat);
+        if (res < 0)
+        {
+            return res;
+        }
+        base = stat.filesize;
+        break;
+    }
+
+    default:
+        return -EINVARG;
+    }
+
+    int64_t pos = base + offset;
+    if (pos < 0 || pos > 0xFFFFFFFF)
+    {
+        return -EINVARG;
+    }
+
+    desc->pos = (uint32_t)pos;
+    return 0;
+}
+
 /*
  * Seek to a new position within an open file.
  *
@@ -325,8 +639,59 @@ int fseek(int fd, int offset, FILE_SEEK_MODE whence)
         return -EIO;
     }
 
+    if (file_reads_cached(desc))
+    {
+        return file_seek_position(desc, offset, whence);
+    }
+
     res = desc->filesystem->seek(desc->private, offset, whence);
-    return res;
+    if (res < 0)
+    {
+        return res;
+    }
+
+    // Keep the mirrored position in step with the driver's
+    return file_seek_position(desc, offset, whence);
+}
+
+/*
+ * Read whole objects through the page cache from the descriptor's
+ * position, with the same result as the filesystem's `read` callback.
+ */
+static int file_read_cached(struct file_descriptor* desc, void* ptr, uint32_t size, uint32_t nmemb)
+{
+    struct file_stat stat;
+    int res = file_stat(desc, &stat);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (desc->pos >= stat.filesize)
+    {
+        return 0;
+    }
+
+    uint32_t available = stat.filesize - desc->pos;
+    if (nmemb > available / size)
+    {
+        nmemb = available / size;
+    }
+
+    uint32_t total = size * nmemb;
+    if (total == 0)
+    {
+        return 0;
+    }
+
+    res = pcache_read(desc->inode, desc->pos, total, ptr);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    desc->pos += total;
+    return nmemb;
 }
 
 /*
@@ -351,6 +716,446 @@ int fread(void* ptr, uint32_t size, uint32_t nmemb, int fd)
         return -EINVARG;
     }
 
-    return desc->filesystem->read(desc->disk, desc->private, size, nmemb, (char*)ptr);
+    if (file_reads_cached(desc))
+    {
+        return file_read_cached(desc, ptr, size, nmemb);
+    }
+
+    int res = desc->filesystem->read(desc->disk, desc->private, size, nmemb, (char*)ptr);
+    if (res > 0)
+    {
+        desc->pos += (uint32_t)res * size;
+    }
+    return res;
 }
 
+/*
+ * Bring the page cache in line with a write of `total` bytes from `in` at
+ * `offset` that returned `res`. The written bytes are copied into the
+ * resident pages; after a failed write, which may have changed some of
+ * them, the pages from `offset` onwards are invalidated instead.
+ */
+static void file_update_pages(struct inode* inode, int res, uint32_t offset, uint32_t total, const void* in)
+{
+    if (res < 0)
+    {
+        pcache_invalidate(inode, offset, PCACHE_TO_END);
+        return;
+    }
+
+    pcache_write(inode, offset, total, in);
+}
+
+
+/*
+ * Write data to an open descriptor at its current position, or at the end
+ * of the file for descriptors opened in append mode.
+ *
+ * @param ptr   Buffer holding the data.
+ * @param size  Size of each object to write in bytes.
+ * @param nmemb Number of objects to write.
+ * @param fd    Descriptor obtained from ``fopen``.
+ * @return      Number of objects written or a negative error code.
+ */
+int fwrite(const void* ptr, uint32_t size, uint32_t nmemb, int fd)
+{
+    if (size == 0 || nmemb == 0 || fd < 1)
+    {
+        return -EINVARG;
+    }
+
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    if (!desc->filesystem->write)
+    {
+        return -ERDONLY;
+    }
+
+    // Appends land at the end of the file rather than at the position
+    uint32_t offset = desc->pos;
+    if (desc->mode == FILE_MODE_APPEND)
+    {
+        struct file_stat stat;
+        int res = file_stat(desc, &stat);
+        if (res < 0)
+        {
+            return res;
+        }
+        offset = stat.filesize;
+    }
+
+    desc->inode->stat_valid = 0;
+    int res = desc->filesystem->write(desc->disk, desc->private, size, nmemb, (const char*)ptr);
+    uint32_t written = res > 0 ? (uint32_t)res * size : 0;
+    file_update_pages(desc->inode, res, offset, written, ptr);
+    if (res >= 0)
+    {
+        desc->pos = offset + written;
+    }
+    return res;
+}
+
+/*
+ * Read up to `count` bytes from `offset` of an open file without moving
+ * its position, so several readers can share one descriptor. Descriptors
+ * that read through the page cache are served from it.
+ *
+ * @return The number of bytes read, fewer than `count` only at the end of
+ *         the file, or a negative error code.
+ */
+int fpread(int fd, void* ptr, uint32_t count, uint32_t offset)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    if (!file_reads_cached(desc))
+    {
+        return desc->filesystem->pread(desc->disk, desc->private, offset, count, ptr);
+    }
+
+    struct file_stat stat;
+    int res = file_stat(desc, &stat);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    if (offset >= stat.filesize)
+    {
+        return 0;
+    }
+
+    if (count > stat.filesize - offset)
+    {
+        count = stat.filesize - offset;
+    }
+
+    res = pcache_read(desc->inode, offset, count, ptr);
+    return res < 0 ? res : (int)count;
+}
+
+/*
+ * Write `count` bytes at `offset` of a file opened for writing without
+ * moving its position. Writing past the end zero fills the gap.
+ *
+ * @return `count` or a negative error code.
+ */
+int fpwrite(int fd, const void* ptr, uint32_t count, uint32_t offset)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    if (!desc->filesystem->pwrite)
+    {
+        return -ERDONLY;
+    }
+
+    desc->inode->stat_valid = 0;
+    int res = desc->filesystem->pwrite(desc->disk, desc->private, offset, count, (const char*)ptr);
+    file_update_pages(desc->inode, res, offset, res > 0 ? (uint32_t)res : 0, ptr);
+    return res;
+}
+
+// Free space left in the buffer of an fgetdents() call
+struct file_dirent_buffer
+{
+    char* out;
+    uint32_t left;
+    uint32_t filled;
+};
+
+/* FILE_DIRENT_EMIT callback packing one record into the caller's buffer. */
+static int file_dirent_emit(void* arg, const char* name, FILE_DIRENT_TYPE type, uint32_t size, uint32_t first_cluster)
+{
+    struct file_dirent_buffer* buffer = arg;
+    uint32_t name_length = strnlen(name, VANA_MAX_PATH - 1);
+    uint32_t record_length = (sizeof(struct file_dirent) + name_length + 1 + 3) & ~3;
+    if (record_length > buffer->left)
+    {
+        return -ENOSPC;
+    }
+
+    struct file_dirent* dirent = (struct file_dirent*)(buffer->out + buffer->filled);
+    dirent->record_length = record_length;
+    dirent->type = type;
+    dirent->name_length = name_length;
+    dirent->size = size;
+    dirent->first_cluster = first_cluster;
+    memcpy(dirent->name, (char*)name, name_length);
+    memset(dirent->name + name_length, 0, record_length - sizeof(struct file_dirent) - name_length);
+
+    buffer->filled += record_length;
+    buffer->left -= record_length;
+    return 0;
+}
+
+/*
+ * Fill `buffer` with as many struct file_dirent records of an open
+ * directory as fit, starting where the previous call stopped. Each record
+ * carries the entry's type and size, so listing a directory needs no
+ * further lookups. "." and ".." are not listed.
+ *
+ * @return The number of bytes filled, zero once every entry was returned,
+ *         -EINVARG if the next record does not fit in an empty buffer or
+ *         the descriptor is not a directory, or another negative status
+ *         code.
+ */
+int fgetdents(int fd, void* buffer, uint32_t size)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    if (!desc->filesystem->readdir)
+    {
+        return -EUNIMP;
+    }
+
+    struct file_dirent_buffer dirents = { .out = buffer, .left = size, .filled = 0 };
+    int res = desc->filesystem->readdir(desc->disk, desc->private, file_dirent_emit, &dirents);
+    if (res < 0)
+    {
+        return dirents.filled > 0 ? (int)dirents.filled : res;
+    }
+
+    if (dirents.filled == 0 && res > 0)
+    {
+        return -EINVARG;
+    }
+    return dirents.filled;
+}
+
+/*
+ * Read into each buffer of `iov` in turn from the position of an open
+ * file, as one fread() per buffer would. Stops early at the end of the
+ * file.
+ *
+ * @return The number of bytes read or a negative error code if nothing
+ *         could be read.
+ */
+int freadv(int fd, const struct file_iovec* iov, int iovcnt)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].length == 0)
+        {
+            continue;
+        }
+
+        // Reading single bytes returns a short count instead of nothing
+        // when the end of the file falls inside the buffer
+        int res = fread(iov[i].base, 1, iov[i].length, fd);
+        if (res < 0)
+        {
+            return total > 0 ? total : res;
+        }
+
+        total += res;
+        if ((uint32_t)res < iov[i].length)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*
+ * Write each buffer of `iov` in turn at the position of an open file, as
+ * one fwrite() per buffer would.
+ *
+ * @return The number of bytes written, fewer than requested if a buffer
+ *         was only partly written, or a negative error code if nothing
+ *         could be written.
+ */
+int fwritev(int fd, const struct file_iovec* iov, int iovcnt)
+{
+    int total = 0;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].length == 0)
+        {
+            continue;
+        }
+
+        // Single byte items make a short write return the bytes it wrote
+        int res = fwrite(iov[i].base, 1, iov[i].length, fd);
+        if (res < 0)
+        {
+            return total > 0 ? total : res;
+        }
+
+        total += res;
+        if ((uint32_t)res < iov[i].length)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/*
+ * Change the size of a file opened for writing. Growing a file fills the
+ * new bytes with zeros.
+ *
+ * @return ``VANA_ALL_OK`` on success or a negative error code.
+ */
+int ftruncate(int fd, uint32_t size)
+{
+    struct file_descriptor* desc = file_get_descriptor(fd);
+    if (!desc)
+    {
+        return -EINVARG;
+    }
+
+    if (!desc->filesystem->truncate)
+    {
+        return -ERDONLY;
+    }
+
+    // Bytes below the new size are unchanged whether or not it succeeds
+    desc->inode->stat_valid = 0;
+    int res = desc->filesystem->truncate(desc->disk, desc->private, size);
+    pcache_invalidate(desc->inode, size, PCACHE_TO_END);
+    return res;
+}
+
+/*
+ * Return a referenced page cache page holding page `index` of an open
+ * file, for mapping it into a process. Release it with pcache_put(); the
+ * file must stay open while the page is in use.
+ *
+ * @return Zero, -EUNIMP if the filesystem cannot cache files, or another
+ *         negative status code.
+ */
+int file_get_page(struct file_descriptor* desc, uint32_t index, struct pcache_page** page_out)
+{
+    struct file_stat stat;
+    int res = file_stat(desc, &stat);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    return pcache_get(desc->inode, index, page_out);
+}
+
+/*
+ * Remove a file by path. Files that are open cannot be removed.
+ *
+ * @param filename  Absolute path in the form "<drive>:/dir/file".
+ * @return          ``VANA_ALL_OK`` on success or a negative error code.
+ */
+int funlink(const char* filename)
+{
+    int res = 0;
+    struct dentry* dentry = 0;
+    struct path_root root_path;
+
+    if (pathparser_parse(filename, &root_path) < 0 || root_path.count == 0)
+    {
+        return -EINVARG;
+    }
+
+    res = file_lookup_path(&root_path, 0, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    res = dcache_unlink(dentry);
+    dcache_put(dentry);
+    return res;
+}
+
+/*
+ * Create a directory by path on filesystems that support it.
+ *
+ * @param path  Absolute path in the form "<drive>:/dir/newdir".
+ * @return      ``VANA_ALL_OK`` on success, -EISTKN if the name already
+ *              exists, -ERDONLY if the filesystem cannot create
+ *              directories, or another negative error code.
+ */
+int fmkdir(const char* path)
+{
+    int res = 0;
+    struct dentry* dentry = 0;
+    struct path_root root_path;
+
+    if (pathparser_parse(path, &root_path) < 0 || root_path.count == 0)
+    {
+        return -EINVARG;
+    }
+
+    res = file_lookup_final(&root_path, 1, &dentry);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    res = dentry->negative ? dcache_mkdir(dentry) : -EISTKN;
+    dcache_put(dentry);
+    return res;
+}
+
+/*
+ * Mount the directory `source` over `target` so paths below `target` reach
+ * the contents of `source`, for example a tmpfs directory over `0:/tmp`.
+ * `target` does not have to exist. Mounts cannot be removed.
+ *
+ * @param source  Absolute path of an existing directory, or a bare
+ *                "<drive>:/" for the root of a drive.
+ * @param target  Absolute path of the entry to cover, not a drive's root.
+ * @return        ``VANA_ALL_OK`` on success, -EISTKN if `target` is
+ *                already covered, or another negative error code.
+ */
+int fmount(const char* source, const char* target)
+{
+    int res = 0;
+    struct dentry* root = 0;
+    struct dentry* mountpoint = 0;
+    struct path_root source_path;
+    struct path_root target_path;
+
+    if (pathparser_parse(source, &source_path) < 0 || pathparser_parse(target, &target_path) < 0 ||
+        target_path.count == 0)
+    {
+        return -EINVARG;
+    }
+
+    res = file_lookup_final(&source_path, 1, &root);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    res = file_lookup_final(&target_path, 0, &mountpoint);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    res = mount_at(root, mountpoint);
+
+out:
+    if (res < 0)
+    {
+        dcache_put(root);
+        dcache_put(mountpoint);
+    }
+    return res;
+}
@@ -2,6 +2,7 @@
 #define FILE_H
 
 #include "pparser.h"
+#include "config.h"
 #include <stdint.h>
 
 typedef unsigned int FILE_SEEK_MODE;
@@ -29,10 +30,45 @@ enum
 typedef unsigned int FILE_STAT_FLAGS;
 
 struct disk;
-typedef void*(*FS_OPEN_FUNCTION)(struct disk* disk, struct path_part* path, FILE_MODE mode);
+struct dentry;
+struct inode;
+// Open the file behind `inode`, whose `fs_private` is the entry a successful
+// lookup produced. State shared by all opens of the file belongs in
+// `inode->private`.
+typedef void*(*FS_OPEN_FUNCTION)(struct disk* disk, struct inode* inode, FILE_MODE mode);
+// Free `inode->private` once no descriptor or entry uses the inode
+typedef void (*FS_FREE_INODE_FUNCTION)(struct disk* disk, struct inode* inode);
+// Fill the page-aligned `page` with PCACHE_PAGE_SIZE bytes of the file
+// behind `inode` from page number `index` on, zeroing whatever lies past the
+// end of the file
+typedef int (*FS_READPAGE_FUNCTION)(struct disk* disk, struct inode* inode, uint32_t index, char* page);
 typedef int (*FS_READ_FUNCTION)(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, char* out);
+typedef int (*FS_WRITE_FUNCTION)(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, const char* in);
+// Read up to `total` bytes from `offset` without moving the descriptor's
+// position, returning how many were read (fewer only at the end of the file)
+typedef int (*FS_PREAD_FUNCTION)(struct disk* disk, void* private, uint32_t offset, uint32_t total, char* out);
+// Write `total` bytes at `offset` without moving the descriptor's position,
+// growing the file as write does, and return `total`
+typedef int (*FS_PWRITE_FUNCTION)(struct disk* disk, void* private, uint32_t offset, uint32_t total, const char* in);
+// Set the size of an open file, freeing or zero filling the difference
+typedef int (*FS_TRUNCATE_FUNCTION)(struct disk* disk, void* private, uint32_t size);
 typedef int (*FS_RESOLVE_FUNCTION)(struct disk* disk);
 
+// Find `name` in the directory `dir_private` (NULL for the root directory).
+// Returns zero and the entry's private data, or -ENOENT if it does not exist.
+typedef int (*FS_LOOKUP_FUNCTION)(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+// Free private data returned by lookup once the dentry cache drops the entry
+typedef void (*FS_RELEASE_FUNCTION)(struct disk* disk, void* entry_private);
+// Create an empty file `name` in the directory `dir_private` and return its
+// entry private data as lookup would
+typedef int (*FS_CREATE_FUNCTION)(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+// Remove the file described by a lookup result. The private data is still
+// released through `release` afterwards.
+typedef int (*FS_UNLINK_FUNCTION)(struct disk* disk, void* entry_private);
+// Create an empty directory `name` in the directory `dir_private` and return
+// its entry private data as lookup would
+typedef int (*FS_MKDIR_FUNCTION)(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+
 typedef int (*FS_CLOSE_FUNCTION)(void* private);
 
 typedef int (*FS_SEEK_FUNCTION)(void* private, uint32_t offset, FILE_SEEK_MODE seek_mode);
@@ -45,22 +81,71 @@ struct file_stat
 
 typedef int (*FS_STAT_FUNCTION)(struct disk* disk, void* private, struct file_stat* stat);
 
+typedef unsigned int FILE_DIRENT_TYPE;
+enum
+{
+    FILE_DIRENT_FILE,
+    FILE_DIRENT_DIRECTORY
+};
+
+// One record filled in by fgetdents(). Records are packed one after the
+// other, each `record_length` bytes long and starting on a four byte
+// boundary; `name` is NUL terminated.
+struct file_dirent
+{
+    uint16_t record_length;
+    uint8_t type;
+    uint8_t name_length;
+    uint32_t size;
+    // First cluster of the entry's data, zero on filesystems without one
+    uint32_t first_cluster;
+    char name[];
+} __attribute__((packed));
+
+// Hand one directory entry to the VFS; returns a negative value once the
+// caller's buffer has no room for it
+typedef int (*FILE_DIRENT_EMIT)(void* arg, const char* name, FILE_DIRENT_TYPE type, uint32_t size, uint32_t first_cluster);
+// Pass the entries of the open directory to `emit` from the descriptor's
+// position on, stopping when it refuses one. The position moves past every
+// entry accepted. Returns zero at the end of the directory, one if `emit`
+// refused an entry, or a negative status code.
+typedef int (*FS_READDIR_FUNCTION)(struct disk* disk, void* private, FILE_DIRENT_EMIT emit, void* arg);
+
 struct filesystem
 {
     // Filesystem should return zero from resolve if the provided disk is using its filesystem
     FS_RESOLVE_FUNCTION resolve;
+    FS_LOOKUP_FUNCTION lookup;
+    FS_RELEASE_FUNCTION release;
     FS_OPEN_FUNCTION open;
     FS_READ_FUNCTION read;
+    FS_PREAD_FUNCTION pread;
     FS_SEEK_FUNCTION seek;
     FS_STAT_FUNCTION stat;
     FS_CLOSE_FUNCTION close;
+    FS_READDIR_FUNCTION readdir;
+
+    // Optional, read-only filesystems leave these NULL
+    FS_WRITE_FUNCTION write;
+    FS_PWRITE_FUNCTION pwrite;
+    FS_TRUNCATE_FUNCTION truncate;
+    FS_CREATE_FUNCTION create;
+    FS_UNLINK_FUNCTION unlink;
+    FS_MKDIR_FUNCTION mkdir;
+    FS_FREE_INODE_FUNCTION free_inode;
+    // Optional, files of filesystems without it cannot be cached or mapped
+    FS_READPAGE_FUNCTION readpage;
+
     char name[20];
+
+    // Non-zero if names match regardless of case
+    int case_insensitive;
 };
 
+// An open file. Descriptor numbers returned by fopen() index a file_table;
+// kernel code may also hold a descriptor directly through file_open().
 struct file_descriptor
 {
-    // The descriptor index
-    int index;
     struct filesystem* filesystem;
 
     // Private data for internal file descriptor
@@ -68,15 +153,63 @@ struct file_descriptor
 
     // The disk that the file descriptor should be used on
     struct disk* disk;
+
+    // Cached directory entry of the open file, referenced until close
+    struct dentry* dentry;
+
+    // In-memory inode shared with every other descriptor of the file
+    struct inode* inode;
+
+    FILE_MODE mode;
+
+    // Position of descriptors whose reads are served by the page cache,
+    // see file_reads_cached(). Other descriptors keep their position in the
+    // driver and mirror it here so a write knows which pages it changed.
+    uint32_t pos;
+};
+
+// One buffer of a vectored read or write
+struct file_iovec
+{
+    void* base;
+    uint32_t length;
+};
+
+#define FILE_TABLE_WORDS (VANA_MAX_FILE_DESCRIPTORS / 32)
+
+// Descriptor numbers of a process (or of the kernel) and the open files
+// they refer to. Number n is bit n-1 of `used` and `descriptors[n-1]`.
+struct file_table
+{
+    uint32_t used[FILE_TABLE_WORDS];
+    struct file_descriptor* descriptors[VANA_MAX_FILE_DESCRIPTORS];
 };
 
 void fs_init();
 int fopen(const char* filename, const char* mode_str);
 int fseek(int fd, int offset, FILE_SEEK_MODE whence);
 int fread(void* ptr, uint32_t size, uint32_t nmemb, int fd);
+int fwrite(const void* ptr, uint32_t size, uint32_t nmemb, int fd);
+int ftruncate(int fd, uint32_t size);
+int funlink(const char* filename);
+int fmkdir(const char* path);
+int fmount(const char* source, const char* target);
 int fstat(int fd, struct file_stat* stat);
+int fpread(int fd, void* ptr, uint32_t count, uint32_t offset);
+int fpwrite(int fd, const void* ptr, uint32_t count, uint32_t offset);
+int freadv(int fd, const struct file_iovec* iov, int iovcnt);
+int fwritev(int fd, const struct file_iovec* iov, int iovcnt);
+int fgetdents(int fd, void* buffer, uint32_t size);
 int fclose(int fd);
 
+int file_open(const char* filename, const char* mode_str, struct file_descriptor** desc_out);
+int file_close(struct file_descriptor* desc);
+int file_stat(struct file_descriptor* desc, struct file_stat* stat);
+void file_table_close_all(struct file_table* table);
+
+struct pcache_page;
+int file_get_page(struct file_descriptor* desc, uint32_t index, struct pcache_page** page_out);
+
 void fs_insert_filesystem(struct filesystem* filesystem);
 struct filesystem* fs_resolve(struct disk* disk);
 
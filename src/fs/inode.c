@@ -0,0 +1,88 @@
+/*
+ * Shared in-memory inodes.
+ *
+ * Every positive dentry that has been opened carries a `struct inode`, and
+ * every descriptor open on the file holds a reference to that same object.
+ * Filesystems hang state that is expensive to rebuild off `inode->private`,
+ * such as the FAT extent map, so a second open of a hot file reuses what
+ * the first one built. The VFS caches fstat() results in the inode as well,
+ * and the page cache (pcache.c) links the file's cached pages to it.
+ *
+ * The dentry holds one reference for as long as it names the file, so an
+ * inode outlives its descriptors while the entry stays cached. Evicting or
+ * unlinking the entry drops that reference through `inode_detach()` before
+ * the filesystem's entry private data is released.
+ */
+#include "inode.h"
+#include "dcache.h"
+#include "pcache.h"
+#include "disk/disk.h"
+#include "memory/heap/kheap.h"
+
+/*
+ * Return a referenced inode for a positive entry, creating it on first
+ * use.
+ *
+ * @return The inode, or NULL if the entry is negative or memory ran out.
+ */
+struct inode* inode_get(struct dentry* dentry)
+{
+    if (dentry->negative)
+    {
+        return 0;
+    }
+
+    if (!dentry->inode)
+    {
+        struct inode* inode = kzalloc(sizeof(struct inode));
+        if (!inode)
+        {
+            return 0;
+        }
+
+        inode->disk = dentry->disk;
+        inode->fs_private = dentry->fs_private;
+        // The entry's own reference
+        inode->refcount = 1;
+        dentry->inode = inode;
+    }
+
+    dentry->inode->refcount++;
+    return dentry->inode;
+}
+
+/*
+ * Drop a reference. The last one frees the file's cached pages and hands
+ * the inode back to its filesystem.
+ */
+void inode_put(struct inode* inode)
+{
+    if (!inode || inode->refcount <= 0)
+    {
+        return;
+    }
+
+    inode->refcount--;
+    if (inode->refcount > 0)
+    {
+        return;
+    }
+
+    pcache_drop_inode(inode);
+    struct filesystem* fs = inode->disk->filesystem;
+    if (fs && fs->free_inode)
+    {
+        fs->free_inode(inode->disk, inode);
+    }
+    kfree(inode);
+}
+
+/* Drop the reference an entry holds on its inode, if it has one. */
+void inode_detach(struct dentry* dentry)
+{
+    if (dentry->inode)
+    {
+        inode_put(dentry->inode);
+        dentry->inode = 0;
+    }
+}
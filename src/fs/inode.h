@@ -0,0 +1,42 @@
+#ifndef INODE_H
+#define INODE_H
+
+#include "file.h"
+
+struct disk;
+struct dentry;
+struct pcache_page;
+
+/*
+ * In-memory object for a file, shared by every descriptor open on it. It
+ * is created by the first open of a cached directory entry and lives while
+ * the entry stays cached or any descriptor still uses it.
+ */
+struct inode
+{
+    struct disk* disk;
+
+    // The filesystem's handle for the file, as returned by `lookup` or
+    // `create`
+    void* fs_private;
+
+    // Held by the dentry naming the file and by every open descriptor
+    int refcount;
+
+    // fstat() result, valid until the file is written or truncated
+    struct file_stat stat;
+    int stat_valid;
+
+    // Pages of the file held by the page cache (pcache.c)
+    struct pcache_page* pages;
+
+    // Filesystem state shared by all descriptors of the file, such as the
+    // FAT extent map. Freed through the filesystem's `free_inode`.
+    void* private;
+};
+
+struct inode* inode_get(struct dentry* dentry);
+void inode_put(struct inode* inode);
+void inode_detach(struct dentry* dentry);
+
+#endif
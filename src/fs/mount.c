@@ -0,0 +1,177 @@
+/*
+ * Mount table.
+ *
+ * Drive numbers in paths are not disk numbers. Every disk whose filesystem
+ * resolves is mounted by `disk_register()` at the lowest free drive number,
+ * so disks without a filesystem take none and an initrd, a data disk and a
+ * tmpfs can all be reached at once. `fopen()` and friends start their walk
+ * from `mount_root()` of the path's drive.
+ *
+ * A mount can also cover a directory entry of another mount, making
+ * `0:/tmp` show the contents of `1:/`. The covered entry is pinned in the
+ * dentry cache with its `mounted` field pointing at the root of the mount,
+ * and path walks in file.c step across whenever they reach such an entry.
+ * Covering does not need the entry to exist, so read-only volumes can have
+ * other filesystems mounted inside them.
+ *
+ * Each mount keeps its own caches: disk_register() gives every disk with a
+ * device its own block cache, and the mount holds its root entry so the top
+ * of its dentry tree is never evicted.
+ */
+#include "mount.h"
+#include "dcache.h"
+#include "config.h"
+#include "status.h"
+#include "disk/disk.h"
+#include "memory/heap/kheap.h"
+
+// Active mounts. A NULL entry means the slot is free.
+static struct mount* mounts[VANA_MAX_MOUNTS];
+
+static int mount_insert(struct mount* mount)
+{
+    for (int i = 0; i < VANA_MAX_MOUNTS; i++)
+    {
+        if (mounts[i] == 0)
+        {
+            mounts[i] = mount;
+            return 0;
+        }
+    }
+
+    return -ENOMEM;
+}
+
+static struct mount* mount_find_drive(int drive_no)
+{
+    for (int i = 0; i < VANA_MAX_MOUNTS; i++)
+    {
+        if (mounts[i] && mounts[i]->drive_no == drive_no)
+        {
+            return mounts[i];
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Mount the filesystem of `disk` at the lowest free drive number.
+ *
+ * @return The drive number, -EFSNOTUS if the disk has no filesystem or
+ *         -ENOMEM if the table or the drive numbers are exhausted.
+ */
+int mount_disk(struct disk* disk)
+{
+    if (!disk->filesystem)
+    {
+        return -EFSNOTUS;
+    }
+
+    int drive_no = 0;
+    while (drive_no < VANA_MAX_DRIVES && mount_find_drive(drive_no))
+    {
+        drive_no++;
+    }
+
+    if (drive_no == VANA_MAX_DRIVES)
+    {
+        return -ENOMEM;
+    }
+
+    struct mount* mount = kzalloc(sizeof(struct mount));
+    if (!mount)
+    {
+        return -ENOMEM;
+    }
+
+    mount->root = dcache_root(disk);
+    if (!mount->root)
+    {
+        kfree(mount);
+        return -ENOMEM;
+    }
+
+    mount->drive_no = drive_no;
+    mount->disk = disk;
+    int res = mount_insert(mount);
+    if (res < 0)
+    {
+        dcache_put(mount->root);
+        kfree(mount);
+        return res;
+    }
+
+    return drive_no;
+}
+
+/*
+ * Cover `mountpoint` with the directory `root` of another mount. Both
+ * references are taken over by the mount table on success.
+ *
+ * @return Zero on success, -EISTKN if something is already mounted there,
+ *         -EINVARG if `root` is not a directory entry that exists or
+ *         -ENOMEM.
+ */
+int mount_at(struct dentry* root, struct dentry* mountpoint)
+{
+    if (root->negative || root == mountpoint)
+    {
+        return -EINVARG;
+    }
+
+    if (mountpoint->mounted || !mountpoint->parent)
+    {
+        return -EISTKN;
+    }
+
+    struct mount* mount = kzalloc(sizeof(struct mount));
+    if (!mount)
+    {
+        return -ENOMEM;
+    }
+
+    mount->drive_no = -1;
+    mount->disk = root->disk;
+    mount->root = root;
+    mount->mountpoint = mountpoint;
+    int res = mount_insert(mount);
+    if (res < 0)
+    {
+        kfree(mount);
+        return res;
+    }
+
+    mountpoint->mounted = root;
+    return 0;
+}
+
+/*
+ * Return a referenced entry for the directory paths on drive `drive_no`
+ * start from, or NULL if nothing is mounted there.
+ */
+struct dentry* mount_root(int drive_no)
+{
+    struct mount* mount = mount_find_drive(drive_no);
+    if (!mount)
+    {
+        return 0;
+    }
+
+    dcache_get(mount->root);
+    return mount->root;
+}
+
+/* The drive number `disk` is mounted at, or -ENOENT. */
+int mount_drive_number(struct disk* disk)
+{
+    for (int i = 0; i < VANA_MAX_MOUNTS; i++)
+    {
+        if (mounts[i] && mounts[i]->disk == disk && mounts[i]->drive_no >= 0)
+        {
+            return mounts[i]->drive_no;
+        }
+    }
+
+    return -ENOENT;
+}
@@ -0,0 +1,34 @@
+#ifndef MOUNT_H
+#define MOUNT_H
+
+struct disk;
+struct dentry;
+
+/*
+ * One entry of the mount table. The disk carries the filesystem and its
+ * private mount state, so (disk, root) says which volume and which of its
+ * directories the mount shows.
+ */
+struct mount
+{
+    // Drive number used in paths such as `1:/file`, or -1 for a mount that
+    // is only reached through `mountpoint`
+    int drive_no;
+
+    struct disk* disk;
+
+    // Referenced directory entry shown by the mount: the volume's root for
+    // a drive mount or any directory of it for fmount()
+    struct dentry* root;
+
+    // Referenced entry of another mount that `root` covers, NULL for a
+    // drive mount
+    struct dentry* mountpoint;
+};
+
+int mount_disk(struct disk* disk);
+int mount_at(struct dentry* root, struct dentry* mountpoint);
+struct dentry* mount_root(int drive_no);
+int mount_drive_number(struct disk* disk);
+
+#endif
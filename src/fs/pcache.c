@@ -0,0 +1,381 @@
+/*
+ * Page cache.
+ *
+ * Holds file data in PCACHE_PAGE_SIZE pages keyed by (inode, page number),
+ * so every reader of a file shares one copy of its data. Buffered reads in
+ * file.c copy out of these pages and process mappings (see process_mmap())
+ * map them straight into the address space, so a page read once from disk
+ * serves fread(), mmap() and program loading alike. A miss is filled by the
+ * filesystem's `readpage` callback.
+ *
+ * The cache is a fixed pool of VANA_PCACHE_PAGES pages allocated once at
+ * boot. Pages are found through a hash table and are also linked into a
+ * list on their inode so all pages of a file can be visited without
+ * scanning the pool. Callers hold a reference while they use a page and a
+ * mapping holds one for as long as the page is mapped. Unreferenced pages
+ * stay cached on an LRU list and the least recently used one is recycled
+ * when the pool runs out.
+ *
+ * Pages are never dirty: writes go to the filesystem and then copy the
+ * written bytes into whichever of the file's pages are resident with
+ * pcache_write(), so every reader and mapping sees the new data without
+ * the file being read again. Changes whose data is not at hand, such as a
+ * truncate, call pcache_invalidate() for the affected range, which drops
+ * its idle pages and reads its mapped ones again in place. Bytes of a page
+ * past the end of the file are always zero. A file's pages are freed with
+ * its inode.
+ */
+#include "pcache.h"
+#include "file.h"
+#include "inode.h"
+#include "status.h"
+#include "disk/disk.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+
+static struct pcache_page* pcache_pages = 0;
+static struct pcache_page* pcache_buckets[VANA_PCACHE_BUCKETS];
+
+// Pages holding no file data, linked through hash_next
+static struct pcache_page* pcache_free = 0;
+
+// Most and least recently released unreferenced pages
+static struct pcache_page* pcache_lru_head = 0;
+static struct pcache_page* pcache_lru_tail = 0;
+
+/*
+ * Allocate the page descriptors and the page frames behind them. Called
+ * once from fs_init().
+ */
+int pcache_init()
+{
+    pcache_pages = kzalloc(sizeof(struct pcache_page) * VANA_PCACHE_PAGES);
+    if (!pcache_pages)
+    {
+        return -ENOMEM;
+    }
+
+    char* data = kzalloc(PCACHE_PAGE_SIZE * VANA_PCACHE_PAGES);
+    if (!data)
+    {
+        kfree(pcache_pages);
+        pcache_pages = 0;
+        return -ENOMEM;
+    }
+
+    memset(pcache_buckets, 0, sizeof(pcache_buckets));
+    pcache_free = 0;
+    for (int i = VANA_PCACHE_PAGES - 1; i >= 0; i--)
+    {
+        pcache_pages[i].data = data + i * PCACHE_PAGE_SIZE;
+        pcache_pages[i].hash_next = pcache_free;
+        pcache_free = &pcache_pages[i];
+    }
+
+    pcache_lru_head = 0;
+    pcache_lru_tail = 0;
+    return 0;
+}
+
+static uint32_t pcache_bucket(struct inode* inode, uint32_t index)
+{
+    return (((uint32_t)inode >> 4) ^ (index * 2654435761u)) % VANA_PCACHE_BUCKETS;
+}
+
+static void pcache_lru_remove(struct pcache_page* page)
+{
+    if (page->lru_prev)
+    {
+        page->lru_prev->lru_next = page->lru_next;
+    }
+    else if (pcache_lru_head == page)
+    {
+        pcache_lru_head = page->lru_next;
+    }
+
+    if (page->lru_next)
+    {
+        page->lru_next->lru_prev = page->lru_prev;
+    }
+    else if (pcache_lru_tail == page)
+    {
+        pcache_lru_tail = page->lru_prev;
+    }
+
+    page->lru_prev = 0;
+    page->lru_next = 0;
+}
+
+static void pcache_lru_push(struct pcache_page* page)
+{
+    page->lru_prev = 0;
+    page->lru_next = pcache_lru_head;
+    if (pcache_lru_head)
+    {
+        pcache_lru_head->lru_prev = page;
+    }
+    pcache_lru_head = page;
+    if (!pcache_lru_tail)
+    {
+        pcache_lru_tail = page;
+    }
+}
+
+static void pcache_unhash(struct pcache_page* page)
+{
+    struct pcache_page** link = &pcache_buckets[pcache_bucket(page->inode, page->index)];
+    while (*link && *link != page)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if (*link)
+    {
+        *link = page->hash_next;
+    }
+    page->hash_next = 0;
+}
+
+/*
+ * Remove an unreferenced page from the hash table, its inode and the LRU
+ * list and return it to the free list.
+ */
+static void pcache_release(struct pcache_page* page)
+{
+    pcache_lru_remove(page);
+    pcache_unhash(page);
+
+    if (page->inode_prev)
+    {
+        page->inode_prev->inode_next = page->inode_next;
+    }
+    else
+    {
+        page->inode->pages = page->inode_next;
+    }
+
+    if (page->inode_next)
+    {
+        page->inode_next->inode_prev = page->inode_prev;
+    }
+
+    page->inode = 0;
+    page->index = 0;
+    page->inode_prev = 0;
+    page->inode_next = 0;
+    page->hash_next = pcache_free;
+    pcache_free = page;
+}
+
+/* Take a free page, recycling the least recently used one if needed. */
+static struct pcache_page* pcache_alloc()
+{
+    if (!pcache_free && pcache_lru_tail)
+    {
+        pcache_release(pcache_lru_tail);
+    }
+
+    struct pcache_page* page = pcache_free;
+    if (page)
+    {
+        pcache_free = page->hash_next;
+        page->hash_next = 0;
+    }
+    return page;
+}
+
+/* Ask the filesystem for the contents of a page. */
+static int pcache_fill(struct pcache_page* page)
+{
+    struct disk* disk = page->inode->disk;
+    struct filesystem* fs = disk->filesystem;
+    if (!fs->readpage)
+    {
+        return -EUNIMP;
+    }
+
+    return fs->readpage(disk, page->inode, page->index, page->data);
+}
+
+/*
+ * Return a referenced page holding page `index` of the file behind
+ * `inode`, reading it through the filesystem's `readpage` callback if it is
+ * not cached. Pages past the end of the file read as zeros.
+ *
+ * @return Zero, -ENOMEM if every page is referenced, or the error of the
+ *         failed read.
+ */
+int pcache_get(struct inode* inode, uint32_t index, struct pcache_page** page_out)
+{
+    if (!pcache_pages)
+    {
+        return -EIO;
+    }
+
+    uint32_t bucket = pcache_bucket(inode, index);
+    for (struct pcache_page* page = pcache_buckets[bucket]; page; page = page->hash_next)
+    {
+        if (page->inode == inode && page->index == index)
+        {
+            if (page->refcount == 0)
+            {
+                pcache_lru_remove(page);
+            }
+            page->refcount++;
+            *page_out = page;
+            return 0;
+        }
+    }
+
+    struct pcache_page* page = pcache_alloc();
+    if (!page)
+    {
+        return -ENOMEM;
+    }
+
+    page->inode = inode;
+    page->index = index;
+    int res = pcache_fill(page);
+    if (res < 0)
+    {
+        page->inode = 0;
+        page->index = 0;
+        page->hash_next = pcache_free;
+        pcache_free = page;
+        return res;
+    }
+
+    page->refcount = 1;
+    page->hash_next = pcache_buckets[bucket];
+    pcache_buckets[bucket] = page;
+    page->inode_prev = 0;
+    page->inode_next = inode->pages;
+    if (inode->pages)
+    {
+        inode->pages->inode_prev = page;
+    }
+    inode->pages = page;
+
+    *page_out = page;
+    return 0;
+}
+
+/* Drop a reference taken by pcache_get(). */
+void pcache_put(struct pcache_page* page)
+{
+    if (!page || page->refcount <= 0)
+    {
+        return;
+    }
+
+    page->refcount--;
+    if (page->refcount == 0)
+    {
+        pcache_lru_push(page);
+    }
+}
+
+/*
+ * Copy `total` bytes of a file starting at `offset` out of the cache,
+ * filling missing pages on the way. The caller limits the span to the size
+ * of the file.
+ *
+ * @return Zero or a negative status code.
+ */
+int pcache_read(struct inode* inode, uint32_t offset, uint32_t total, char* out)
+{
+    while (total > 0)
+    {
+        struct pcache_page* page = 0;
+        int res = pcache_get(inode, offset / PCACHE_PAGE_SIZE, &page);
+        if (res < 0)
+        {
+            return res;
+        }
+
+        uint32_t offset_in_page = offset % PCACHE_PAGE_SIZE;
+        uint32_t chunk = PCACHE_PAGE_SIZE - offset_in_page;
+        if (chunk > total)
+        {
+            chunk = total;
+        }
+
+        memcpy(out, page->data + offset_in_page, chunk);
+        pcache_put(page);
+
+        offset += chunk;
+        out += chunk;
+        total -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Copy `total` bytes just written at `offset` of a file into those of its
+ * pages that are cached. Pages that are not resident are left to be read
+ * on demand.
+ */
+void pcache_write(struct inode* inode, uint32_t offset, uint32_t total, const char* in)
+{
+    uint64_t end = (uint64_t)offset + total;
+    for (struct pcache_page* page = inode->pages; page; page = page->inode_next)
+    {
+        uint64_t page_start = (uint64_t)page->index * PCACHE_PAGE_SIZE;
+        uint64_t start = offset > page_start ? offset : page_start;
+        uint64_t stop = end < page_start + PCACHE_PAGE_SIZE ? end : page_start + PCACHE_PAGE_SIZE;
+        if (start < stop)
+        {
+            memcpy(page->data + (start - page_start), (char*)in + (start - offset), stop - start);
+        }
+    }
+}
+
+/*
+ * Bring the cached pages overlapping `length` bytes from `offset` of a file
+ * in line with the filesystem after that range changed, PCACHE_TO_END
+ * reaching the end of the file. Idle pages are dropped; pages still mapped
+ * somewhere are read again in place, or zeroed if that fails, so their
+ * mappings stay valid.
+ */
+void pcache_invalidate(struct inode* inode, uint32_t offset, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    uint32_t first = offset / PCACHE_PAGE_SIZE;
+    uint32_t last = (uint32_t)(((uint64_t)offset + length - 1) / PCACHE_PAGE_SIZE);
+    struct pcache_page* page = inode->pages;
+    while (page)
+    {
+        struct pcache_page* next = page->inode_next;
+        if (page->index >= first && page->index <= last)
+        {
+            if (page->refcount == 0)
+            {
+                pcache_release(page);
+            }
+            else if (pcache_fill(page) < 0)
+            {
+                memset(page->data, 0, PCACHE_PAGE_SIZE);
+            }
+        }
+        page = next;
+    }
+}
+
+/*
+ * Free every page of an inode that is going away. Mappings hold a
+ * reference on the inode, so none of its pages can still be in use.
+ */
+void pcache_drop_inode(struct inode* inode)
+{
+    while (inode->pages)
+    {
+        struct pcache_page* page = inode->pages;
+        page->refcount = 0;
+        pcache_release(page);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef PCACHE_H
+#define PCACHE_H
+
+#include <stdint.h>
+#include "config.h"
+
+struct inode;
+
+#define PCACHE_PAGE_SIZE 4096
+// Length passed to pcache_invalidate() to reach the end of the file
+#define PCACHE_TO_END 0xFFFFFFFF
+
+// One cached page of a file
+struct pcache_page
+{
+    struct inode* inode;
+    // Page number within the file, the page holds bytes
+    // index * PCACHE_PAGE_SIZE up to the next page
+    uint32_t index;
+
+    // Page aligned, so it can be mapped into a process as it is
+    char* data;
+
+    // Readers and process mappings using the page; referenced pages are
+    // never evicted
+    int refcount;
+
+    struct pcache_page* hash_next;
+
+    // Other cached pages of the same inode, see inode->pages
+    struct pcache_page* inode_prev;
+    struct pcache_page* inode_next;
+
+    // Unreferenced pages are kept on the LRU list until recycled
+    struct pcache_page* lru_prev;
+    struct pcache_page* lru_next;
+};
+
+int pcache_init();
+int pcache_get(struct inode* inode, uint32_t index, struct pcache_page** page_out);
+void pcache_put(struct pcache_page* page);
+int pcache_read(struct inode* inode, uint32_t offset, uint32_t total, char* out);
+void pcache_write(struct inode* inode, uint32_t offset, uint32_t total, const char* in);
+void pcache_invalidate(struct inode* inode, uint32_t offset, uint32_t length);
+void pcache_drop_inode(struct inode* inode);
+
+#endif
@@ -1,21 +1,27 @@
 /*
- * Very small path parser used by the FAT16 driver.
+ * Very small path parser used by the VFS.
  *
  * Paths must be absolute and follow the ``<drive>:/dir/file`` pattern.
- * ``pathparser_parse()`` breaks the string into a ``struct path_root`` which
- * contains the drive number and a linked list of ``path_part`` components. The
- * filesystem then iterates over this list to walk directories one part at a
+ * ``pathparser_parse()`` copies everything after the drive into the
+ * caller's ``struct path_root`` once and splits the copy in place,
+ * replacing each slash with a terminator and recording where every
+ * component starts. Parsing a path therefore allocates nothing, whatever
+ * its depth, and the VFS walks the resulting array one component at a
  * time.
  *
- * Only digits 0-9 are accepted for the drive number and no handling for ".."
- * or redundant slashes is provided.  This matches the current FAT16
- * implementation which assumes a single drive and simple 8.3 style names.
+ * Paths are normalized while they are split: empty components from
+ * repeated or trailing slashes and "." are dropped and ".." removes the
+ * component before it, or nothing at the root of the drive. Callers, and
+ * the dentry cache behind them, only ever see canonical names. ".." is
+ * resolved by name, so it leads back to the directory the path came
+ * through even when that directory has something mounted on it.
+ *
+ * Only digits 0-9 are accepted for the drive number.
  */
 #include "pparser.h"
 #include "config.h"
 #include "kernel.h"
 #include "string/string.h"
-#include "memory/heap/kheap.h"
 #include "memory/memory.h"
 #include "status.h"
 
@@ -49,172 +55,72 @@ static int pathparser_get_drive_by_path(const char** path)
 }
 
 /*
- * Allocate the root of the parsed path for the given drive.
- * Returns NULL on allocation failure.
- */
-static struct path_root* pathparser_create_root(int drive_number)
-{
-    struct path_root* path_r = kzalloc(sizeof(struct path_root));
-    if (!path_r)
-    {
-        return NULL;
-    }
-
-    path_r->drive_no = drive_number;
-    path_r->first = 0;
-    return path_r;
-}
-
-/*
- * Reads the next component of the path into a newly allocated string.
- * The input pointer is advanced past the component and any trailing slash.
- * Returns NULL if allocation fails or no more components exist.
+ * Record the component starting at `part`, already terminated in the
+ * buffer, applying "." and "..".
  */
-static const char* pathparser_get_path_part(const char** path)
+static void pathparser_add_part(struct path_root* root, const char* part)
 {
-    char* result_path_part = kzalloc(VANA_MAX_PATH);
-    if (!result_path_part)
-    {
-        return NULL;
-    }
-
-    int i = 0;
-    while (**path != '/' && **path != 0x00)
-    {
-        result_path_part[i] = **path;
-        *path += 1;
-        i++;
-    }
-
-    if (**path == '/')
-    {
-        *path += 1; // skip '/'
-    }
-
-    if (i == 0)
-    {
-        kfree(result_path_part);
-        result_path_part = 0;
-    }
-
-    return result_path_part;
-}
-
-/*
- * Creates a new path_part structure for the next component.
- * Links it after last_part if supplied and advances the path pointer.
- * Returns NULL on memory errors or if there are no more parts.
- */
-struct path_part* pathparser_parse_path_part(struct path_part* last_part, const char** path)
-{
-    const char* path_part_str = pathparser_get_path_part(path);
-    if (!path_part_str)
-    {
-        return 0;
-    }
-
-    struct path_part* part = kzalloc(sizeof(struct path_part));
-    if (!part)
+    if (part[0] == 0 || strncmp(part, ".", 2) == 0)
     {
-        kfree((void*)path_part_str);
-        return 0;
+        return;
     }
 
-    part->part = path_part_str;
-    part->next = 0;
-
-    if (last_part)
-    {
-        last_part->next = part;
-    }
-
-    return part;
-}
-
-/*
- * Free a parsed path structure returned by ``pathparser_parse``.
- *
- * @param root  The root of the path list to free. Passing NULL is safe.
- */
-void pathparser_free(struct path_root* root)
-{
-    struct path_part* part = root->first;
-    while (part)
+    if (strncmp(part, "..", 3) == 0)
     {
-        struct path_part* next_part = part->next;
-        kfree((void*)part->part);
-        kfree(part);
-        part = next_part;
+        if (root->count > 0)
+        {
+            root->count--;
+        }
+        return;
     }
 
-    kfree(root);
+    root->parts[root->count++] = part;
 }
 
 /*
  * Parse an absolute path into its components.
  *
- * @param path                   NUL terminated path string ``<drive>:/...``.
- * @param current_directory_path Unused placeholder for future relative paths.
- * @return                       Newly allocated ``struct path_root`` or NULL on
- *                               failure. Use ``pathparser_free`` when done.
+ * @param path  NUL terminated path string ``<drive>:/...``.
+ * @param root  Filled with the drive number and the normalized components,
+ *              which point into `root` itself.
+ * @return      Zero on success or -EBADPATH if the path is too long or not
+ *              of the ``<drive>:/`` form.
  */
-struct path_root* pathparser_parse(const char* path, const char* current_directory_path)
+int pathparser_parse(const char* path, struct path_root* root)
 {
-    (void)current_directory_path;
-    int res = 0;
-    const char* tmp_path = path;
-    struct path_root* path_root = NULL;
-    struct path_part* first_part = NULL;
-    struct path_part* part = NULL;
-
-    if (strlen(path) > VANA_MAX_PATH)
+    if (strnlen(path, VANA_MAX_PATH + 1) > VANA_MAX_PATH)
     {
-        res = -1;
-        goto out;
+        return -EBADPATH;
     }
 
-    res = pathparser_get_drive_by_path(&tmp_path);
+    int res = pathparser_get_drive_by_path(&path);
     if (res < 0)
     {
-        res = -1;
-        goto out;
+        return res;
     }
 
-    path_root = pathparser_create_root(res);
-    if (!path_root)
-    {
-        res = -1;
-        goto out;
-    }
+    root->drive_no = res;
+    root->count = 0;
 
-    first_part = pathparser_parse_path_part(NULL, &tmp_path);
-    if (!first_part)
-    {
-        res = -1;
-        goto out;
-    }
+    // The drive prefix is gone, so the rest of the path and its terminator
+    // fit the buffer
+    strcpy(root->buffer, path);
 
-    path_root->first = first_part;
-    part = pathparser_parse_path_part(first_part, &tmp_path);
-    while (part)
+    char* part = root->buffer;
+    for (char* c = root->buffer; ; c++)
     {
-        part = pathparser_parse_path_part(part, &tmp_path);
-    }
-
-out:
-    if (res < 0)
-    {
-        if (path_root)
+        if (*c == '/' || *c == 0)
         {
-            kfree(path_root);
-            path_root = NULL;
-        }
-        if (first_part)
-        {
-            kfree(first_part);
+            int last = *c == 0;
+            *c = 0;
+            pathparser_add_part(root, part);
+            if (last)
+            {
+                break;
+            }
+            part = c + 1;
         }
     }
 
-    return path_root;
+    return 0;
 }
-
@@ -1,19 +1,25 @@
 #ifndef PATHPARSER_H
 #define PATHPARSER_H
 
+#include "config.h"
+
+// Most components a path can have, as each takes a character and a slash
+#define PATH_MAX_PARTS (VANA_MAX_PATH / 2)
+
+// A parsed path. Small enough to live on the stack of its user; the
+// components point into `buffer`, so a parsed path needs no freeing.
 struct path_root
 {
     int drive_no;
-    struct path_part* first;
-};
 
-struct path_part
-{
-    const char* part;
-    struct path_part* next;
+    // Components from the root of the drive down, with "." and ".."
+    // already resolved. Zero components name the root itself.
+    int count;
+    const char* parts[PATH_MAX_PARTS];
+
+    char buffer[VANA_MAX_PATH];
 };
 
-struct path_root* pathparser_parse(const char* path, const char* current_directory_path);
-void pathparser_free(struct path_root* root);
+int pathparser_parse(const char* path, struct path_root* root);
 
 #endif
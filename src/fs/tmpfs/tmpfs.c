@@ -0,0 +1,912 @@
+/*
+ * tmpfs: a filesystem kept entirely in kernel memory.
+ *
+ * A tmpfs volume is a `struct disk` of type VANA_DISK_TYPE_VIRTUAL with no
+ * read or write callbacks. `tmpfs_mount()` registers one, so the volume is
+ * mounted at its own drive number and paths such as `1:/tmp/x` reach it
+ * through the normal VFS and dentry cache. Nothing ever touches a device and the
+ * contents are gone at reboot.
+ *
+ * File data lives in a page list: an array of pointers to TMPFS_PAGE_SIZE
+ * pages indexed by page number. Reads and writes find their page with a
+ * division and copy with memcpy, and the array doubles when it is full so
+ * appending is amortised O(1). Holes left by seeking or truncating past the
+ * end of a file are only given pages when they are written and read back
+ * as zeros. A volume allocates at most VANA_TMPFS_MAX_PAGES data pages.
+ *
+ * Directories are hash tables of their children keyed by name. A table
+ * doubles once it holds two entries per bucket so lookups stay O(1) however
+ * large the directory gets.
+ *
+ * Nodes are reference counted. The dentry cache holds a reference for every
+ * cached entry and each open descriptor holds one. Unlinking removes a node
+ * from its directory at once and it is freed with its last reference.
+ */
+#include "tmpfs.h"
+#include "config.h"
+#include "status.h"
+#include "kernel.h"
+#include "disk/disk.h"
+#include "mount.h"
+#include "inode.h"
+#include "pcache.h"
+#include "string/string.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+#include <stdint.h>
+
+#define TMPFS_PAGE_SIZE VANA_HEAP_BLOCK_SIZE
+
+typedef unsigned int TMPFS_NODE_TYPE;
+#define TMPFS_NODE_FILE 0
+#define TMPFS_NODE_DIRECTORY 1
+
+struct tmpfs_node
+{
+    TMPFS_NODE_TYPE type;
+    char name[VANA_MAX_PATH];
+    uint32_t hash;
+
+    // Directory holding the node and the next node in its hash bucket
+    struct tmpfs_node* parent;
+    struct tmpfs_node* hash_next;
+
+    // References held by the dentry cache and by open descriptors
+    int refcount;
+    // Set once the node has been removed from its directory
+    int unlinked;
+
+    // Files: `size` bytes stored in `pages`, which has room for
+    // `page_slots` pointers. A NULL page is a hole.
+    uint32_t size;
+    char** pages;
+    uint32_t page_slots;
+
+    // Directories: children hashed by name
+    struct tmpfs_node** buckets;
+    uint32_t bucket_count;
+    uint32_t entries;
+};
+
+// Per-volume state stored in disk->fs_private
+struct tmpfs
+{
+    struct tmpfs_node* root;
+    // Data pages allocated by all files of the volume
+    uint32_t pages_used;
+};
+
+struct tmpfs_descriptor
+{
+    struct disk* disk;
+    struct tmpfs_node* node;
+    uint32_t pos;
+    FILE_MODE mode;
+};
+
+int tmpfs_resolve(struct disk* disk);
+int tmpfs_lookup(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+void tmpfs_release(struct disk* disk, void* entry_private);
+void* tmpfs_open(struct disk* disk, struct inode* inode, FILE_MODE mode);
+int tmpfs_read(struct disk* disk, void* descriptor, uint32_t size, uint32_t nmemb, char* out);
+int tmpfs_pread(struct disk* disk, void* descriptor, uint32_t offset, uint32_t total, char* out);
+int tmpfs_readpage(struct disk* disk, struct inode* inode, uint32_t index, char* page);
+int tmpfs_seek(void* private, uint32_t offset, FILE_SEEK_MODE seek_mode);
+int tmpfs_stat(struct disk* disk, void* private, struct file_stat* stat);
+int tmpfs_close(void* private);
+int tmpfs_readdir(struct disk* disk, void* private, FILE_DIRENT_EMIT emit, void* arg);
+int tmpfs_write(struct disk* disk, void* descriptor, uint32_t size, uint32_t nmemb, const char* in);
+int tmpfs_pwrite(struct disk* disk, void* descriptor, uint32_t offset, uint32_t total, const char* in);
+int tmpfs_truncate(struct disk* disk, void* descriptor, uint32_t size);
+int tmpfs_create(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+int tmpfs_unlink(struct disk* disk, void* entry_private);
+int tmpfs_mkdir(struct disk* disk, void* dir_private, const char* name, void** entry_private_out);
+
+struct filesystem tmpfs_fs =
+    {
+        .resolve = tmpfs_resolve,
+        .lookup = tmpfs_lookup,
+        .release = tmpfs_release,
+        .open = tmpfs_open,
+        .read = tmpfs_read,
+        .pread = tmpfs_pread,
+        .seek = tmpfs_seek,
+        .stat = tmpfs_stat,
+        .close = tmpfs_close,
+        .readdir = tmpfs_readdir,
+        .write = tmpfs_write,
+        .pwrite = tmpfs_pwrite,
+        .truncate = tmpfs_truncate,
+        .create = tmpfs_create,
+        .unlink = tmpfs_unlink,
+        .mkdir = tmpfs_mkdir,
+        .readpage = tmpfs_readpage,
+        .case_insensitive = 0
+    };
+
+struct filesystem* tmpfs_init()
+{
+    strcpy(tmpfs_fs.name, "TMPFS");
+    return &tmpfs_fs;
+}
+
+/* FNV-1a hash of a name. */
+static uint32_t tmpfs_hash(const char* name)
+{
+    uint32_t hash = 2166136261u;
+    for (const char* c = name; *c; c++)
+    {
+        hash ^= (uint8_t)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* Allocate an unlinked node. Directories get an empty hash table. */
+static struct tmpfs_node* tmpfs_node_new(TMPFS_NODE_TYPE type, const char* name)
+{
+    struct tmpfs_node* node = kzalloc(sizeof(struct tmpfs_node));
+    if (!node)
+    {
+        return 0;
+    }
+
+    node->type = type;
+    strncpy(node->name, name, sizeof(node->name));
+    node->hash = tmpfs_hash(node->name);
+    if (type == TMPFS_NODE_DIRECTORY)
+    {
+        node->bucket_count = VANA_TMPFS_DIRECTORY_BUCKETS;
+        node->buckets = kzalloc(node->bucket_count * sizeof(struct tmpfs_node*));
+        if (!node->buckets)
+        {
+            kfree(node);
+            return 0;
+        }
+    }
+
+    return node;
+}
+
+/* Free the data pages of a file from page index `first` onwards. */
+static void tmpfs_free_pages(struct tmpfs* tmpfs, struct tmpfs_node* node, uint32_t first)
+{
+    for (uint32_t i = first; i < node->page_slots; i++)
+    {
+        if (node->pages[i])
+        {
+            kfree(node->pages[i]);
+            node->pages[i] = 0;
+            tmpfs->pages_used--;
+        }
+    }
+}
+
+/* Free a node that is no longer linked or referenced. */
+static void tmpfs_node_free(struct tmpfs* tmpfs, struct tmpfs_node* node)
+{
+    if (node->pages)
+    {
+        tmpfs_free_pages(tmpfs, node, 0);
+        kfree(node->pages);
+    }
+
+    if (node->buckets)
+    {
+        kfree(node->buckets);
+    }
+
+    kfree(node);
+}
+
+/* Drop a reference, freeing an unlinked node with its last one. */
+static void tmpfs_node_put(struct disk* disk, struct tmpfs_node* node)
+{
+    node->refcount--;
+    if (node->refcount <= 0 && node->unlinked)
+    {
+        tmpfs_node_free(disk->fs_private, node);
+    }
+}
+
+static struct tmpfs_node* tmpfs_directory_find(struct tmpfs_node* directory, const char* name)
+{
+    uint32_t hash = tmpfs_hash(name);
+    struct tmpfs_node* node = directory->buckets[hash % directory->bucket_count];
+    for (; node; node = node->hash_next)
+    {
+        if (node->hash == hash && strncmp(node->name, name, sizeof(node->name)) == 0)
+        {
+            return node;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Double the hash table of a directory and rehash its children. A failed
+ * allocation keeps the old table, which still works with longer chains.
+ */
+static void tmpfs_directory_grow(struct tmpfs_node* directory)
+{
+    uint32_t bucket_count = directory->bucket_count * 2;
+    struct tmpfs_node** buckets = kzalloc(bucket_count * sizeof(struct tmpfs_node*));
+    if (!buckets)
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < directory->bucket_count; i++)
+    {
+        struct tmpfs_node* node = directory->buckets[i];
+        while (node)
+        {
+            struct tmpfs_node* next = node->hash_next;
+            node->hash_next = buckets[node->hash % bucket_count];
+            buckets[node->hash % bucket_count] = node;
+            node = next;
+        }
+    }
+
+    kfree(directory->buckets);
+    directory->buckets = buckets;
+    directory->bucket_count = bucket_count;
+}
+
+static void tmpfs_directory_insert(struct tmpfs_node* directory, struct tmpfs_node* node)
+{
+    if (directory->entries >= directory->bucket_count * 2)
+    {
+        tmpfs_directory_grow(directory);
+    }
+
+    uint32_t bucket = node->hash % directory->bucket_count;
+    node->parent = directory;
+    node->hash_next = directory->buckets[bucket];
+    directory->buckets[bucket] = node;
+    directory->entries++;
+}
+
+static void tmpfs_directory_remove(struct tmpfs_node* directory, struct tmpfs_node* node)
+{
+    struct tmpfs_node** link = &directory->buckets[node->hash % directory->bucket_count];
+    while (*link && *link != node)
+    {
+        link = &(*link)->hash_next;
+    }
+
+    if (*link)
+    {
+        *link = node->hash_next;
+        directory->entries--;
+    }
+
+    node->hash_next = 0;
+    node->parent = 0;
+}
+
+/*
+ * Make the page list of a file long enough for `pages` pages, doubling it
+ * so a file grown by repeated appends is copied only O(log n) times.
+ */
+static int tmpfs_reserve_pages(struct tmpfs_node* node, uint32_t pages)
+{
+    if (pages <= node->page_slots)
+    {
+        return 0;
+    }
+
+    uint32_t page_slots = node->page_slots ? node->page_slots : TMPFS_PAGE_SIZE / sizeof(char*);
+    while (page_slots < pages)
+    {
+        page_slots *= 2;
+    }
+
+    char** list = kzalloc(page_slots * sizeof(char*));
+    if (!list)
+    {
+        return -ENOMEM;
+    }
+
+    if (node->pages)
+    {
+        memcpy(list, node->pages, node->page_slots * sizeof(char*));
+        kfree(node->pages);
+    }
+
+    node->pages = list;
+    node->page_slots = page_slots;
+    return 0;
+}
+
+/* Pages needed to hold `size` bytes. */
+static uint32_t tmpfs_pages_for(uint32_t size)
+{
+    return size / TMPFS_PAGE_SIZE + (size % TMPFS_PAGE_SIZE ? 1 : 0);
+}
+
+/* Copy `total` bytes at `offset` out of a file, reading holes as zeros. */
+static void tmpfs_read_bytes(struct tmpfs_node* node, uint32_t offset, uint32_t total, char* out)
+{
+    while (total > 0)
+    {
+        uint32_t page = offset / TMPFS_PAGE_SIZE;
+        uint32_t page_offset = offset % TMPFS_PAGE_SIZE;
+        uint32_t chunk = TMPFS_PAGE_SIZE - page_offset;
+        if (chunk > total)
+        {
+            chunk = total;
+        }
+
+        if (page < node->page_slots && node->pages[page])
+        {
+            memcpy(out, node->pages[page] + page_offset, chunk);
+        }
+        else
+        {
+            memset(out, 0, chunk);
+        }
+
+        offset += chunk;
+        out += chunk;
+        total -= chunk;
+    }
+}
+
+/*
+ * Copy `total` bytes into a file at `offset`, allocating the pages that are
+ * written. The file's size is not changed.
+ *
+ * @return Zero, -ENOSPC once the volume's page budget is used up or
+ *         -ENOMEM.
+ */
+static int tmpfs_write_bytes(struct tmpfs* tmpfs, struct tmpfs_node* node, uint32_t offset, uint32_t total, const char* in)
+{
+    int res = tmpfs_reserve_pages(node, tmpfs_pages_for(offset + total));
+    if (res < 0)
+    {
+        return res;
+    }
+
+    while (total > 0)
+    {
+        uint32_t page = offset / TMPFS_PAGE_SIZE;
+        uint32_t page_offset = offset % TMPFS_PAGE_SIZE;
+        uint32_t chunk = TMPFS_PAGE_SIZE - page_offset;
+        if (chunk > total)
+        {
+            chunk = total;
+        }
+
+        if (!node->pages[page])
+        {
+            if (tmpfs->pages_used >= VANA_TMPFS_MAX_PAGES)
+            {
+                return -ENOSPC;
+            }
+
+            node->pages[page] = kzalloc(TMPFS_PAGE_SIZE);
+            if (!node->pages[page])
+            {
+                return -ENOMEM;
+            }
+            tmpfs->pages_used++;
+        }
+
+        memcpy(node->pages[page] + page_offset, (void*)in, chunk);
+        offset += chunk;
+        in += chunk;
+        total -= chunk;
+    }
+
+    return 0;
+}
+
+/*
+ * Change the size of a file. Pages past the new end are freed and the
+ * rest of the last page is cleared, so bytes that later come back into
+ * the file read as zeros. Growing only moves the size; the new range is a
+ * hole.
+ */
+static void tmpfs_resize(struct tmpfs* tmpfs, struct tmpfs_node* node, uint32_t size)
+{
+    if (size < node->size && node->pages)
+    {
+        tmpfs_free_pages(tmpfs, node, tmpfs_pages_for(size));
+
+        uint32_t page = size / TMPFS_PAGE_SIZE;
+        uint32_t page_offset = size % TMPFS_PAGE_SIZE;
+        if (page_offset && page < node->page_slots && node->pages[page])
+        {
+            memset(node->pages[page] + page_offset, 0, TMPFS_PAGE_SIZE - page_offset);
+        }
+    }
+
+    node->size = size;
+}
+
+/*
+ * Claim virtual disks created by tmpfs_mount() and give them an empty root
+ * directory. Every other disk is refused.
+ */
+int tmpfs_resolve(struct disk* disk)
+{
+    if (disk->type != VANA_DISK_TYPE_VIRTUAL)
+    {
+        return -EFSNOTUS;
+    }
+
+    struct tmpfs* tmpfs = kzalloc(sizeof(struct tmpfs));
+    if (!tmpfs)
+    {
+        return -ENOMEM;
+    }
+
+    tmpfs->root = tmpfs_node_new(TMPFS_NODE_DIRECTORY, "/");
+    if (!tmpfs->root)
+    {
+        kfree(tmpfs);
+        return -ENOMEM;
+    }
+
+    disk->fs_private = tmpfs;
+    return 0;
+}
+
+/*
+ * Create and register an empty tmpfs volume.
+ *
+ * @return The volume's drive number or a negative status code.
+ */
+int tmpfs_mount()
+{
+    struct disk* disk = kzalloc(sizeof(struct disk));
+    if (!disk)
+    {
+        return -ENOMEM;
+    }
+
+    disk->type = VANA_DISK_TYPE_VIRTUAL;
+    disk->sector_size = VANA_SECTOR_SIZE;
+    int res = disk_register(disk);
+    if (res < 0)
+    {
+        kfree(disk);
+        return res;
+    }
+
+    if (disk->filesystem != &tmpfs_fs)
+    {
+        panic("tmpfs volume was not claimed by tmpfs\n");
+    }
+
+    return mount_drive_number(disk);
+}
+
+/* The directory node for `dir_private`, which is NULL for the root. */
+static struct tmpfs_node* tmpfs_directory(struct disk* disk, void* dir_private)
+{
+    struct tmpfs* tmpfs = disk->fs_private;
+    return dir_private ? dir_private : tmpfs->root;
+}
+
+/*
+ * Filesystem lookup callback. A hash table probe in the parent directory;
+ * the node itself is the entry's private data and gains a reference.
+ */
+int tmpfs_lookup(struct disk* disk, void* dir_private, const char* name, void** entry_private_out)
+{
+    struct tmpfs_node* directory = tmpfs_directory(disk, dir_private);
+    if (directory->type != TMPFS_NODE_DIRECTORY)
+    {
+        return -ENOENT;
+    }
+
+    struct tmpfs_node* node = tmpfs_directory_find(directory, name);
+    if (!node)
+    {
+        return -ENOENT;
+    }
+
+    node->refcount++;
+    *entry_private_out = node;
+    return 0;
+}
+
+/* Filesystem release callback dropping the dentry cache's reference. */
+void tmpfs_release(struct disk* disk, void* entry_private)
+{
+    tmpfs_node_put(disk, entry_private);
+}
+
+/* Add a new node named `name` to a directory; see tmpfs_create(). */
+static int tmpfs_new_entry(struct disk* disk, void* dir_private, const char* name, TMPFS_NODE_TYPE type, void** entry_private_out)
+{
+    struct tmpfs_node* directory = tmpfs_directory(disk, dir_private);
+    if (directory->type != TMPFS_NODE_DIRECTORY)
+    {
+        return -ENOENT;
+    }
+
+    if (name[0] == 0)
+    {
+        return -EBADPATH;
+    }
+
+    if (tmpfs_directory_find(directory, name))
+    {
+        return -EISTKN;
+    }
+
+    struct tmpfs_node* node = tmpfs_node_new(type, name);
+    if (!node)
+    {
+        return -ENOMEM;
+    }
+
+    tmpfs_directory_insert(directory, node);
+    node->refcount = 1;
+    *entry_private_out = node;
+    return 0;
+}
+
+/* Filesystem create callback adding an empty file. */
+int tmpfs_create(struct disk* disk, void* dir_private, const char* name, void** entry_private_out)
+{
+    return tmpfs_new_entry(disk, dir_private, name, TMPFS_NODE_FILE, entry_private_out);
+}
+
+/* Filesystem mkdir callback adding an empty directory. */
+int tmpfs_mkdir(struct disk* disk, void* dir_private, const char* name, void** entry_private_out)
+{
+    return tmpfs_new_entry(disk, dir_private, name, TMPFS_NODE_DIRECTORY, entry_private_out);
+}
+
+/*
+ * Filesystem unlink callback. Files and empty directories are taken out of
+ * their directory and their data pages freed; the node itself goes when
+ * the dentry cache releases it.
+ */
+int tmpfs_unlink(struct disk* disk, void* entry_private)
+{
+    struct tmpfs_node* node = entry_private;
+    if (!node || !node->parent)
+    {
+        return -EINVARG;
+    }
+
+    if (node->type == TMPFS_NODE_DIRECTORY && node->entries > 0)
+    {
+        return -EISTKN;
+    }
+
+    tmpfs_directory_remove(node->parent, node);
+    node->unlinked = 1;
+    if (node->pages)
+    {
+        tmpfs_free_pages(disk->fs_private, node, 0);
+    }
+    node->size = 0;
+    return 0;
+}
+
+/*
+ * Filesystem open callback. Directories, the root included, can only be
+ * opened for reading, to be listed with tmpfs_readdir(); FILE_MODE_WRITE truncates a file and FILE_MODE_APPEND positions every
+ * write at its end.
+ */
+void* tmpfs_open(struct disk* disk, struct inode* inode, FILE_MODE mode)
+{
+    struct tmpfs_node* node = tmpfs_directory(disk, inode->fs_private);
+    if (mode != FILE_MODE_READ && node->type == TMPFS_NODE_DIRECTORY)
+    {
+        return ERROR(-EINVARG);
+    }
+
+    struct tmpfs_descriptor* descriptor = kzalloc(sizeof(struct tmpfs_descriptor));
+    if (!descriptor)
+    {
+        return ERROR(-ENOMEM);
+    }
+
+    descriptor->disk = disk;
+    descriptor->node = node;
+    descriptor->mode = mode;
+    node->refcount++;
+    if (mode == FILE_MODE_WRITE)
+    {
+        tmpfs_resize(disk->fs_private, node, 0);
+    }
+
+    return descriptor;
+}
+
+/* Filesystem close callback. */
+int tmpfs_close(void* private)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    tmpfs_node_put(descriptor->disk, descriptor->node);
+    kfree(descriptor);
+    return 0;
+}
+
+/*
+ * Filesystem readdir callback. The children are visited bucket by bucket
+ * and the descriptor's position counts the ones already returned, so a
+ * directory that grows or shrinks between calls may have entries skipped
+ * or listed twice.
+ */
+int tmpfs_readdir(struct disk* disk, void* private, FILE_DIRENT_EMIT emit, void* arg)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    struct tmpfs_node* directory = descriptor->node;
+    if (directory->type != TMPFS_NODE_DIRECTORY)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t index = 0;
+    for (uint32_t i = 0; i < directory->bucket_count; i++)
+    {
+        for (struct tmpfs_node* node = directory->buckets[i]; node; node = node->hash_next, index++)
+        {
+            if (index < descriptor->pos)
+            {
+                continue;
+            }
+
+            int is_directory = node->type == TMPFS_NODE_DIRECTORY;
+            if (emit(arg, node->name, is_directory ? FILE_DIRENT_DIRECTORY : FILE_DIRENT_FILE,
+                     is_directory ? 0 : node->size, 0) < 0)
+            {
+                return 1;
+            }
+            descriptor->pos = index + 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Populate a file_stat structure for an open file. */
+int tmpfs_stat(struct disk* disk, void* private, struct file_stat* stat)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    if (descriptor->node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    stat->filesize = descriptor->node->size;
+    stat->flags = 0;
+    return 0;
+}
+
+/*
+ * Read whole objects from the current position with one memcpy per page.
+ *
+ * @return The number of complete objects read, less than `nmemb` only at
+ *         the end of the file, or a negative status code.
+ */
+int tmpfs_read(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, char* out)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    struct tmpfs_node* node = descriptor->node;
+    if (node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    if (descriptor->pos >= node->size)
+    {
+        return 0;
+    }
+
+    uint32_t available = node->size - descriptor->pos;
+    if (nmemb > available / size)
+    {
+        nmemb = available / size;
+    }
+
+    uint32_t total = size * nmemb;
+    tmpfs_read_bytes(node, descriptor->pos, total, out);
+    descriptor->pos += total;
+    return nmemb;
+}
+
+/*
+ * Read up to `total` bytes from `offset` without moving the position.
+ *
+ * @return The number of bytes read, zero at or past the end of the file.
+ */
+int tmpfs_pread(struct disk* disk, void* private, uint32_t offset, uint32_t total, char* out)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    struct tmpfs_node* node = descriptor->node;
+    if (node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    if (offset >= node->size)
+    {
+        return 0;
+    }
+
+    if (total > node->size - offset)
+    {
+        total = node->size - offset;
+    }
+
+    tmpfs_read_bytes(node, offset, total, out);
+    return total;
+}
+
+/*
+ * Filesystem readpage callback. tmpfs data is already in memory, so the
+ * VFS reads through the descriptor instead; only process mappings, which
+ * need page cache pages, copy file pages here.
+ */
+int tmpfs_readpage(struct disk* disk, struct inode* inode, uint32_t index, char* page)
+{
+    struct tmpfs_node* node = inode->fs_private;
+    if (!node || node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t offset = index * PCACHE_PAGE_SIZE;
+    uint32_t total = 0;
+    if (offset < node->size)
+    {
+        total = node->size - offset;
+        if (total > PCACHE_PAGE_SIZE)
+        {
+            total = PCACHE_PAGE_SIZE;
+        }
+    }
+
+    tmpfs_read_bytes(node, offset, total, page);
+    memset(page + total, 0, PCACHE_PAGE_SIZE - total);
+    return 0;
+}
+
+/*
+ * Write `total` bytes at `offset` of a file open for writing, growing the
+ * file as needed. Writing past the end leaves a hole that reads as zeros.
+ *
+ * @return Zero or a negative status code, in which case the file keeps its
+ *         previous size.
+ */
+static int tmpfs_write_at(struct tmpfs* tmpfs, struct tmpfs_descriptor* descriptor, uint32_t offset, uint32_t total, const char* in)
+{
+    struct tmpfs_node* node = descriptor->node;
+    if (node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    if (descriptor->mode == FILE_MODE_READ)
+    {
+        return -ERDONLY;
+    }
+
+    uint32_t end = offset + total;
+    if (end < offset)
+    {
+        return -EINVARG;
+    }
+
+    int res = tmpfs_write_bytes(tmpfs, node, offset, total, in);
+    if (res < 0)
+    {
+        // Give back pages allocated past the old end of the file
+        tmpfs_free_pages(tmpfs, node, tmpfs_pages_for(node->size));
+        return res;
+    }
+
+    if (end > node->size)
+    {
+        node->size = end;
+    }
+    return 0;
+}
+
+/*
+ * Write objects at the current position, or at the end of the file in
+ * append mode, see tmpfs_write_at().
+ *
+ * @return `nmemb` or a negative status code.
+ */
+int tmpfs_write(struct disk* disk, void* private, uint32_t size, uint32_t nmemb, const char* in)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    if (nmemb > 0xFFFFFFFF / size)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t offset = descriptor->pos;
+    if (descriptor->mode == FILE_MODE_APPEND)
+    {
+        offset = descriptor->node->size;
+    }
+
+    uint32_t total = size * nmemb;
+    int res = tmpfs_write_at(disk->fs_private, descriptor, offset, total, in);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    descriptor->pos = offset + total;
+    return nmemb;
+}
+
+/*
+ * Write `total` bytes at `offset` without moving the position, also for
+ * descriptors opened for appending.
+ *
+ * @return `total` or a negative status code.
+ */
+int tmpfs_pwrite(struct disk* disk, void* private, uint32_t offset, uint32_t total, const char* in)
+{
+    int res = tmpfs_write_at(disk->fs_private, private, offset, total, in);
+    return res < 0 ? res : (int)total;
+}
+
+/* Filesystem truncate callback, see tmpfs_resize(). */
+int tmpfs_truncate(struct disk* disk, void* private, uint32_t size)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    if (descriptor->node->type != TMPFS_NODE_FILE)
+    {
+        return -EINVARG;
+    }
+
+    if (descriptor->mode == FILE_MODE_READ)
+    {
+        return -ERDONLY;
+    }
+
+    tmpfs_resize(disk->fs_private, descriptor->node, size);
+    return 0;
+}
+
+/*
+ * Move the position of an open file. `offset` is signed relative to the
+ * current position or the end of the file. Positions past the end are
+ * allowed; a later write there leaves a hole.
+ */
+int tmpfs_seek(void* private, uint32_t offset, FILE_SEEK_MODE seek_mode)
+{
+    struct tmpfs_descriptor* descriptor = private;
+    int64_t base = 0;
+    switch (seek_mode)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+
+    case SEEK_CUR:
+        base = descriptor->pos;
+        break;
+
+    case SEEK_END:
+        base = descriptor->node->size;
+        break;
+
+    default:
+        return -EINVARG;
+    }
+
+    int64_t pos = base + (int32_t)offset;
+    if (pos < 0 || pos > 0xFFFFFFFF)
+    {
+        return -EINVARG;
+    }
+
+    descriptor->pos = (uint32_t)pos;
+    return 0;
+}
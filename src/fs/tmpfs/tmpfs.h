@@ -0,0 +1,9 @@
+#ifndef TMPFS_H
+#define TMPFS_H
+
+#include "file.h"
+
+struct filesystem* tmpfs_init();
+int tmpfs_mount();
+
+#endif
@@ -11,6 +11,7 @@ global enable_interrupts
 global disable_interrupts
 global isr80h_wrapper
 global interrupt_pointer_table
+global idt_fault_address
 
 enable_interrupts:
     sti
@@ -28,6 +29,12 @@ idt_load:
     pop ebp
     ret
 
+; void* idt_fault_address()
+; Linear address that caused the last page fault
+idt_fault_address:
+    mov eax, cr2
+    ret
+
 no_interrupt:
     pushad
     call no_interrupt_handler
@@ -37,6 +44,11 @@ no_interrupt:
 %macro interrupt 1
     global int%1
     int%1:
+%if %1 = 14
+        ; Drop the page fault error code so the frame matches the other
+        ; vectors and iret finds the return address
+        add esp, 4
+%endif
         pushad
         push esp
         push dword %1
@@ -25,6 +25,7 @@ static struct idtr_desc idtr_descriptor;
 extern void* interrupt_pointer_table[IDT_TOTAL_DESCRIPTORS];
 extern void idt_load(struct idtr_desc* ptr);
 extern void isr80h_wrapper();
+extern void* idt_fault_address();
 
 static ISR80H_COMMAND isr80h_commands[VANA_MAX_ISR80H_COMMANDS];
 
@@ -46,15 +47,42 @@ void interrupt_ignore(struct interrupt_frame* frame)
  * Default exception handler used for early faults.
  *
  * Terminates the current process and schedules the next task. This prevents
- * faulty user code from crashing the entire system during development.
+ * faulty user code from crashing the entire system during development. An
+ * exception taken with no process to blame, such as in the idle task, is a
+ * kernel fault and panics.
  */
 static void idt_handle_exception(struct interrupt_frame* frame)
 {
     (void)frame;
-    process_terminate(task_current()->process);
+    struct task* task = task_current();
+    if (!task || !task->process)
+    {
+        panic("Kernel fault outside of any process\n");
+    }
+
+    process_terminate(task->process);
     task_next();
 }
 
+/**
+ * Page fault handler.
+ *
+ * Faults inside a file mapping of the current process are resolved by
+ * mapping the page from the page cache, after which the faulting
+ * instruction runs again. Any other fault is handled like the remaining
+ * exceptions and ends the process.
+ */
+static void idt_handle_page_fault(struct interrupt_frame* frame)
+{
+    struct task* task = task_current();
+    if (task && task->process && process_fault_page(task->process, idt_fault_address()) == 0)
+    {
+        return;
+    }
+
+    idt_handle_exception(frame);
+}
+
 /**
  * Populate a single entry in the IDT.
  *
@@ -115,7 +143,8 @@ void interrupt_handler(int interrupt, struct interrupt_frame* frame)
  *
  * Vector 0x80 is reserved for system calls from user mode. The first 32
  * vectors are mapped to a simple exception handler that terminates the current
- * task.
+ * task, except for page faults, which may first be resolved for file
+ * mappings.
  */
 void idt_init()
 {
@@ -139,6 +168,7 @@ void idt_init()
     {
         idt_register_interrupt_callback(i, idt_handle_exception);
     }
+    idt_register_interrupt_callback(14, idt_handle_page_fault);
     idt_register_interrupt_callback(0x27, interrupt_ignore);
     idt_register_interrupt_callback(0x2E, interrupt_ignore); // IDE (IRQ14)
     idt_register_interrupt_callback(0x2F, interrupt_ignore);
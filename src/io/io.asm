@@ -2,8 +2,10 @@ section .asm
 
 global insb
 global insw
+global insl
 global outb
 global outw
+global outl
 
 insb:
     push ebp
@@ -27,6 +29,17 @@ insw:
     pop ebp
     ret
 
+insl:
+    push ebp
+    mov ebp, esp
+
+    xor eax, eax
+    mov edx, [ebp+8]
+    in eax, dx
+
+    pop ebp
+    ret
+
 outb:
     push ebp
     mov ebp, esp
@@ -48,3 +61,14 @@ outw:
 
     pop ebp
     ret
+
+outl:
+    push ebp
+    mov ebp, esp
+
+    mov eax, [ebp+12]
+    mov edx, [ebp+8]
+    out dx, eax
+
+    pop ebp
+    ret
@@ -4,13 +4,17 @@
 #ifdef __x86_64__
 unsigned char insb(unsigned short port);
 unsigned short insw(unsigned short port);
+unsigned int insl(unsigned short port);
 void outb(unsigned short port, unsigned char val);
 void outw(unsigned short port, unsigned short val);
+void outl(unsigned short port, unsigned int val);
 #else
 unsigned char insb(unsigned short port);
 unsigned short insw(unsigned short port);
+unsigned int insl(unsigned short port);
 void outb(unsigned short port, unsigned char val);
 void outw(unsigned short port, unsigned short val);
+void outl(unsigned short port, unsigned int val);
 #endif
 
 #endif
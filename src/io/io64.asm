@@ -2,8 +2,10 @@ section .text
 
 global insb
 global insw
+global insl
 global outb
 global outw
+global outl
 
 insb:
     push rbp
@@ -27,6 +29,17 @@ insw:
     pop rbp
     ret
 
+insl:
+    push rbp
+    mov rbp, rsp
+
+    xor eax, eax
+    mov dx, di
+    in eax, dx
+
+    pop rbp
+    ret
+
 outb:
     push rbp
     mov rbp, rsp
@@ -48,3 +61,14 @@ outw:
 
     pop rbp
     ret
+
+outl:
+    push rbp
+    mov rbp, rsp
+
+    mov dx, di
+    mov eax, esi
+    out dx, eax
+
+    pop rbp
+    ret
@@ -0,0 +1,341 @@
+#include "fileio.h"
+#include "task/task.h"
+#include "fs/file.h"
+#include "memory/memory.h"
+#include "memory/heap/kheap.h"
+#include "memory/paging/paging.h"
+#include "config.h"
+#include "status.h"
+#include "kernel.h"
+
+/*
+ * System call implementations for file I/O.
+ *
+ * Data moves directly between the file and the caller's buffers. A user
+ * buffer is only contiguous within a page, so each one is handed to the
+ * VFS as a list of spans that stop at page boundaries, gathered a batch at
+ * a time. A whole readv or writev, however many buffers it names, costs
+ * the program a single trap.
+ *
+ * Directory records are packed into a kernel page by fgetdents() and then
+ * copied out, so one getdents call lists up to a page of entries.
+ */
+
+// Spans handed to the VFS at a time
+#define ISR80H_FILE_SPANS 16
+
+// Progress through the user buffers of one system call
+struct isr80h_file_cursor
+{
+    struct task* task;
+    struct file_iovec* iov;
+    int iovcnt;
+    // Buffer being walked and bytes of it already gathered
+    int index;
+    uint32_t done;
+    // Non-zero if the file is read, so the buffers are written
+    int reading;
+};
+
+/*
+ * Gather the next spans of the user buffers into `spans`.
+ *
+ * @return The number of spans, zero once every buffer was gathered, or
+ *         -EINVARG if the first span lies in memory the task may not use
+ *         that way.
+ */
+static int isr80h_file_gather(struct isr80h_file_cursor* cursor, struct file_iovec* spans, uint32_t* total_out)
+{
+    int count = 0;
+    *total_out = 0;
+    while (count < ISR80H_FILE_SPANS && cursor->index < cursor->iovcnt)
+    {
+        struct file_iovec* iov = &cursor->iov[cursor->index];
+        if (cursor->done == iov->length)
+        {
+            cursor->index++;
+            cursor->done = 0;
+            continue;
+        }
+
+        uint32_t span = 0;
+        void* kernel_ptr = task_user_span(cursor->task, iov->base + cursor->done, iov->length - cursor->done, cursor->reading, &span);
+        if (!kernel_ptr)
+        {
+            // Transfer what was gathered so far and fail on the next call
+            return count > 0 ? count : -EINVARG;
+        }
+
+        spans[count].base = kernel_ptr;
+        spans[count].length = span;
+        count++;
+        cursor->done += span;
+        *total_out += span;
+    }
+
+    return count;
+}
+
+/*
+ * Move data between a file and the user buffers of the cursor, at the
+ * file's position or, if `positional` is set, at `offset`.
+ *
+ * @return The number of bytes transferred, or a negative status code if
+ *         nothing was.
+ */
+static int isr80h_file_transfer(int fd, struct isr80h_file_cursor* cursor, int positional, uint32_t offset)
+{
+    struct file_iovec spans[ISR80H_FILE_SPANS];
+    int total = 0;
+    while (1)
+    {
+        uint32_t wanted = 0;
+        int count = isr80h_file_gather(cursor, spans, &wanted);
+        if (count <= 0)
+        {
+            return total > 0 || count == 0 ? total : count;
+        }
+
+        int res = 0;
+        if (!positional)
+        {
+            res = cursor->reading ? freadv(fd, spans, count) : fwritev(fd, spans, count);
+        }
+        else
+        {
+            for (int i = 0; i < count; i++)
+            {
+                uint32_t at = offset + total + res;
+                int span_res = cursor->reading ? fpread(fd, spans[i].base, spans[i].length, at)
+                                               : fpwrite(fd, spans[i].base, spans[i].length, at);
+                if (span_res < 0)
+                {
+                    res = res > 0 ? res : span_res;
+                    break;
+                }
+
+                res += span_res;
+                if ((uint32_t)span_res < spans[i].length)
+                {
+                    break;
+                }
+            }
+        }
+
+        if (res < 0)
+        {
+            return total > 0 ? total : res;
+        }
+
+        total += res;
+        if ((uint32_t)res < wanted)
+        {
+            return total;
+        }
+    }
+}
+
+/* Copy `size` bytes from task memory into a kernel buffer. */
+static int isr80h_file_copy_from_task(struct task* task, void* virtual, void* out, uint32_t size)
+{
+    while (size > 0)
+    {
+        uint32_t span = 0;
+        void* kernel_ptr = task_user_span(task, virtual, size, 0, &span);
+        if (!kernel_ptr)
+        {
+            return -EINVARG;
+        }
+
+        memcpy(out, kernel_ptr, span);
+        virtual += span;
+        out += span;
+        size -= span;
+    }
+
+    return 0;
+}
+
+/* Copy `size` bytes from a kernel buffer into task memory. */
+static int isr80h_file_copy_to_task(struct task* task, void* in, void* virtual, uint32_t size)
+{
+    while (size > 0)
+    {
+        uint32_t span = 0;
+        void* kernel_ptr = task_user_span(task, virtual, size, 1, &span);
+        if (!kernel_ptr)
+        {
+            return -EINVARG;
+        }
+
+        memcpy(kernel_ptr, in, span);
+        virtual += span;
+        in += span;
+        size -= span;
+    }
+
+    return 0;
+}
+
+/*
+ * Shared body of readv and writev. Arguments on the user stack: the
+ * descriptor, an array of buffers and the number of buffers, at most
+ * VANA_MAX_IOVECS.
+ */
+static int isr80h_file_vector(int reading)
+{
+    struct task* task = task_current();
+    int fd = (int)task_get_stack_item(task, 0);
+    void* iov_user_ptr = task_get_stack_item(task, 1);
+    int iovcnt = (int)task_get_stack_item(task, 2);
+    if (iovcnt < 0 || iovcnt > VANA_MAX_IOVECS)
+    {
+        return -EINVARG;
+    }
+
+    struct file_iovec iov[VANA_MAX_IOVECS];
+    int res = isr80h_file_copy_from_task(task, iov_user_ptr, iov, sizeof(struct file_iovec) * iovcnt);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    struct isr80h_file_cursor cursor = { .task = task, .iov = iov, .iovcnt = iovcnt, .reading = reading };
+    return isr80h_file_transfer(fd, &cursor, 0, 0);
+}
+
+/*
+ * Read a file into, or write it from, one buffer of the task, at the
+ * file's position or, if `positional` is set, at `offset` without moving
+ * the position.
+ *
+ * @return The number of bytes transferred or a negative status code.
+ */
+int isr80h_file_io(struct task* task, int fd, void* buffer, uint32_t length, int reading, int positional, uint32_t offset)
+{
+    struct file_iovec iov = { .base = buffer, .length = length };
+    struct isr80h_file_cursor cursor = { .task = task, .iov = &iov, .iovcnt = 1, .reading = reading };
+    return isr80h_file_transfer(fd, &cursor, positional, offset);
+}
+
+/*
+ * Shared body of pread and pwrite. Arguments on the user stack: the
+ * descriptor, the buffer, its size in bytes and the file offset.
+ */
+static int isr80h_file_positional(int reading)
+{
+    struct task* task = task_current();
+    int fd = (int)task_get_stack_item(task, 0);
+    void* buffer = task_get_stack_item(task, 1);
+    uint32_t length = (uint32_t)task_get_stack_item(task, 2);
+    uint32_t offset = (uint32_t)task_get_stack_item(task, 3);
+    return isr80h_file_io(task, fd, buffer, length, reading, 1, offset);
+}
+
+/*
+ * Open a file for the current process.
+ * Arguments on the user stack: the path and a mode string ("r", "w" or
+ * "a") as for fopen().
+ * Returns the new descriptor number or zero on failure.
+ */
+void* isr80h_command12_open(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    char filename[VANA_MAX_PATH];
+    char mode[4];
+    if (copy_string_from_task(task, task_get_stack_item(task, 0), filename, sizeof(filename)) < 0 ||
+        copy_string_from_task(task, task_get_stack_item(task, 1), mode, sizeof(mode)) < 0)
+    {
+        return 0;
+    }
+
+    return (void*)fopen(filename, mode);
+}
+
+/*
+ * Close the descriptor taken from the user stack.
+ * Returns zero or a negative status code.
+ */
+void* isr80h_command13_close(struct interrupt_frame* frame)
+{
+    (void)frame;
+    int fd = (int)task_get_stack_item(task_current(), 0);
+    return (void*)fclose(fd);
+}
+
+/*
+ * Read from a file at an offset without moving its position.
+ * Returns the number of bytes read or a negative status code.
+ */
+void* isr80h_command14_pread(struct interrupt_frame* frame)
+{
+    (void)frame;
+    return (void*)isr80h_file_positional(1);
+}
+
+/*
+ * Write to a file at an offset without moving its position.
+ * Returns the number of bytes written or a negative status code.
+ */
+void* isr80h_command15_pwrite(struct interrupt_frame* frame)
+{
+    (void)frame;
+    return (void*)isr80h_file_positional(0);
+}
+
+/*
+ * Read from the file's position into each buffer in turn.
+ * Returns the number of bytes read or a negative status code.
+ */
+void* isr80h_command16_readv(struct interrupt_frame* frame)
+{
+    (void)frame;
+    return (void*)isr80h_file_vector(1);
+}
+
+/*
+ * Write each buffer in turn at the file's position.
+ * Returns the number of bytes written or a negative status code.
+ */
+void* isr80h_command17_writev(struct interrupt_frame* frame)
+{
+    (void)frame;
+    return (void*)isr80h_file_vector(0);
+}
+
+/*
+ * List an open directory.
+ * Arguments on the user stack: the descriptor, a buffer and its size in
+ * bytes. The buffer is filled with packed struct file_dirent records from
+ * where the previous call stopped, at most a page of them per call.
+ * Returns the number of bytes filled, zero at the end of the directory, or
+ * a negative status code.
+ */
+void* isr80h_command20_getdents(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    int fd = (int)task_get_stack_item(task, 0);
+    void* buffer = task_get_stack_item(task, 1);
+    uint32_t size = (uint32_t)task_get_stack_item(task, 2);
+    if (size > PAGING_PAGE_SIZE)
+    {
+        size = PAGING_PAGE_SIZE;
+    }
+
+    char* records = kzalloc(PAGING_PAGE_SIZE);
+    if (!records)
+    {
+        return (void*)-ENOMEM;
+    }
+
+    int res = fgetdents(fd, records, size);
+    if (res > 0 && isr80h_file_copy_to_task(task, records, buffer, res) < 0)
+    {
+        res = -EINVARG;
+    }
+
+    kfree(records);
+    return (void*)res;
+}
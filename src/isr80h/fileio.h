@@ -0,0 +1,27 @@
+#ifndef ISR80H_FILEIO_H
+#define ISR80H_FILEIO_H
+
+/*
+ * File system call declarations.
+ * Commands 12 and 13 open and close files in the calling process's
+ * descriptor table, 14 and 15 read and write at an explicit offset and 16
+ * and 17 read and write a list of buffers at the file's position and 20
+ * lists a directory.
+ */
+
+#include <stdint.h>
+
+struct interrupt_frame;
+struct task;
+
+void* isr80h_command12_open(struct interrupt_frame* frame);
+void* isr80h_command13_close(struct interrupt_frame* frame);
+void* isr80h_command14_pread(struct interrupt_frame* frame);
+void* isr80h_command15_pwrite(struct interrupt_frame* frame);
+void* isr80h_command16_readv(struct interrupt_frame* frame);
+void* isr80h_command17_writev(struct interrupt_frame* frame);
+void* isr80h_command20_getdents(struct interrupt_frame* frame);
+
+int isr80h_file_io(struct task* task, int fd, void* buffer, uint32_t length, int reading, int positional, uint32_t offset);
+
+#endif
@@ -5,7 +5,7 @@
  * These functions implement the basic terminal interface exposed through
  * the `isr80h` system call mechanism. User programs invoke them via
  * commands 1-3 to print strings, read keyboard input and write single
- * characters.
+ * characters, and command 23 to wait for a key without polling.
  */
 
 #include "io.h"
@@ -48,3 +48,14 @@ void* isr80h_command3_putchar(struct interrupt_frame* frame)
     terminal_writechar(c, 15);
     return 0;
 }
+
+/*
+ * Return the next character from the keyboard queue, sleeping until a key
+ * is pressed if the queue is empty.
+ */
+void* isr80h_command23_getkey_block(struct interrupt_frame* frame)
+{
+    (void)frame;
+    char c = keyboard_pop_block();
+    return (void*)((int)c);
+}
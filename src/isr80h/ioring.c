@@ -0,0 +1,149 @@
+#include "ioring.h"
+#include "fileio.h"
+#include "task/task.h"
+#include "task/process.h"
+#include "fs/file.h"
+#include "memory/memory.h"
+#include "status.h"
+#include "kernel.h"
+
+/*
+ * I/O rings.
+ *
+ * A process that asks for a ring gets one page of its own memory laid out
+ * as a struct io_ring. It queues open, close, read and write requests in
+ * the submission ring with plain memory writes and then makes one system
+ * call, which runs every queued request in order and posts a completion
+ * for each. A batch of any size costs a single trap, and the program finds
+ * the results in shared memory without copying.
+ *
+ * Disk I/O in this kernel is synchronous, so requests run during the
+ * enter call rather than in the background. Each request behaves exactly
+ * like the matching system call.
+ */
+
+/*
+ * Kernel address of the calling process's ring. The ring lives in memory
+ * the process can free or corrupt, so it is looked up and checked on every
+ * use.
+ */
+static struct io_ring* io_ring_get(struct task* task)
+{
+    void* user_ring = task->process->io_ring;
+    if (!user_ring)
+    {
+        return 0;
+    }
+
+    uint32_t span = 0;
+    struct io_ring* ring = task_user_span(task, user_ring, sizeof(struct io_ring), 1, &span);
+    if (!ring || span != sizeof(struct io_ring) || ring->entries != VANA_IO_RING_ENTRIES)
+    {
+        return 0;
+    }
+
+    return ring;
+}
+
+/* Run one request and return its result. */
+static int io_ring_execute(struct task* task, struct io_ring_sqe* sqe)
+{
+    switch (sqe->opcode)
+    {
+    case IO_RING_OP_NOP:
+        return 0;
+
+    case IO_RING_OP_OPEN:
+    {
+        char filename[VANA_MAX_PATH];
+        char mode[2] = { (char)sqe->mode, 0 };
+        int res = copy_string_from_task(task, sqe->buffer, filename, sizeof(filename));
+        if (res < 0)
+        {
+            return res;
+        }
+
+        int fd = fopen(filename, mode);
+        return fd ? fd : -EIO;
+    }
+
+    case IO_RING_OP_CLOSE:
+        return fclose(sqe->fd);
+
+    case IO_RING_OP_READ:
+    case IO_RING_OP_WRITE:
+    {
+        int positional = sqe->offset != IO_RING_AT_POSITION;
+        return isr80h_file_io(task, sqe->fd, sqe->buffer, sqe->length, sqe->opcode == IO_RING_OP_READ, positional, sqe->offset);
+    }
+
+    default:
+        return -EINVARG;
+    }
+}
+
+/*
+ * Give the calling process its I/O ring, allocating it on first use.
+ * Returns the user address of the ring or NULL on failure.
+ */
+void* isr80h_command18_io_ring_setup(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    struct process* process = task->process;
+    if (io_ring_get(task))
+    {
+        return process->io_ring;
+    }
+
+    // The heap hands out whole pages, so the ring never straddles two
+    struct io_ring* ring = process_malloc(process, sizeof(struct io_ring));
+    if (!ring)
+    {
+        return 0;
+    }
+
+    ring->entries = VANA_IO_RING_ENTRIES;
+    process->io_ring = ring;
+    return ring;
+}
+
+/*
+ * Run every request queued in the calling process's ring, stopping early
+ * only while the completion ring is full.
+ * Returns the number of requests run or a negative status code if the
+ * process has no valid ring.
+ */
+void* isr80h_command19_io_ring_enter(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    struct io_ring* ring = io_ring_get(task);
+    if (!ring)
+    {
+        return (void*)-EINVARG;
+    }
+
+    uint32_t mask = VANA_IO_RING_ENTRIES - 1;
+    if (ring->sq_tail - ring->sq_head > VANA_IO_RING_ENTRIES)
+    {
+        return (void*)-EINVARG;
+    }
+
+    int count = 0;
+    while (ring->sq_head != ring->sq_tail && ring->cq_tail - ring->cq_head < VANA_IO_RING_ENTRIES)
+    {
+        // Copied so the program cannot change the request while it runs
+        struct io_ring_sqe sqe = ring->sq[ring->sq_head & mask];
+        ring->sq_head++;
+
+        int result = io_ring_execute(task, &sqe);
+        struct io_ring_cqe* cqe = &ring->cq[ring->cq_tail & mask];
+        cqe->user_data = sqe.user_data;
+        cqe->result = result;
+        ring->cq_tail++;
+        count++;
+    }
+
+    return (void*)count;
+}
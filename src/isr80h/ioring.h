@@ -0,0 +1,77 @@
+#ifndef ISR80H_IORING_H
+#define ISR80H_IORING_H
+
+#include <stdint.h>
+#include "config.h"
+
+/*
+ * Submission and completion rings shared between a process and the kernel.
+ * Command 18 sets up the ring of the calling process and command 19 runs
+ * the requests queued in it. The same layout is declared for programs in
+ * programs/stdlib/src/vana.h.
+ */
+
+enum
+{
+    IO_RING_OP_NOP = 0,
+    IO_RING_OP_OPEN,
+    IO_RING_OP_CLOSE,
+    IO_RING_OP_READ,
+    IO_RING_OP_WRITE
+};
+
+// Offset of a read or write that uses and advances the file's position
+#define IO_RING_AT_POSITION 0xFFFFFFFF
+
+// A request queued by the program
+struct io_ring_sqe
+{
+    uint8_t opcode;
+    uint8_t reserved[3];
+    int32_t fd;
+    // Data buffer, or the path for IO_RING_OP_OPEN
+    void* buffer;
+    uint32_t length;
+    // File offset, or IO_RING_AT_POSITION
+    uint32_t offset;
+    // IO_RING_OP_OPEN mode: 'r', 'w' or 'a'
+    uint32_t mode;
+    // Copied to the completion untouched
+    uint32_t user_data;
+    uint32_t reserved2;
+};
+
+// The result of one request: the value the matching system call would
+// return, with failures as negative status codes
+struct io_ring_cqe
+{
+    uint32_t user_data;
+    int32_t result;
+};
+
+/*
+ * Both queues run on free-running indexes, masked by `entries - 1` to find
+ * a slot. The program fills submission slots and advances `sq_tail`; the
+ * kernel consumes them by advancing `sq_head`. The kernel fills completion
+ * slots and advances `cq_tail`; the program consumes them by advancing
+ * `cq_head`.
+ */
+struct io_ring
+{
+    uint32_t sq_head;
+    uint32_t sq_tail;
+    uint32_t cq_head;
+    uint32_t cq_tail;
+    uint32_t entries;
+    uint32_t reserved;
+
+    struct io_ring_sqe sq[VANA_IO_RING_ENTRIES];
+    struct io_ring_cqe cq[VANA_IO_RING_ENTRIES];
+};
+
+struct interrupt_frame;
+
+void* isr80h_command18_io_ring_setup(struct interrupt_frame* frame);
+void* isr80h_command19_io_ring_enter(struct interrupt_frame* frame);
+
+#endif
@@ -11,6 +11,9 @@
 #include "heap.h"
 #include "process.h"
 #include "misc.h"
+#include "mmap.h"
+#include "fileio.h"
+#include "ioring.h"
 
 void isr80h_register_commands()
 {
@@ -24,4 +27,18 @@ void isr80h_register_commands()
     isr80h_register_command(ISR80H_COMMAND7_INVOKE_SYSTEM_COMMAND, isr80h_command7_invoke_system_command);
     isr80h_register_command(ISR80H_COMMAND8_GET_PROGRAM_ARGUMENTS, isr80h_command8_get_program_arguments);
     isr80h_register_command(ISR80H_COMMAND9_EXIT, isr80h_command9_exit);
+    isr80h_register_command(ISR80H_COMMAND10_MMAP, isr80h_command10_mmap);
+    isr80h_register_command(ISR80H_COMMAND11_MUNMAP, isr80h_command11_munmap);
+    isr80h_register_command(ISR80H_COMMAND12_OPEN, isr80h_command12_open);
+    isr80h_register_command(ISR80H_COMMAND13_CLOSE, isr80h_command13_close);
+    isr80h_register_command(ISR80H_COMMAND14_PREAD, isr80h_command14_pread);
+    isr80h_register_command(ISR80H_COMMAND15_PWRITE, isr80h_command15_pwrite);
+    isr80h_register_command(ISR80H_COMMAND16_READV, isr80h_command16_readv);
+    isr80h_register_command(ISR80H_COMMAND17_WRITEV, isr80h_command17_writev);
+    isr80h_register_command(ISR80H_COMMAND18_IO_RING_SETUP, isr80h_command18_io_ring_setup);
+    isr80h_register_command(ISR80H_COMMAND19_IO_RING_ENTER, isr80h_command19_io_ring_enter);
+    isr80h_register_command(ISR80H_COMMAND20_GETDENTS, isr80h_command20_getdents);
+    isr80h_register_command(ISR80H_COMMAND21_SETPRIORITY, isr80h_command21_setpriority);
+    isr80h_register_command(ISR80H_COMMAND22_GETPRIORITY, isr80h_command22_getpriority);
+    isr80h_register_command(ISR80H_COMMAND23_GETKEY_BLOCK, isr80h_command23_getkey_block);
 }
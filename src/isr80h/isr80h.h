@@ -12,7 +12,21 @@ enum ISR80H_COMMANDS
     ISR80H_COMMAND6_PROCESS_LOAD_START,
     ISR80H_COMMAND7_INVOKE_SYSTEM_COMMAND,
     ISR80H_COMMAND8_GET_PROGRAM_ARGUMENTS,
-    ISR80H_COMMAND9_EXIT
+    ISR80H_COMMAND9_EXIT,
+    ISR80H_COMMAND10_MMAP,
+    ISR80H_COMMAND11_MUNMAP,
+    ISR80H_COMMAND12_OPEN,
+    ISR80H_COMMAND13_CLOSE,
+    ISR80H_COMMAND14_PREAD,
+    ISR80H_COMMAND15_PWRITE,
+    ISR80H_COMMAND16_READV,
+    ISR80H_COMMAND17_WRITEV,
+    ISR80H_COMMAND18_IO_RING_SETUP,
+    ISR80H_COMMAND19_IO_RING_ENTER,
+    ISR80H_COMMAND20_GETDENTS,
+    ISR80H_COMMAND21_SETPRIORITY,
+    ISR80H_COMMAND22_GETPRIORITY,
+    ISR80H_COMMAND23_GETKEY_BLOCK
 };
 
 void isr80h_register_commands();
@@ -0,0 +1,53 @@
+#include "mmap.h"
+#include "task/task.h"
+#include "task/process.h"
+#include "config.h"
+#include "kernel.h"
+
+/*
+ * System call implementations for file mappings. Mapped pages come from
+ * the page cache and are faulted in on first access, see process_mmap().
+ */
+
+/*
+ * Map a file into the current process.
+ * Arguments on the user stack: the path, the page aligned file offset and
+ * the number of bytes to map (zero for the rest of the file).
+ * Returns the user-space address of the mapping or NULL on failure.
+ */
+void* isr80h_command10_mmap(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    void* filename_user_ptr = task_get_stack_item(task, 0);
+    uint32_t offset = (uint32_t)task_get_stack_item(task, 1);
+    uint32_t length = (uint32_t)task_get_stack_item(task, 2);
+
+    char filename[VANA_MAX_PATH];
+    int res = copy_string_from_task(task, filename_user_ptr, filename, sizeof(filename));
+    if (res < 0)
+    {
+        return 0;
+    }
+
+    void* address = 0;
+    res = process_mmap(task->process, filename, offset, length, 0, &address);
+    if (res < 0)
+    {
+        return 0;
+    }
+
+    return address;
+}
+
+/*
+ * Remove the mapping starting at the address taken from the user stack.
+ * Returns zero or a negative status code.
+ */
+void* isr80h_command11_munmap(struct interrupt_frame* frame)
+{
+    (void)frame;
+    struct task* task = task_current();
+    void* address = task_get_stack_item(task, 0);
+    return (void*)process_munmap(task->process, address);
+}
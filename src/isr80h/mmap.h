@@ -0,0 +1,15 @@
+#ifndef ISR80H_MMAP_H
+#define ISR80H_MMAP_H
+
+/*
+ * File mapping system call declarations.
+ * Command 10 maps a file read-only into the calling process and command 11
+ * removes such a mapping.
+ */
+
+struct interrupt_frame;
+
+void* isr80h_command10_mmap(struct interrupt_frame* frame);
+void* isr80h_command11_munmap(struct interrupt_frame* frame);
+
+#endif
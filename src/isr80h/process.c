@@ -13,6 +13,7 @@
  *  - Command 7 invokes a program with arguments provided by the caller.
  *  - Command 8 returns argc/argv information for the current process.
  *  - Command 9 terminates the running process.
+ *  - Commands 21 and 22 set and read the nice value of a process.
  */
 
 /*
@@ -108,3 +109,70 @@ void* isr80h_command9_exit(struct interrupt_frame* frame)
     task_next();
     return 0;
 }
+
+/*
+ * The process a priority call names: the process with that id, or the
+ * caller for a negative id since ids start at zero.
+ */
+static struct process* isr80h_priority_target(int process_id)
+{
+    if (process_id < 0)
+    {
+        return task_current()->process;
+    }
+
+    return process_get(process_id);
+}
+
+/*
+ * Set the nice value of a process.
+ * Arguments on the user stack: the process id, negative for the caller,
+ * and the nice value from VANA_TASK_NICE_MIN to VANA_TASK_NICE_MAX. A
+ * process may give itself any value, but another process only a higher
+ * one, so no program can raise another above the rest.
+ * Returns zero or -EINVARG if there is no such process, the value is out
+ * of range or it would raise another process's priority.
+ */
+void* isr80h_command21_setpriority(struct interrupt_frame* frame)
+{
+    (void)frame;
+    int process_id = (int)task_get_stack_item(task_current(), 0);
+    int nice = (int)task_get_stack_item(task_current(), 1);
+    if (nice < VANA_TASK_NICE_MIN || nice > VANA_TASK_NICE_MAX)
+    {
+        return (void*)-EINVARG;
+    }
+
+    struct process* process = isr80h_priority_target(process_id);
+    if (!process || !process->task)
+    {
+        return (void*)-EINVARG;
+    }
+
+    if (process->task != task_current() && nice < process->task->nice)
+    {
+        return (void*)-EINVARG;
+    }
+
+    task_set_nice(process->task, nice);
+    return 0;
+}
+
+/*
+ * Read the nice value of a process.
+ * Argument on the user stack: the process id, negative for the caller.
+ * Returns 20 minus the nice value, always positive so it cannot be
+ * mistaken for the -EINVARG returned if there is no such process.
+ */
+void* isr80h_command22_getpriority(struct interrupt_frame* frame)
+{
+    (void)frame;
+    int process_id = (int)task_get_stack_item(task_current(), 0);
+    struct process* process = isr80h_priority_target(process_id);
+    if (!process || !process->task)
+    {
+        return (void*)-EINVARG;
+    }
+
+    return (void*)(20 - process->task->nice);
+}
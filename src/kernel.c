@@ -20,9 +20,12 @@
 #include "isr80h/isr80h.h"
 #include "disk/disk.h"
 #include "disk/streamer.h"
+#include "pci/pci.h"
 #include "fs/file.h"
+#include "fs/tmpfs/tmpfs.h"
 #include "status.h"
 #include "io/io.h"
+#include "pit/pit.h"
 #include <stddef.h>
 #include <stdint.h>
 
@@ -257,16 +260,33 @@ void kernel_main()
     isr80h_register_commands();
     print("IDT initialized.\n");
 
-    // Ignore spurious timer interrupts until proper handlers exist
-    idt_register_interrupt_callback(0x20, interrupt_ignore);
+    // The timer tick preempts user tasks once their time slice is used up
+    pit_init(VANA_TIMER_HZ);
+    idt_register_interrupt_callback(PIT_INTERRUPT, task_timer_interrupt);
 
     fs_init();
+    pci_init();
     disk_search_and_init();
     struct disk_stream* default_stream = diskstreamer_new(0);
     if (default_stream)
         diskstreamer_close(default_stream);
     print("Disk initialized.\n");
 
+    // Scratch space in memory, reachable as <drive>:/tmp and mounted over
+    // 0:/tmp on the boot disk
+    int tmp_drive = tmpfs_mount();
+    if (tmp_drive >= 0)
+    {
+        char tmp_path[] = "0:/tmp";
+        tmp_path[0] += tmp_drive;
+        fmkdir(tmp_path);
+        if (tmp_drive != 0)
+        {
+            fmount(tmp_path, "0:/tmp");
+        }
+        print("tmpfs mounted.\n");
+    }
+
     keyboard_init();
     print("Keyboard initialized.\n");
     kernel_chunk =
@@ -7,12 +7,17 @@
  * `keyboard_push()` while consumers call `keyboard_pop()` to retrieve
  * them. `keyboard_init()` registers available drivers (currently only the
  * classic PS/2 implementation) so they can hook their IRQ handlers.
+ *
+ * Tasks that want to wait for input sleep in `keyboard_wait` through
+ * `keyboard_pop_block()` and are woken by the next push, so a task waiting
+ * for a key uses no CPU time until IRQ 1 fires.
  */
 #include "keyboard.h"
 #include "status.h"
 #include "classic.h"
 #include "io/io.h"
 #include "idt/idt.h"
+#include "task/task.h"
 #include <stdint.h>
 
 static struct keyboard* keyboard_list_head = 0;
@@ -33,6 +38,9 @@ struct keyboard_buffer
 
 static struct keyboard_buffer kbuffer;
 
+// Tasks asleep until a character is pushed
+static struct task_wait_queue keyboard_wait;
+
 /* Initialise the keyboard subsystem and register built-in drivers. */
 void keyboard_init()
 {
@@ -111,6 +119,7 @@ void keyboard_push(char c)
     int real_index = keyboard_get_tail_index();
     kbuffer.buffer[real_index] = c;
     kbuffer.tail++;
+    task_wakeup(&keyboard_wait);
 }
 
 /* Retrieve the next character from the buffer, or 0 when empty. */
@@ -126,3 +135,19 @@ char keyboard_pop()
     kbuffer.head++;
     return c;
 }
+
+/*
+ * Retrieve the next character, putting the calling task to sleep until a
+ * key is pushed if the buffer is empty. Only valid inside a system call:
+ * the task makes the call again when woken (see task_sleep()), so this
+ * returns only with a character.
+ */
+char keyboard_pop_block()
+{
+    char c = keyboard_pop();
+    if (c == 0)
+    {
+        task_sleep(&keyboard_wait);
+    }
+    return c;
+}
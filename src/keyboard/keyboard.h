@@ -27,6 +27,7 @@ void keyboard_init();
 void keyboard_backspace();
 void keyboard_push(char c);
 char keyboard_pop();
+char keyboard_pop_block();
 int keyboard_insert(struct keyboard* keyboard);
 void keyboard_set_capslock(struct keyboard* keyboard, KEYBOARD_CAPS_LOCK_STATE state);
 KEYBOARD_CAPS_LOCK_STATE keyboard_get_capslock(struct keyboard* keyboard);
@@ -0,0 +1,79 @@
+/*
+ * Slab allocator for small kernel objects.
+ *
+ * The kernel heap hands out whole VANA_HEAP_BLOCK_SIZE blocks, so a
+ * structure of a few dozen bytes allocated with kzalloc() wastes most of a
+ * 4 KiB block and costs a scan of the heap table. A slab cache takes one
+ * block at a time, splits it into objects of a single size and keeps the
+ * unused ones on a free list, so allocating and freeing an object is a
+ * constant time list operation. Blocks are never returned to the heap; a
+ * cache only grows to the most objects it has had in use at once.
+ */
+#include "slab.h"
+#include "kheap.h"
+#include "config.h"
+#include "memory/memory.h"
+
+/* Prepare an empty cache for objects of `object_size` bytes. */
+void slab_init(struct slab_cache* cache, size_t object_size)
+{
+    // Free objects hold the list link, so they are at least a pointer wide
+    // and stay pointer aligned
+    object_size = (object_size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    cache->object_size = object_size;
+    cache->free = 0;
+}
+
+/* Split a new heap block into objects and put them on the free list. */
+static int slab_grow(struct slab_cache* cache)
+{
+    if (cache->object_size > VANA_HEAP_BLOCK_SIZE)
+    {
+        return -1;
+    }
+
+    char* block = kmalloc(VANA_HEAP_BLOCK_SIZE);
+    if (!block)
+    {
+        return -1;
+    }
+
+    size_t count = VANA_HEAP_BLOCK_SIZE / cache->object_size;
+    for (size_t i = 0; i < count; i++)
+    {
+        void** object = (void**)(block + i * cache->object_size);
+        *object = cache->free;
+        cache->free = object;
+    }
+    return 0;
+}
+
+/*
+ * Allocate a zeroed object from the cache.
+ *
+ * @return The object, or NULL if the heap is exhausted.
+ */
+void* slab_alloc(struct slab_cache* cache)
+{
+    if (!cache->free && slab_grow(cache) < 0)
+    {
+        return 0;
+    }
+
+    void** object = cache->free;
+    cache->free = *object;
+    memset(object, 0, cache->object_size);
+    return object;
+}
+
+/* Return an object obtained from slab_alloc() on the same cache. */
+void slab_free(struct slab_cache* cache, void* object)
+{
+    if (!object)
+    {
+        return;
+    }
+
+    *(void**)object = cache->free;
+    cache->free = object;
+}
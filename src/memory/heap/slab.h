@@ -0,0 +1,22 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+/*
+ * A cache of equally sized kernel objects carved out of heap blocks.
+ * Declare one per object type and set it up with slab_init().
+ */
+struct slab_cache
+{
+    size_t object_size;
+
+    // Free objects of every block, linked through their first word
+    void* free;
+};
+
+void slab_init(struct slab_cache* cache, size_t object_size);
+void* slab_alloc(struct slab_cache* cache);
+void slab_free(struct slab_cache* cache, void* object);
+
+#endif
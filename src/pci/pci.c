@@ -0,0 +1,168 @@
+/*
+ * PCI configuration space access and bus enumeration.
+ *
+ * Configuration space is reached through the legacy mechanism #1 ports:
+ * a 32-bit address selecting bus, slot, function and register is written to
+ * 0xCF8 and the register contents are then read or written through 0xCFC.
+ *
+ * `pci_init()` scans every bus once during boot and records the functions it
+ * finds in a small static table. Drivers then look up their controller by
+ * class code or vendor/device id instead of rescanning the bus.
+ */
+#include "pci.h"
+#include "config.h"
+#include "io/io.h"
+#include "memory/memory.h"
+
+static struct pci_device pci_devices[VANA_MAX_PCI_DEVICES];
+static int pci_total_devices = 0;
+
+/* Build the CONFIG_ADDRESS value for a register of the given function. */
+static uint32_t pci_config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)function << 8) | (offset & 0xFC);
+}
+
+/* Read a 32-bit configuration register before a device structure exists. */
+static uint32_t pci_config_read_raw(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(bus, slot, function, offset));
+    return insl(PCI_CONFIG_DATA);
+}
+
+/* Read a 32-bit register from the configuration space of `device`. */
+uint32_t pci_config_read(struct pci_device* device, uint8_t offset)
+{
+    return pci_config_read_raw(device->bus, device->slot, device->function, offset);
+}
+
+/* Write a 32-bit register in the configuration space of `device`. */
+void pci_config_write(struct pci_device* device, uint8_t offset, uint32_t value)
+{
+    outl(PCI_CONFIG_ADDRESS, pci_config_address(device->bus, device->slot, device->function, offset));
+    outl(PCI_CONFIG_DATA, value);
+}
+
+/* Record a present function in the device table. */
+static void pci_add_device(uint8_t bus, uint8_t slot, uint8_t function, uint32_t id)
+{
+    if (pci_total_devices >= VANA_MAX_PCI_DEVICES)
+    {
+        return;
+    }
+
+    struct pci_device* device = &pci_devices[pci_total_devices++];
+    device->bus = bus;
+    device->slot = slot;
+    device->function = function;
+    device->vendor_id = id & 0xFFFF;
+    device->device_id = id >> 16;
+
+    uint32_t class = pci_config_read(device, PCI_CONFIG_CLASS);
+    device->class_code = class >> 24;
+    device->subclass = (class >> 16) & 0xFF;
+    device->prog_if = (class >> 8) & 0xFF;
+    device->interrupt_line = pci_config_read(device, PCI_CONFIG_INTERRUPT_LINE) & 0xFF;
+}
+
+/*
+ * Enumerate all buses by brute force. Function 0 of every slot is probed and
+ * the remaining functions are only examined for multi-function devices.
+ */
+void pci_init()
+{
+    memset(pci_devices, 0, sizeof(pci_devices));
+    pci_total_devices = 0;
+
+    for (int bus = 0; bus < 256; bus++)
+    {
+        for (int slot = 0; slot < 32; slot++)
+        {
+            uint32_t id = pci_config_read_raw(bus, slot, 0, PCI_CONFIG_VENDOR_ID);
+            if ((id & 0xFFFF) == PCI_VENDOR_NONE)
+            {
+                continue;
+            }
+
+            pci_add_device(bus, slot, 0, id);
+
+            // Bit 7 of the header type marks a multi-function device
+            uint32_t header = pci_config_read_raw(bus, slot, 0, PCI_CONFIG_HEADER_TYPE);
+            if (!((header >> 16) & 0x80))
+            {
+                continue;
+            }
+
+            for (int function = 1; function < 8; function++)
+            {
+                id = pci_config_read_raw(bus, slot, function, PCI_CONFIG_VENDOR_ID);
+                if ((id & 0xFFFF) != PCI_VENDOR_NONE)
+                {
+                    pci_add_device(bus, slot, function, id);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Return the `index`th function matching the class triple or NULL when
+ * there are no more matches.
+ */
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int index)
+{
+    for (int i = 0; i < pci_total_devices; i++)
+    {
+        struct pci_device* device = &pci_devices[i];
+        if (device->class_code == class_code && device->subclass == subclass &&
+            device->prog_if == prog_if && index-- == 0)
+        {
+            return device;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return the `index`th function with the given vendor and device id or NULL
+ * when there are no more matches.
+ */
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id, int index)
+{
+    for (int i = 0; i < pci_total_devices; i++)
+    {
+        struct pci_device* device = &pci_devices[i];
+        if (device->vendor_id == vendor_id && device->device_id == device_id &&
+            index-- == 0)
+        {
+            return device;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Read a base address register with its type bits stripped, yielding either
+ * a port number or a physical MMIO address.
+ */
+uint32_t pci_get_bar(struct pci_device* device, int bar)
+{
+    uint32_t value = pci_config_read(device, PCI_CONFIG_BAR0 + (bar * 4));
+    if (value & PCI_BAR_IO_SPACE)
+    {
+        return value & 0xFFFFFFFC;
+    }
+
+    return value & 0xFFFFFFF0;
+}
+
+/* Set decode and bus mastering bits in the command register. */
+void pci_enable(struct pci_device* device, uint16_t command_flags)
+{
+    uint32_t command = pci_config_read(device, PCI_CONFIG_COMMAND);
+    command |= command_flags;
+    pci_config_write(device, PCI_CONFIG_COMMAND, command);
+}
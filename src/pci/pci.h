@@ -0,0 +1,51 @@
+#ifndef PCI_H
+#define PCI_H
+
+#include <stdint.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+// Offsets into the type 0 configuration header
+#define PCI_CONFIG_VENDOR_ID 0x00
+#define PCI_CONFIG_COMMAND 0x04
+#define PCI_CONFIG_CLASS 0x08
+#define PCI_CONFIG_HEADER_TYPE 0x0C
+#define PCI_CONFIG_BAR0 0x10
+#define PCI_CONFIG_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO_SPACE 0x0001
+#define PCI_COMMAND_MEMORY_SPACE 0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+// BAR bit zero distinguishes I/O port ranges from memory ranges
+#define PCI_BAR_IO_SPACE 0x01
+
+#define PCI_VENDOR_NONE 0xFFFF
+
+struct pci_device
+{
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+
+    uint16_t vendor_id;
+    uint16_t device_id;
+
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+
+    // Legacy PIC line routed to INTA# by the firmware
+    uint8_t interrupt_line;
+};
+
+void pci_init();
+uint32_t pci_config_read(struct pci_device* device, uint8_t offset);
+void pci_config_write(struct pci_device* device, uint8_t offset, uint32_t value);
+struct pci_device* pci_find_class(uint8_t class_code, uint8_t subclass, uint8_t prog_if, int index);
+struct pci_device* pci_find_device(uint16_t vendor_id, uint16_t device_id, int index);
+uint32_t pci_get_bar(struct pci_device* device, int bar);
+void pci_enable(struct pci_device* device, uint16_t command_flags);
+
+#endif
@@ -0,0 +1,37 @@
+#include "pit.h"
+#include "io/io.h"
+
+/**
+ * @file pit.c
+ * @brief Programmable Interval Timer setup.
+ *
+ * Channel 0 of the PIT is wired to IRQ0. It divides a fixed 1.193182 MHz
+ * input clock by a 16-bit reload value and raises the interrupt each time
+ * the count runs out, which gives the kernel its periodic tick. The
+ * scheduler uses the tick to preempt the running task.
+ */
+
+/**
+ * Program channel 0 as a rate generator firing `hz` times a second.
+ *
+ * @param hz Requested tick rate. Rates the 16-bit divisor cannot express
+ *           are clamped to the nearest one it can, about 19 Hz at the low
+ *           end.
+ */
+void pit_init(uint32_t hz)
+{
+    uint32_t divisor = hz ? PIT_BASE_FREQUENCY / hz : 0x10000;
+    if (divisor < 1)
+    {
+        divisor = 1;
+    }
+    else if (divisor > 0x10000)
+    {
+        divisor = 0x10000;
+    }
+
+    // A reload value of zero stands for 65536
+    outb(PIT_COMMAND, PIT_COMMAND_CHANNEL0_RATE);
+    outb(PIT_CHANNEL0_DATA, divisor & 0xFF);
+    outb(PIT_CHANNEL0_DATA, (divisor >> 8) & 0xFF);
+}
@@ -0,0 +1,21 @@
+#ifndef PIT_H
+#define PIT_H
+
+#include <stdint.h>
+
+// Input clock of the PIT in Hz
+#define PIT_BASE_FREQUENCY 1193182
+
+#define PIT_CHANNEL0_DATA 0x40
+#define PIT_COMMAND 0x43
+
+// Channel 0, low byte then high byte, mode 2 (rate generator), binary
+#define PIT_COMMAND_CHANNEL0_RATE 0x34
+
+// Vector of IRQ0 after the PICs are remapped
+#define PIT_INTERRUPT 0x20
+
+/** Program channel 0 to raise IRQ0 `hz` times a second. */
+void pit_init(uint32_t hz);
+
+#endif
@@ -11,5 +11,7 @@
 #define EUNIMP 7
 #define EISTKN 8
 #define EINFORMAT 9
+#define ENOENT 10
+#define ENOSPC 11
 
 #endif
@@ -26,6 +26,16 @@ char tolower(char s1)
     return s1;
 }
 
+char toupper(char s1)
+{
+    if (s1 >= 'a' && s1 <= 'z')
+    {
+        s1 -= 32;
+    }
+
+    return s1;
+}
+
 /**
  * Calculate the length of a NUL terminated string.
  *
@@ -23,6 +23,8 @@ int istrncmp(const char* s1, const char* s2, int n);
 int strnlen_terminator(const char* str, int max, char terminator);
 /** Convert an uppercase ASCII character to lowercase. */
 char tolower(char s1);
+/** Convert a lowercase ASCII character to uppercase. */
+char toupper(char s1);
 /** Convert an integer to a decimal string. */
 void int_to_string(int value, char* out);
 
@@ -38,6 +38,7 @@ void tss64_init(uint64_t rsp0)
 #include "memory/memory.h"
 #include "string/string.h"
 #include "fs/file.h"
+#include "fs/pcache.h"
 #include "memory/heap/kheap.h"
 #include "memory/paging/paging.h"
 #include "loader/formats/elfloader.h"
@@ -198,6 +199,303 @@ static struct process_allocation* process_get_allocation_by_addr(struct process*
 }
 
 
+/*
+ * Return the file mapping covering `address`, or NULL if the address lies
+ * outside every mapping of the process.
+ */
+static struct process_mapping* process_get_mapping(struct process* process, void* address)
+{
+    for (int i = 0; i < VANA_MAX_PROCESS_MAPPINGS; i++)
+    {
+        struct process_mapping* mapping = &process->mappings[i];
+        if (mapping->address && address >= mapping->address &&
+            (uint32_t)(address - mapping->address) < mapping->pages * PAGING_PAGE_SIZE)
+        {
+            return mapping;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Return a mapping overlapping the `pages` pages at `address`, or NULL if
+ * the range is free.
+ */
+static struct process_mapping* process_find_overlap(struct process* process, uint32_t address, uint32_t pages)
+{
+    uint32_t end = address + pages * PAGING_PAGE_SIZE;
+    for (int i = 0; i < VANA_MAX_PROCESS_MAPPINGS; i++)
+    {
+        struct process_mapping* mapping = &process->mappings[i];
+        uint32_t start = (uint32_t)mapping->address;
+        if (start && address < start + mapping->pages * PAGING_PAGE_SIZE && start < end)
+        {
+            return mapping;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Find room for `pages` pages in the mmap window, starting at its base and
+ * stepping past every mapping in the way.
+ */
+static void* process_find_mapping_address(struct process* process, uint32_t pages)
+{
+    uint32_t address = VANA_MMAP_VIRTUAL_ADDRESS;
+    uint32_t size = pages * PAGING_PAGE_SIZE;
+    while (address <= VANA_MMAP_VIRTUAL_END && size <= VANA_MMAP_VIRTUAL_END - address)
+    {
+        struct process_mapping* overlap = process_find_overlap(process, address, pages);
+        if (!overlap)
+        {
+            return (void*)address;
+        }
+
+        address = (uint32_t)overlap->address + overlap->pages * PAGING_PAGE_SIZE;
+    }
+
+    return 0;
+}
+
+/*
+ * Map page `index` of a file mapping to its page cache page, read-only.
+ * The page stays referenced until it is unmapped.
+ */
+static int process_map_file_page(struct process* process, struct process_mapping* mapping, uint32_t index)
+{
+    struct pcache_page* page = 0;
+    int res = file_get_page(mapping->file, mapping->first_page + index, &page);
+    if (res < 0)
+    {
+        return res;
+    }
+
+    res = paging_map(process->task->page_directory, mapping->address + index * PAGING_PAGE_SIZE, page->data, PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL);
+    if (res < 0)
+    {
+        pcache_put(page);
+        return res;
+    }
+
+    mapping->mapped[index] = page;
+    return 0;
+}
+
+/*
+ * Map `length` bytes of a file starting at `offset` read-only into a
+ * process, at `address` or, if that is NULL, at the first free spot of the
+ * mmap window. Only the first page is mapped now; the others are left not
+ * present and process_fault_page() maps each from the page cache when it
+ * is first touched, so every process mapping a file shares its cached
+ * pages and nothing is read that is never used.
+ *
+ * @param offset  Page aligned offset of the first mapped byte in the file.
+ * @param length  Bytes to map, cut off at the end of the file. Zero maps
+ *                the rest of the file.
+ * @return Zero with the mapped address in `address_out`, or a negative
+ *         status code.
+ */
+int process_mmap(struct process* process, const char* filename, uint32_t offset, uint32_t length, void* address, void** address_out)
+{
+    int res = 0;
+    struct file_descriptor* file = 0;
+    struct process_mapping* mapping = 0;
+    struct pcache_page** mapped = 0;
+
+    if (offset % PAGING_PAGE_SIZE || !paging_is_aligned(address))
+    {
+        res = -EINVARG;
+        goto out;
+    }
+
+    for (int i = 0; i < VANA_MAX_PROCESS_MAPPINGS; i++)
+    {
+        if (!process->mappings[i].address)
+        {
+            mapping = &process->mappings[i];
+            break;
+        }
+    }
+
+    if (!mapping)
+    {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    // The mapping holds the file itself rather than a descriptor number,
+    // so it does not use up one of the process's numbers
+    res = file_open(filename, "r", &file);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    struct file_stat stat;
+    res = file_stat(file, &stat);
+    if (res < 0)
+    {
+        goto out;
+    }
+
+    if (offset >= stat.filesize)
+    {
+        res = -EINVARG;
+        goto out;
+    }
+
+    if (length == 0 || length > stat.filesize - offset)
+    {
+        length = stat.filesize - offset;
+    }
+
+    uint32_t pages = (length + PAGING_PAGE_SIZE - 1) / PAGING_PAGE_SIZE;
+    if (!address)
+    {
+        address = process_find_mapping_address(process, pages);
+        if (!address)
+        {
+            res = -ENOMEM;
+            goto out;
+        }
+    }
+    else if (process_find_overlap(process, (uint32_t)address, pages))
+    {
+        res = -EISTKN;
+        goto out;
+    }
+
+    mapped = kzalloc(sizeof(struct pcache_page*) * pages);
+    if (!mapped)
+    {
+        res = -ENOMEM;
+        goto out;
+    }
+
+    mapping->address = address;
+    mapping->pages = pages;
+    mapping->first_page = offset / PAGING_PAGE_SIZE;
+    mapping->file = file;
+    mapping->mapped = mapped;
+
+    // Everything but the first page faults in on first access. Mapping the
+    // first page now also refuses files the page cache cannot hold.
+    for (uint32_t i = 1; i < pages; i++)
+    {
+        paging_set(process->task->page_directory->directory_entry, address + i * PAGING_PAGE_SIZE, 0);
+    }
+
+    res = process_map_file_page(process, mapping, 0);
+    if (res < 0)
+    {
+        memset(mapping, 0, sizeof(struct process_mapping));
+        goto out;
+    }
+
+    *address_out = address;
+
+out:
+    if (res < 0)
+    {
+        if (mapped)
+        {
+            kfree(mapped);
+        }
+
+        if (file)
+        {
+            file_close(file);
+        }
+    }
+    return res;
+}
+
+/*
+ * Remove a file mapping: unmap its pages, release them to the page cache
+ * and close the file.
+ */
+static void process_unmap(struct process* process, struct process_mapping* mapping)
+{
+    for (uint32_t i = 0; i < mapping->pages; i++)
+    {
+        if (!mapping->mapped[i])
+        {
+            continue;
+        }
+
+        if (process->task)
+        {
+            paging_set(process->task->page_directory->directory_entry, mapping->address + i * PAGING_PAGE_SIZE, 0);
+        }
+        pcache_put(mapping->mapped[i]);
+    }
+
+    kfree(mapping->mapped);
+    file_close(mapping->file);
+    memset(mapping, 0, sizeof(struct process_mapping));
+}
+
+/*
+ * Unmap the file mapping that starts at `address`.
+ *
+ * @return Zero, or -EINVARG if no mapping starts there.
+ */
+int process_munmap(struct process* process, void* address)
+{
+    for (int i = 0; i < VANA_MAX_PROCESS_MAPPINGS; i++)
+    {
+        struct process_mapping* mapping = &process->mappings[i];
+        if (mapping->address && mapping->address == address)
+        {
+            process_unmap(process, mapping);
+            return 0;
+        }
+    }
+
+    return -EINVARG;
+}
+
+/* Remove every file mapping of an exiting process. */
+static void process_terminate_mappings(struct process* process)
+{
+    for (int i = 0; i < VANA_MAX_PROCESS_MAPPINGS; i++)
+    {
+        if (process->mappings[i].address)
+        {
+            process_unmap(process, &process->mappings[i]);
+        }
+    }
+}
+
+/*
+ * Resolve a page fault at `address` by mapping the page cache page behind
+ * it if the address lies in a file mapping. Called by the page fault
+ * handler in the faulting process's address space.
+ *
+ * @return Zero if the page is now mapped and the access can be retried, or
+ *         a negative status code if the address is not mapped or the page
+ *         was already present, which means a write to a read-only mapping.
+ */
+int process_fault_page(struct process* process, void* address)
+{
+    struct process_mapping* mapping = process_get_mapping(process, address);
+    if (!mapping)
+    {
+        return -EINVARG;
+    }
+
+    uint32_t index = (uint32_t)(address - mapping->address) / PAGING_PAGE_SIZE;
+    if (mapping->mapped[index])
+    {
+        return -ERDONLY;
+    }
+
+    return process_map_file_page(process, mapping, index);
+}
+
 /*
  * Free all heap allocations that a process has made during its lifetime.
  * This prevents memory leaks when a process exits and ensures no stale
@@ -304,6 +602,8 @@ static void process_unlink(struct process* process)
 int process_free_process(struct process* process)
 {
     int res = 0;
+    process_terminate_mappings(process);
+    file_table_close_all(&process->files);
     process_terminate_allocations(process);
     process_free_program_data(process);
 
@@ -545,11 +845,47 @@ int process_map_binary(struct process* process)
     return res;
 }
 
-/* Map all loadable ELF segments for the process. */
+/*
+ * Non-zero if a loadable segment can be mapped straight from the page
+ * cache: it is read-only, has no zero filled tail, starts on a page in
+ * both the file and memory and shares no page with another segment.
+ */
+static bool process_elf_segment_shareable(struct elf_header* header, struct elf32_phdr* phdr)
+{
+    if (phdr->p_type != PT_LOAD || (phdr->p_flags & PF_W) || phdr->p_filesz != phdr->p_memsz ||
+        phdr->p_memsz == 0 || phdr->p_offset % PAGING_PAGE_SIZE || phdr->p_vaddr % PAGING_PAGE_SIZE)
+    {
+        return false;
+    }
+
+    uint32_t end = (uint32_t)paging_align_address((void*)(phdr->p_vaddr + phdr->p_memsz));
+    struct elf32_phdr* phdrs = elf_pheader(header);
+    for (int i = 0; i < header->e_phnum; i++)
+    {
+        struct elf32_phdr* other = &phdrs[i];
+        if (other == phdr || other->p_type != PT_LOAD)
+        {
+            continue;
+        }
+
+        uint32_t other_start = (uint32_t)paging_align_to_lower_page((void*)other->p_vaddr);
+        if (other_start < end && phdr->p_vaddr < other->p_vaddr + other->p_memsz)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 /*
  * Map all loadable ELF segments for the process using the information
  * parsed by the loader. Each program header is mapped with permissions
  * derived from its flags so read-only sections remain protected.
+ * Read-only segments that fill whole pages are mapped from the page cache
+ * like a file mapping, so every process running the program shares one
+ * copy of its code; the rest are mapped from the process's own copy of
+ * the image.
  */
 static int process_map_elf(struct process* process)
 {
@@ -561,6 +897,16 @@ static int process_map_elf(struct process* process)
     for (int i = 0; i < header->e_phnum; i++)
     {
         struct elf32_phdr* phdr = &phdrs[i];
+        if (process_elf_segment_shareable(header, phdr))
+        {
+            void* address = 0;
+            res = process_mmap(process, process->filename, phdr->p_offset, phdr->p_memsz, (void*)phdr->p_vaddr, &address);
+            if (res == 0)
+            {
+                continue;
+            }
+        }
+
         void* phdr_phys_address = elf_phdr_phys_address(elf_file, phdr);
         int flags = PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL;
         if (phdr->p_flags & PF_W)
@@ -5,6 +5,7 @@
 
 #include "task.h"
 #include "config.h"
+#include "fs/file.h"
 
 #define PROCESS_FILETYPE_ELF 0
 #define PROCESS_FILETYPE_BINARY 1
@@ -17,6 +18,24 @@ struct process_allocation
     size_t size;
 };
 
+struct pcache_page;
+
+// A file mapped read-only into the address space of a process
+struct process_mapping
+{
+    // First mapped virtual address, NULL for an unused slot
+    void* address;
+    // Mapped pages; page i shows page first_page + i of the file
+    uint32_t pages;
+    uint32_t first_page;
+
+    // The file, kept open while it is mapped
+    struct file_descriptor* file;
+
+    // Page cache pages faulted in so far, NULL for pages not yet touched
+    struct pcache_page** mapped;
+};
+
 struct command_argument
 {
     char argument[512];
@@ -42,6 +61,15 @@ struct process
     // The memory (malloc) allocations of the process
     struct process_allocation allocations[VANA_MAX_PROGRAM_ALLOCATIONS];
 
+    // Files mapped into the process, see process_mmap()
+    struct process_mapping mappings[VANA_MAX_PROCESS_MAPPINGS];
+
+    // Files the process has open, numbered by fopen()
+    struct file_table files;
+
+    // User address of the process's I/O ring, NULL until it asks for one
+    void* io_ring;
+
     PROCESS_FILETYPE filetype;
 
     union
@@ -78,6 +106,10 @@ struct process* process_get(int process_id);
 void* process_malloc(struct process* process, size_t size);
 void process_free(struct process* process, void* ptr);
 
+int process_mmap(struct process* process, const char* filename, uint32_t offset, uint32_t length, void* address, void** address_out);
+int process_munmap(struct process* process, void* address);
+int process_fault_page(struct process* process, void* address);
+
 void process_get_arguments(struct process* process, int* argc, char*** argv);
 int process_inject_arguments(struct process* process, struct command_argument* root_argument);
 int process_terminate(struct process* process);
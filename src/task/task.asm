@@ -3,6 +3,7 @@ section .asm
 
 global restore_general_purpose_registers
 global task_return
+global task_return_kernel
 global user_registers
 
 ; void task_return(struct registers* regs);
@@ -46,6 +47,34 @@ task_return:
     ; Let's leave kernel land and execute in user land!
     iretd
     
+; void task_return_kernel(struct registers* regs);
+; Resume a task that runs in ring 0, such as the idle task. An iret that
+; stays in ring 0 does not load a stack, so the task's stack is switched
+; to first. The flags are used as saved, interrupts included.
+task_return_kernel:
+    mov ebx, [esp+4]
+
+    ; Switch to the task's stack
+    mov esp, [ebx+40]
+
+    ; Push the flags, the code segment and the IP to execute
+    push dword [ebx+36]
+    push dword [ebx+32]
+    push dword [ebx+28]
+
+    ; Setup some segment registers
+    mov ax, [ebx+44]
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+
+    push ebx
+    call restore_general_purpose_registers
+    add esp, 4
+
+    iretd
+
 ; void restore_general_purpose_registers(struct registers* regs);
 restore_general_purpose_registers:
     push ebp
@@ -8,26 +8,54 @@
 #include "memory/paging/paging.h"
 #include "loader/formats/elfloader.h"
 #include "idt/idt.h"
+#include "pic/pic.h"
+#include "pit/pit.h"
 
 #ifdef __x86_64__
 /* Assembly helper that restores registers and returns to user mode. */
 extern void task_switch64(struct registers* regs);
 #endif
 /*
- * Pointer to the task that currently owns the CPU. The scheduler keeps
- * tasks in a doubly linked list and `current_task` always references the
- * head that is executing. Context switches update this pointer before
- * restoring the saved register state of the next task.
+ * Pointer to the task that currently owns the CPU. Context switches update
+ * this pointer before restoring the saved register state of the next task.
  */
 struct task *current_task = 0;
 
 /*
- * Head and tail of the run queue. Tasks are scheduled cooperatively in a
- * simple round-robin fashion. New tasks are appended to the tail and the
- * scheduler walks the list in order when `task_next()` is invoked.
+ * Run queues, one per priority level with 0 the highest. Every runnable
+ * task, the running one included, sits in the queue of its `priority`;
+ * bit n of `task_ready` is set while queue n is non-empty, so the highest
+ * non-empty queue is found with a single count of trailing zeros however
+ * many tasks there are. Within a level tasks take turns round-robin.
  */
-struct task *task_tail = 0;
-struct task *task_head = 0;
+struct task_queue
+{
+    struct task *head;
+    struct task *tail;
+};
+
+static struct task_queue task_queues[VANA_TASK_PRIORITIES];
+static uint32_t task_ready = 0;
+
+// Tasks asleep in a wait queue
+static uint32_t task_blocked = 0;
+
+/*
+ * The idle task runs when no other task is runnable. It is in no run
+ * queue and owns no process: it runs task_idle_loop() in ring 0 on its own
+ * stack, and as it keeps no state it starts from the top each time.
+ */
+static struct task task_idle;
+static char task_idle_stack[VANA_TASK_IDLE_STACK_SIZE] __attribute__((aligned(16)));
+
+// Length of the int 0x80 instruction a sleeping task runs again when woken
+#define TASK_SYSCALL_INSTRUCTION_SIZE 2
+
+// Timer interrupts since boot
+static uint32_t task_ticks = 0;
+
+// Timer ticks left before the running task is preempted
+static uint32_t task_slice_left = 0;
 
 int task_init(struct task *task, struct process *process);
 
@@ -42,10 +70,98 @@ struct task *task_current()
 }
 
 /*
- * Allocate and initialise a new task for the given process. New tasks are
- * inserted at the tail of the run queue so they participate in the
- * round-robin scheduling algorithm. The task starts with a fresh register
- * state and its own page directory created by `task_init()`.
+ * Priority level of a task: its nice value picks one of the levels the
+ * feedback penalty cannot reach past, and each step of penalty moves it
+ * one level down from there.
+ */
+static uint32_t task_level(struct task *task)
+{
+    uint32_t base_levels = VANA_TASK_PRIORITIES - VANA_TASK_FEEDBACK_LEVELS + 1;
+    uint32_t base = (task->nice - VANA_TASK_NICE_MIN) * base_levels / (VANA_TASK_NICE_MAX - VANA_TASK_NICE_MIN + 1);
+    return base + task->penalty;
+}
+
+/* Timer ticks a task runs before it is preempted; lower levels run longer. */
+static uint32_t task_slice(struct task *task)
+{
+    return VANA_TASK_TIME_SLICE_TICKS * (task->penalty + 1);
+}
+
+/* Append a task to the tail of the run queue of its priority. */
+static void task_enqueue(struct task *task)
+{
+    task->priority = task_level(task);
+    struct task_queue *queue = &task_queues[task->priority];
+    task->next = 0;
+    task->prev = queue->tail;
+    if (queue->tail)
+    {
+        queue->tail->next = task;
+    }
+    else
+    {
+        queue->head = task;
+    }
+    queue->tail = task;
+    task->queued = 1;
+    task_ready |= 1u << task->priority;
+}
+
+/* Take a task out of its run queue. */
+static void task_dequeue(struct task *task)
+{
+    if (!task->queued)
+    {
+        return;
+    }
+
+    struct task_queue *queue = &task_queues[task->priority];
+    if (task->prev)
+    {
+        task->prev->next = task->next;
+    }
+    else
+    {
+        queue->head = task->next;
+    }
+
+    if (task->next)
+    {
+        task->next->prev = task->prev;
+    }
+    else
+    {
+        queue->tail = task->prev;
+    }
+
+    task->next = 0;
+    task->prev = 0;
+    task->queued = 0;
+    if (!queue->head)
+    {
+        task_ready &= ~(1u << task->priority);
+    }
+}
+
+/*
+ * Move a queued task to the tail of the queue of its current level, after
+ * its nice value or penalty changed or to let the others in its level
+ * take their turn.
+ */
+static void task_requeue(struct task *task)
+{
+    if (task->queued)
+    {
+        task_dequeue(task);
+        task_enqueue(task);
+    }
+}
+
+/*
+ * Allocate and initialise a new task for the given process. New tasks
+ * start at nice 0 with no penalty and join the tail of their run queue.
+ * The task starts with a fresh register state and its own page directory
+ * created by `task_init()`.
  */
 struct task *task_new(struct process *process)
 {
@@ -63,22 +179,19 @@ struct task *task_new(struct process *process)
         goto out;
     }
 
-    if (task_head == 0)
+    task_enqueue(task);
+    if (!current_task)
     {
-        task_head = task;
-        task_tail = task;
         current_task = task;
-        goto out;
     }
 
-    task_tail->next = task;
-    task->prev = task_tail;
-    task_tail = task;
-
 out:
     if (ISERR(res))
     {
-        task_free(task);
+        if (task)
+        {
+            task_free(task);
+        }
         return ERROR(res);
     }
 
@@ -86,57 +199,87 @@ out:
 }
 
 /*
- * Return the next runnable task in the circular list. When the scheduler
- * reaches the end of the queue it wraps back to `task_head` so every task
- * eventually receives CPU time.
+ * Return the task at the head of the highest priority non-empty run
+ * queue, or the idle task if no task is runnable. O(1) in the number of
+ * tasks.
  */
 struct task *task_get_next()
 {
-    if (!current_task->next)
+    if (!task_ready)
     {
-        return task_head;
+        return &task_idle;
     }
 
-    return current_task->next;
+    return task_queues[__builtin_ctz(task_ready)].head;
 }
 
-/*
- * Detach a task from the scheduling list. Called when a task exits so the
- * scheduler will no longer select it. If the removed task is the current
- * one, `current_task` is advanced to the next runnable entry.
- */
-static void task_list_remove(struct task *task)
+/* Append a task to the tail of a wait queue. */
+static void task_wait_enqueue(struct task_wait_queue *queue, struct task *task)
 {
-    if (task->prev)
+    task->wait_queue = queue;
+    task->next = 0;
+    task->prev = queue->tail;
+    if (queue->tail)
     {
-        task->prev->next = task->next;
+        queue->tail->next = task;
+    }
+    else
+    {
+        queue->head = task;
     }
+    queue->tail = task;
+    task_blocked++;
+}
 
-    if (task == task_head)
+/* Take a blocked task out of the wait queue it sleeps in. */
+static void task_wait_dequeue(struct task *task)
+{
+    struct task_wait_queue *queue = task->wait_queue;
+    if (!queue)
     {
-        task_head = task->next;
+        return;
     }
 
-    if (task == task_tail)
+    if (task->prev)
     {
-        task_tail = task->prev;
+        task->prev->next = task->next;
+    }
+    else
+    {
+        queue->head = task->next;
     }
 
-    if (task == current_task)
+    if (task->next)
     {
-        current_task = task_get_next();
+        task->next->prev = task->prev;
+    }
+    else
+    {
+        queue->tail = task->prev;
     }
+
+    task->next = 0;
+    task->prev = 0;
+    task->wait_queue = 0;
+    task_blocked--;
 }
 
 /*
- * Destroy a task and release its resources. The task is removed from the
- * run queue and its paging structures are freed so no stale mappings
- * remain. Called when a process exits.
+ * Destroy a task and release its resources. The task becomes a zombie and
+ * leaves its run queue or wait queue, and its paging structures are freed
+ * so no stale mappings remain. Called when a process exits. If the task
+ * was running, `current_task` moves on to the next runnable one.
  */
 int task_free(struct task *task)
 {
+    task->state = TASK_ZOMBIE;
     paging_free_4gb(task->page_directory);
-    task_list_remove(task);
+    task_dequeue(task);
+    task_wait_dequeue(task);
+    if (task == current_task)
+    {
+        current_task = task_get_next();
+    }
 
     /* Finally free the task data structure itself */
     kfree(task);
@@ -144,16 +287,54 @@ int task_free(struct task *task)
 }
 
 /*
- * Select the next task in the run queue and perform a context switch to it.
- * This implements the cooperative round-robin behaviour where each task
- * voluntarily yields control and the scheduler rotates through the list.
+ * Body of the idle task. The CPU sleeps in hlt until an interrupt arrives
+ * and the loop hands over as soon as one of them made a task runnable.
+ * Interrupts are only enabled while halted: sti takes effect after the
+ * next instruction, so no interrupt can slip in between checking the run
+ * queues and halting and leave the CPU asleep with a task ready.
+ */
+static void task_idle_loop()
+{
+    while (1)
+    {
+        if (task_ready)
+        {
+            task_next();
+        }
+        asm volatile("sti; hlt; cli" ::: "memory");
+    }
+}
+
+/* Make the idle task current and start its loop afresh on its stack. */
+static void task_run_idle()
+{
+    task_idle.state = TASK_RUNNABLE;
+    task_idle.registers.ip = (uint32_t)task_idle_loop;
+    task_idle.registers.cs = KERNEL_CODE_SELECTOR;
+    task_idle.registers.ss = KERNEL_DATA_SELECTOR;
+    task_idle.registers.esp = (uint32_t)(task_idle_stack + sizeof(task_idle_stack));
+    task_idle.registers.flags = 0;
+
+    current_task = &task_idle;
+    kernel_page();
+    task_return_kernel(&task_idle.registers);
+}
+
+/*
+ * Select the highest priority runnable task and perform a context switch
+ * to it. Called when the running task exits, sleeps or is preempted. If
+ * every task is asleep the idle task runs until an interrupt wakes one.
  */
 void task_next()
 {
     struct task* next_task = task_get_next();
-    if (!next_task)
+    if (next_task == &task_idle)
     {
-        panic("No more tasks!\n");
+        if (!task_blocked)
+        {
+            panic("No more tasks!\n");
+        }
+        task_run_idle();
     }
 
     task_switch(next_task);
@@ -164,14 +345,176 @@ void task_next()
 #endif
 }
 
+/*
+ * Multi-level feedback. A task that used up its whole slice drops a level,
+ * down to VANA_TASK_FEEDBACK_LEVELS - 1 levels below where its nice value
+ * puts it, and gets a longer slice there; tasks that give up the CPU early
+ * keep their level. Every VANA_TASK_BOOST_TICKS ticks all penalties are
+ * cleared so demoted tasks cannot starve.
+ */
+static void task_boost_all()
+{
+    for (int level = 0; level < VANA_TASK_PRIORITIES; level++)
+    {
+        struct task *task = task_queues[level].head;
+        while (task)
+        {
+            struct task *next = task->next;
+            if (task->penalty)
+            {
+                task->penalty = 0;
+                task_requeue(task);
+            }
+            task = next;
+        }
+    }
+}
+
+/*
+ * Lift a task that waited instead of running, such as one woken up by
+ * input, back to the top level its nice value allows so it runs ahead of
+ * the tasks using the CPU.
+ */
+void task_boost(struct task *task)
+{
+    if (task->penalty)
+    {
+        task->penalty = 0;
+        task_requeue(task);
+    }
+}
+
+/*
+ * Put the running task to sleep on `queue` until task_wakeup() and run
+ * another task. Only called from a system call, which the task makes again
+ * once woken: its saved instruction pointer is moved back over the int
+ * 0x80, so it retries with the same arguments and either finds what it
+ * waited for or sleeps again. Interrupts are off in the kernel, so no
+ * wakeup can be missed between the caller's check and the sleep. Never
+ * returns.
+ */
+void task_sleep(struct task_wait_queue *queue)
+{
+    struct task *task = current_task;
+    task->registers.ip -= TASK_SYSCALL_INSTRUCTION_SIZE;
+    task_dequeue(task);
+    task->state = TASK_BLOCKED;
+    task_wait_enqueue(queue, task);
+    task_next();
+}
+
+/*
+ * Make every task asleep on `queue` runnable again. They waited rather
+ * than ran, so each is boosted to the top level its nice value allows and
+ * preempts CPU-bound tasks on the next tick. Safe to call from interrupt
+ * handlers.
+ */
+void task_wakeup(struct task_wait_queue *queue)
+{
+    while (queue->head)
+    {
+        struct task *task = queue->head;
+        task_wait_dequeue(task);
+        task->state = TASK_RUNNABLE;
+        task_enqueue(task);
+        task_boost(task);
+    }
+}
+
+/*
+ * IRQ0 handler driving preemption. Every tick charges the running task.
+ * It is preempted once its slice is used up, after dropping a level and
+ * moving to the back of its new queue, or as soon as a task of a higher
+ * level is runnable. Its registers are then saved from the interrupt
+ * frame, exactly as a system call saves them, and the task at the front
+ * of the highest queue takes over. Only user mode is preempted: the
+ * kernel runs with interrupts disabled apart from the moment before the
+ * first task starts and in the idle task, which is never preempted.
+ */
+void task_timer_interrupt(struct interrupt_frame *frame)
+{
+    task_ticks++;
+    if (task_ticks % VANA_TASK_BOOST_TICKS == 0)
+    {
+        task_boost_all();
+    }
+
+    struct task *task = current_task;
+    if (!task || (frame->cs & 3) != 3)
+    {
+        return;
+    }
+
+    if (task_slice_left > 1)
+    {
+        task_slice_left--;
+        if (!(task_ready & ((1u << task->priority) - 1)))
+        {
+            return;
+        }
+    }
+    else
+    {
+        if (task->penalty < VANA_TASK_FEEDBACK_LEVELS - 1)
+        {
+            task->penalty++;
+        }
+        task_requeue(task);
+        task_slice_left = task_slice(task);
+    }
+
+    if (task_get_next() == task)
+    {
+        return;
+    }
+
+    kernel_page();
+    task_current_save_state(frame);
+
+    // task_next() does not return here, so the interrupt is acknowledged now
+    pic_send_eoi(PIT_INTERRUPT - 0x20);
+    task_next();
+}
+
+/* Timer interrupts since boot, at VANA_TIMER_HZ a second. */
+uint32_t task_get_ticks()
+{
+    return task_ticks;
+}
+
+/*
+ * Set the nice value of a task, clamped to VANA_TASK_NICE_MIN to
+ * VANA_TASK_NICE_MAX. A lower value moves the task to a higher level.
+ */
+void task_set_nice(struct task *task, int nice)
+{
+    if (nice < VANA_TASK_NICE_MIN)
+    {
+        nice = VANA_TASK_NICE_MIN;
+    }
+    else if (nice > VANA_TASK_NICE_MAX)
+    {
+        nice = VANA_TASK_NICE_MAX;
+    }
+
+    task->nice = nice;
+    task_requeue(task);
+}
+
 /*
  * Install the given task's page directory and make it the running task.
- * The low-level assembly helper `task_return` restores the saved CPU
- * state after this call so that execution resumes in the context of the
- * new task.
+ * A task switched to from another one starts a fresh slice. The low-level
+ * assembly helper `task_return` restores the saved CPU state after this
+ * call so that execution resumes in the context of the new task.
  */
 int task_switch(struct task *task)
 {
+    // task_page() switches back to the running task after every system
+    // call, which must not renew its slice
+    if (task != current_task)
+    {
+        task_slice_left = task_slice(task);
+    }
     current_task = task;
     paging_switch(task->page_directory);
     return 0;
@@ -258,9 +601,15 @@ void task_current_save_state(struct interrupt_frame *frame)
 /*
  * Switch to the page directory of the current task while keeping kernel
  * privileges. This is used when the kernel needs to access user memory.
+ * The idle task has no page directory and always runs on the kernel's.
  */
 int task_page()
 {
+    if (current_task == &task_idle)
+    {
+        return 0;
+    }
+
     user_registers();
     task_switch(current_task);
     return 0;
@@ -277,8 +626,8 @@ int task_page_task(struct task* task)
 /*
  * Start execution of the very first user task. The boot code sets up a
  * single task in the run queue and once paging and interrupts are ready
- * this function installs that task's directory and jumps to
- * `task_return` to enter user mode.
+ * this function gives it its first slice, installs its directory and jumps
+ * to `task_return` to enter user mode.
  */
 void task_run_first_ever_task()
 {
@@ -287,11 +636,13 @@ void task_run_first_ever_task()
         panic("task_run_first_ever_task(): No current task exists!\n");
     }
 
-    task_switch(task_head);
+    task_slice_left = task_slice(current_task);
+
+    task_switch(current_task);
 #ifdef __x86_64__
-    task_switch64(&task_head->registers);
+    task_switch64(&current_task->registers);
 #else
-    task_return(&task_head->registers);
+    task_return(&current_task->registers);
 #endif
 }
 
@@ -357,3 +708,37 @@ void* task_virtual_address_to_physical(struct task* task, void* virtual_address)
 {
     return paging_get_physical_address(task->page_directory->directory_entry, virtual_address);
 }
+
+/*
+ * Translate the start of a user buffer for direct access by the kernel.
+ * Only the part up to the end of its page is guaranteed to be contiguous,
+ * so callers walk a buffer one span at a time. Pages of a file mapping
+ * that were not touched yet are faulted in first.
+ *
+ * @param write     Non-zero if the kernel will write to the buffer, which
+ *                  then has to be writeable by the task.
+ * @param span_out  Bytes from `virtual` that may be accessed through the
+ *                  returned pointer, at most `size`.
+ * @return          The kernel address of `virtual`, or NULL if the task
+ *                  cannot access the page that way.
+ */
+void* task_user_span(struct task* task, void* virtual, uint32_t size, int write, uint32_t* span_out)
+{
+    uint32_t* directory = task->page_directory->directory_entry;
+    void* page = paging_align_to_lower_page(virtual);
+    uint32_t entry = paging_get(directory, page);
+    if (!(entry & PAGING_IS_PRESENT) && task->process && process_fault_page(task->process, page) == 0)
+    {
+        entry = paging_get(directory, page);
+    }
+
+    uint32_t required = PAGING_IS_PRESENT | PAGING_ACCESS_FROM_ALL | (write ? PAGING_IS_WRITEABLE : 0);
+    if ((entry & required) != required)
+    {
+        return 0;
+    }
+
+    uint32_t span = PAGING_PAGE_SIZE - ((uint32_t)virtual - (uint32_t)page);
+    *span_out = span < size ? span : size;
+    return (void*)((entry & 0xfffff000) + ((uint32_t)virtual - (uint32_t)page));
+}
@@ -23,6 +23,25 @@ struct registers
 };
 
 
+enum
+{
+    // In a run queue, running or waiting for its turn
+    TASK_RUNNABLE,
+    // Asleep in a wait queue until task_wakeup()
+    TASK_BLOCKED,
+    // Its process is being torn down; the task never runs again
+    TASK_ZOMBIE
+};
+
+struct task;
+
+// Tasks asleep until an event, linked through their next and prev
+struct task_wait_queue
+{
+    struct task* head;
+    struct task* tail;
+};
+
 struct process;
 struct task
 {
@@ -37,10 +56,23 @@ struct task
     // The process of the task
     struct process* process;
 
-    // The next task in the linked list
-    struct task* next;
+    // Nice value from VANA_TASK_NICE_MIN to VANA_TASK_NICE_MAX and the
+    // levels the task was demoted by for using up its slices
+    int nice;
+    uint32_t penalty;
+
+    // Run queue the task is in, see task_level()
+    uint32_t priority;
+    int queued;
 
-    // Previous task in the linked list
+    // TASK_RUNNABLE, TASK_BLOCKED or TASK_ZOMBIE
+    int state;
+
+    // Wait queue of a blocked task
+    struct task_wait_queue* wait_queue;
+
+    // Neighbours in the run queue, or in the wait queue while blocked
+    struct task* next;
     struct task* prev;
 };
 
@@ -56,6 +88,7 @@ int task_page_task(struct task* task);
 void task_run_first_ever_task();
 
 void task_return(struct registers* regs);
+void task_return_kernel(struct registers* regs);
 void restore_general_purpose_registers(struct registers* regs);
 void user_registers();
 
@@ -63,6 +96,13 @@ void task_current_save_state(struct interrupt_frame *frame);
 int copy_string_from_task(struct task* task, void* virtual, void* phys, int max);
 void* task_get_stack_item(struct task* task, int index);
 void* task_virtual_address_to_physical(struct task* task, void* virtual_address);
+void* task_user_span(struct task* task, void* virtual, uint32_t size, int write, uint32_t* span_out);
 void task_next();
+void task_timer_interrupt(struct interrupt_frame *frame);
+uint32_t task_get_ticks();
+void task_set_nice(struct task* task, int nice);
+void task_boost(struct task* task);
+void task_sleep(struct task_wait_queue* queue);
+void task_wakeup(struct task_wait_queue* queue);
 
 #endif